@@ -0,0 +1,500 @@
+//
+// Velella
+// bench/bench.c
+//
+// End-to-end benchmark. Generates a deterministic corpus of indexed PNG
+// sprite sheets, writes a script for every data format at every angle it
+// supports, runs velella over each one and reports throughput and peak
+// memory. Results may be compared against (or saved as) a baseline file.
+//
+// Usage: velella_bench [options]
+//   --velella PATH      velella binary to run (default ./velella)
+//   --work DIR          Directory for the corpus and outputs (default bench/out)
+//   --baseline FILE     Compare results against FILE
+//   --write-baseline FILE  Save results to FILE
+//   --tolerance PCT     Allowed slowdown / growth before a regression (default 30)
+//   --runs N            Runs of each script; the fastest is kept (default 5)
+//   -j N                Passed on to velella
+//   --inflate NAME      Passed on to velella
+//
+
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "lodepng.h"
+
+// =======
+// Corpus
+// =======
+
+typedef struct Sheet
+{
+	const char *name;
+	int w, h;
+	int colors;        // Palette size.
+	int cell;          // Size of the grid that content is drawn in.
+	int sparsity;      // Percent of cells left empty; 0 fills every pixel.
+	uint32_t seed;
+} Sheet;
+
+static const Sheet k_sheets[] =
+{
+	{"dense16",  1024, 1024,  16, 32,  0, 0x1234},
+	{"sparse16", 1024,  768,  12, 32, 60, 0x5678},
+	{"dense256",  512,  512, 256, 32,  0, 0x9ABC},
+	{"csp16",     384,  192,  16, 48, 25, 0xDEF0},
+};
+
+static uint32_t rng(uint32_t *s)
+{
+	// xorshift32
+	uint32_t x = *s;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*s = x;
+	return x;
+}
+
+static void sheet_fill(const Sheet *sh, uint8_t *px)
+{
+	uint32_t seed = sh->seed;
+	memset(px, 0, sh->w * sh->h);
+	for (int cy = 0; cy < sh->h; cy += sh->cell)
+	{
+		for (int cx = 0; cx < sh->w; cx += sh->cell)
+		{
+			if (sh->sparsity == 0)
+			{
+				for (int y = cy; y < cy + sh->cell && y < sh->h; y++)
+				{
+					for (int x = cx; x < cx + sh->cell && x < sh->w; x++)
+					{
+						px[(y * sh->w) + x] = rng(&seed) % sh->colors;
+					}
+				}
+				continue;
+			}
+
+			if ((int)(rng(&seed) % 100) < sh->sparsity) continue;
+
+			// An ellipse of runs and noise somewhere in the cell.
+			const int r_min = sh->cell / 6;
+			const int r_span = (sh->cell * 5 / 12) - r_min;
+			const int rx = r_min + rng(&seed) % r_span;
+			const int ry = r_min + rng(&seed) % r_span;
+			const int ox = cx + rx + rng(&seed) % (sh->cell - (2 * rx));
+			const int oy = cy + ry + rng(&seed) % (sh->cell - (2 * ry));
+			const int base = rng(&seed) % sh->colors;
+			for (int y = oy - ry; y <= oy + ry; y++)
+			{
+				for (int x = ox - rx; x <= ox + rx; x++)
+				{
+					const int dx = x - ox;
+					const int dy = y - oy;
+					if ((dx * dx * ry * ry) + (dy * dy * rx * rx) > rx * rx * ry * ry) continue;
+					const int noise = (rng(&seed) % 8) == 0 ? rng(&seed) % 4 : 0;
+					px[(y * sh->w) + x] = 1 + ((base + (x / 3) + (y / 5) + noise) % (sh->colors - 1));
+				}
+			}
+		}
+	}
+}
+
+static bool sheet_write(const Sheet *sh, const char *dir)
+{
+	uint8_t *px = malloc(sh->w * sh->h);
+	if (!px) return false;
+	sheet_fill(sh, px);
+
+	LodePNGState state;
+	lodepng_state_init(&state);
+	state.info_raw.colortype = LCT_PALETTE;
+	state.info_raw.bitdepth = 8;
+	state.info_png.color.colortype = LCT_PALETTE;
+	state.info_png.color.bitdepth = (sh->colors <= 16) ? 4 : 8;
+	state.encoder.auto_convert = 0;
+	for (int i = 0; i < sh->colors; i++)
+	{
+		const uint8_t r = (i * 37) & 0xFF;
+		const uint8_t g = (i * 91) & 0xFF;
+		const uint8_t b = ((i * 53) + sh->colors) & 0xFF;
+		lodepng_palette_add(&state.info_png.color, r, g, b, 255);
+		lodepng_palette_add(&state.info_raw, r, g, b, 255);
+	}
+
+	uint8_t *png = NULL;
+	size_t png_size = 0;
+	unsigned int error = lodepng_encode(&png, &png_size, px, sh->w, sh->h, &state);
+	if (!error)
+	{
+		char fname[512];
+		snprintf(fname, sizeof(fname), "%s/%s.png", dir, sh->name);
+		error = lodepng_save_file(png, png_size, fname);
+	}
+	if (error) fprintf(stderr, "[BENCH] %s: LodePNG error %u: %s\n", sh->name, error,
+	                   lodepng_error_text(error));
+
+	free(png);
+	free(px);
+	lodepng_state_cleanup(&state);
+	return error == 0;
+}
+
+// =======
+// Scripts
+// =======
+
+// One script per case and angle.
+typedef struct Case
+{
+	const char *name;
+	const char *settings;  // Script lines before the first section.
+	bool rotates;          // Run at every angle, or only at 0.
+	bool wide;             // Uses the 8bpp sheet too.
+	bool csp;              // Uses the composite sprite sheet only.
+	int repeat;            // Sections per sheet; 0 means one.
+} Case;
+
+static const Case k_cases[] =
+{
+	{"direct",      "format = direct\npal = atlus\ntilesize = 8\nw = 32\nh = 32\n", true, true},
+	{"sp013_4",     "format = sp013\npal = atlus\ndepth = 4\nw = 32\nh = 32\n", true},
+	{"sp013_8",     "format = sp013\npal = atlus\ndepth = 8\nw = 32\nh = 32\n", true, true},
+	{"bg038_4",     "format = bg038\npal = atlus\ndepth = 4\ntilesize = 16\n", true},
+	{"bg038_8",     "format = bg038\npal = atlus\ndepth = 8\ntilesize = 16\n", true, true},
+	{"cps_spr",     "format = cps_spr\npal = cps\nw = 32\nh = 32\n", true},
+	{"cps_bg_8",    "format = cps_bg\npal = cps\ntilesize = 8\n", true},
+	{"cps_bg_16",   "format = cps_bg\npal = cps\ntilesize = 16\n", true},
+	{"md_spr",      "format = md_spr\npal = md\ntilesize = 8\nw = 32\nh = 32\n", true},
+	{"md_bg",       "format = md_bg\npal = md\ntilesize = 8\n", true},
+	{"md_csp",      "format = md_csp\npal = md\ntilesize = 8\nw = 48\nh = 48\n", false, false, true, 128},
+	{"toa_txt",     "format = toa_txt\npal = toa\ntilesize = 8\n", true},
+	{"toa_gcu_spr", "format = toa_gcu_spr\npal = toa\ntilesize = 8\nw = 32\nh = 32\n", true},
+	{"toa_gcu_bg",  "format = toa_gcu_bg\npal = toa\ntilesize = 16\n", true},
+	{"neo_fix",     "format = neo_fix\npal = neo\ntilesize = 8\n", true},
+	{"neo_spr",     "format = neo_spr\npal = neo\ntilesize = 16\nw = 32\nh = 32\n", true},
+};
+
+static const int k_angles[] = {0, 90, 180, 270};
+
+typedef struct Result
+{
+	char name[64];
+	int entries;
+	double mpix;           // Source megapixels converted.
+	double seconds;        // Fastest run.
+	long peak_rss_kib;     // Largest of all runs.
+} Result;
+
+static const Sheet *sheet_by_name(const char *name)
+{
+	for (size_t i = 0; i < sizeof(k_sheets) / sizeof(k_sheets[0]); i++)
+	{
+		if (strcmp(k_sheets[i].name, name) == 0) return &k_sheets[i];
+	}
+	return NULL;
+}
+
+// Writes the script for a case, and notes how much work it holds.
+static bool script_write(const char *dir, const Case *c, int angle, Result *r)
+{
+	snprintf(r->name, sizeof(r->name), "%s_%d", c->name, angle);
+	char fname[512];
+	snprintf(fname, sizeof(fname), "%s/%s.ini", dir, r->name);
+	FILE *f = fopen(fname, "w");
+	if (!f)
+	{
+		fprintf(stderr, "[BENCH] Couldn't open %s for writing\n", fname);
+		return false;
+	}
+
+	fprintf(f, "out = %s\n%sangle = %d\n", r->name, c->settings, angle);
+
+	const char *srcs[3];
+	int src_count = 0;
+	if (c->csp)
+	{
+		srcs[src_count++] = "csp16";
+	}
+	else
+	{
+		srcs[src_count++] = "dense16";
+		srcs[src_count++] = "sparse16";
+		if (c->wide) srcs[src_count++] = "dense256";
+	}
+
+	r->entries = 0;
+	r->mpix = 0.0;
+	const int repeat = (c->repeat > 0) ? c->repeat : 1;
+	for (int i = 0; i < src_count; i++)
+	{
+		const Sheet *sh = sheet_by_name(srcs[i]);
+		for (int j = 0; j < repeat; j++)
+		{
+			fprintf(f, "[%s_%d]\nsrc = %s.png\n", srcs[i], j, srcs[i]);
+			r->entries++;
+			r->mpix += (sh->w * sh->h) / 1000000.0;
+		}
+	}
+
+	fclose(f);
+	return true;
+}
+
+// =======
+// Running
+// =======
+
+static double now_seconds(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+// Runs velella once in dir, returning the wall time and peak RSS.
+static bool run_once(const char *velella, const char *dir, const char *jobs,
+                     const char *inflate, const char *script, double *seconds, long *rss_kib)
+{
+	const double start = now_seconds();
+	const pid_t pid = fork();
+	if (pid < 0)
+	{
+		fprintf(stderr, "[BENCH] fork: %s\n", strerror(errno));
+		return false;
+	}
+	if (pid == 0)
+	{
+		if (chdir(dir) != 0) _exit(127);
+		freopen("/dev/null", "w", stdout);
+		if (inflate) execl(velella, velella, "-j", jobs, "--inflate", inflate, script, (char *)NULL);
+		else execl(velella, velella, "-j", jobs, script, (char *)NULL);
+		_exit(127);
+	}
+
+	int status = 0;
+	struct rusage ru;
+	if (wait4(pid, &status, 0, &ru) < 0)
+	{
+		fprintf(stderr, "[BENCH] wait4: %s\n", strerror(errno));
+		return false;
+	}
+	*seconds = now_seconds() - start;
+	*rss_kib = ru.ru_maxrss;
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+	{
+		fprintf(stderr, "[BENCH] velella failed on %s (status %d)\n", script, status);
+		return false;
+	}
+	return true;
+}
+
+// =======
+// Baseline
+// =======
+
+typedef struct Baseline
+{
+	char name[64];
+	double mpix_per_s;
+	double entries_per_s;
+	long peak_rss_kib;
+} Baseline;
+
+static int baseline_load(const char *fname, Baseline *b, int max)
+{
+	FILE *f = fopen(fname, "r");
+	if (!f)
+	{
+		fprintf(stderr, "[BENCH] Couldn't open baseline %s\n", fname);
+		return -1;
+	}
+	int count = 0;
+	char line[256];
+	while (count < max && fgets(line, sizeof(line), f))
+	{
+		if (line[0] == '#' || line[0] == '\n') continue;
+		Baseline *e = &b[count];
+		if (sscanf(line, "%63s %lf %lf %ld", e->name, &e->mpix_per_s, &e->entries_per_s,
+		           &e->peak_rss_kib) == 4)
+		{
+			count++;
+		}
+	}
+	fclose(f);
+	return count;
+}
+
+static bool baseline_save(const char *fname, const Result *res, int count)
+{
+	FILE *f = fopen(fname, "w");
+	if (!f)
+	{
+		fprintf(stderr, "[BENCH] Couldn't open %s for writing\n", fname);
+		return false;
+	}
+	fprintf(f, "# velella bench baseline; regenerate with `make bench-baseline`.\n");
+	fprintf(f, "# case  mpix_per_s  entries_per_s  peak_rss_kib\n");
+	for (int i = 0; i < count; i++)
+	{
+		fprintf(f, "%s %.2f %.2f %ld\n", res[i].name, res[i].mpix / res[i].seconds,
+		        res[i].entries / res[i].seconds, res[i].peak_rss_kib);
+	}
+	return fclose(f) == 0;
+}
+
+// =======
+// Main
+// =======
+
+#define BENCH_MAX_RESULTS 128
+
+int main(int argc, char **argv)
+{
+	const char *velella = "./velella";
+	const char *work = "bench/out";
+	const char *baseline_fname = NULL;
+	const char *write_baseline_fname = NULL;
+	const char *jobs = "1";
+	const char *inflate = NULL;
+	double tolerance = 30.0;
+	int runs = 5;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char *arg = argv[i];
+		const char *val = (i + 1 < argc) ? argv[i + 1] : NULL;
+		if (!val)
+		{
+			fprintf(stderr, "[BENCH] Missing value for %s\n", arg);
+			return 2;
+		}
+		if (strcmp(arg, "--velella") == 0) velella = val;
+		else if (strcmp(arg, "--work") == 0) work = val;
+		else if (strcmp(arg, "--baseline") == 0) baseline_fname = val;
+		else if (strcmp(arg, "--write-baseline") == 0) write_baseline_fname = val;
+		else if (strcmp(arg, "--tolerance") == 0) tolerance = strtod(val, NULL);
+		else if (strcmp(arg, "--runs") == 0) runs = strtol(val, NULL, 0);
+		else if (strcmp(arg, "-j") == 0) jobs = val;
+		else if (strcmp(arg, "--inflate") == 0) inflate = val;
+		else
+		{
+			fprintf(stderr, "[BENCH] Unknown option \"%s\"\n", arg);
+			return 2;
+		}
+		i++;
+	}
+	if (runs < 1) runs = 1;
+
+	// The binary is run from inside the work directory.
+	char velella_abs[PATH_MAX];
+	if (!realpath(velella, velella_abs))
+	{
+		fprintf(stderr, "[BENCH] Couldn't find %s\n", velella);
+		return 2;
+	}
+
+	mkdir(work, 0777);
+	for (size_t i = 0; i < sizeof(k_sheets) / sizeof(k_sheets[0]); i++)
+	{
+		if (!sheet_write(&k_sheets[i], work)) return 2;
+	}
+
+	Result res[BENCH_MAX_RESULTS];
+	int res_count = 0;
+	for (size_t i = 0; i < sizeof(k_cases) / sizeof(k_cases[0]); i++)
+	{
+		const Case *c = &k_cases[i];
+		for (size_t a = 0; a < sizeof(k_angles) / sizeof(k_angles[0]); a++)
+		{
+			if (!c->rotates && k_angles[a] != 0) continue;
+			Result *r = &res[res_count++];
+			if (!script_write(work, c, k_angles[a], r)) return 2;
+
+			char script[128];
+			snprintf(script, sizeof(script), "%s.ini", r->name);
+			r->seconds = 0.0;
+			r->peak_rss_kib = 0;
+			for (int run = 0; run < runs; run++)
+			{
+				double seconds;
+				long rss_kib;
+				if (!run_once(velella_abs, work, jobs, inflate, script, &seconds, &rss_kib)) return 2;
+				if (run == 0 || seconds < r->seconds) r->seconds = seconds;
+				if (rss_kib > r->peak_rss_kib) r->peak_rss_kib = rss_kib;
+			}
+		}
+	}
+
+	Baseline base[BENCH_MAX_RESULTS];
+	int base_count = 0;
+	if (baseline_fname)
+	{
+		base_count = baseline_load(baseline_fname, base, BENCH_MAX_RESULTS);
+		if (base_count < 0) return 2;
+	}
+
+	printf("%-16s %7s %8s %9s %10s %9s", "Case", "Entries", "MPix", "ms", "MPix/s", "RSS KiB");
+	if (base_count > 0) printf(" %9s %9s", "vs MPix/s", "vs RSS");
+	printf("\n");
+
+	int regressions = 0;
+	double total_mpix = 0.0;
+	double total_seconds = 0.0;
+	int total_entries = 0;
+	long max_rss = 0;
+	for (int i = 0; i < res_count; i++)
+	{
+		const Result *r = &res[i];
+		const double mpix_per_s = r->mpix / r->seconds;
+		printf("%-16s %7d %8.2f %9.2f %10.2f %9ld", r->name, r->entries, r->mpix,
+		       r->seconds * 1000.0, mpix_per_s, r->peak_rss_kib);
+		total_mpix += r->mpix;
+		total_seconds += r->seconds;
+		total_entries += r->entries;
+		if (r->peak_rss_kib > max_rss) max_rss = r->peak_rss_kib;
+
+		for (int j = 0; j < base_count; j++)
+		{
+			if (strcmp(base[j].name, r->name) != 0) continue;
+			const double speed = ((mpix_per_s / base[j].mpix_per_s) - 1.0) * 100.0;
+			const double rss = (((double)r->peak_rss_kib / base[j].peak_rss_kib) - 1.0) * 100.0;
+			printf(" %+8.1f%% %+8.1f%%", speed, rss);
+			if (speed < -tolerance || rss > tolerance)
+			{
+				printf("  REGRESSION");
+				regressions++;
+			}
+			break;
+		}
+		printf("\n");
+	}
+
+	printf("\nTotal: %d entries, %.2f MPix in %.2f ms: %.2f MPix/s, %.2f entries/s, peak RSS %ld KiB\n",
+	       total_entries, total_mpix, total_seconds * 1000.0, total_mpix / total_seconds,
+	       total_entries / total_seconds, max_rss);
+
+	if (write_baseline_fname)
+	{
+		if (!baseline_save(write_baseline_fname, res, res_count)) return 2;
+		printf("Baseline written to %s\n", write_baseline_fname);
+	}
+	if (regressions > 0)
+	{
+		printf("%d case(s) regressed by more than %.0f%% against %s\n", regressions, tolerance,
+		       baseline_fname);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,1324 @@
+//
+// Velella
+// bench/kernels.c
+//
+// Kernel microbenchmark. Times the inner pixel loops on their own, on
+// synthetic buffers, next to the frozen scalar copies in kernels_ref.h, or
+// for inflate and PNG decoding, next to LodePNG's own.
+// Before anything is timed, each kernel's output is compared against its
+// reference, and any difference is reported as a failure.
+//
+// Usage: velella_kernels [options]
+//   --filter STR        Only run kernels whose name contains STR
+//   --ms N              Minimum time spent timing each kernel (default 100)
+//   --rounds N          Rounds the time is split into; the fastest is kept (default 5)
+//   --check             Compare outputs only, without timing anything
+//
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "cpu.h"
+#include "crc32.h"
+#include "entry_emit.h"
+#include "format.h"
+#include "image.h"
+#include "inflate.h"
+#include "lodepng.h"
+#include "mdcsp_claim.h"
+#include "pal.h"
+#include "pngdec.h"
+#include "pxutil.h"
+#include "tileread.h"
+#include "transpose.h"
+#include "types.h"
+#include "kernels_ref.h"
+
+// Sizes of the synthetic buffers.
+#define IMG_W 512
+#define IMG_H 512
+#define CHR_LEN (1024 * 1024)
+#define PAL_COLORS 4096
+#define CSP_FRAMES 64
+#define CSP_SW 48
+#define CSP_SH 48
+#define CSP_WIN_W (CSP_SW + 8)
+#define CSP_WIN_H (CSP_SH + 8)
+#define PNG_SET_COUNT 8
+
+static uint32_t rng(uint32_t *s)
+{
+	// xorshift32
+	uint32_t x = *s;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*s = x;
+	return x;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+// =======
+// Cases
+// =======
+
+// PNG files to decode, each in a buffer of exactly its size, so that a read
+// past the end shows up under AddressSanitizer.
+typedef struct PngSet
+{
+	uint8_t **png;
+	size_t *size;
+	int count;
+	int cap;
+	size_t px_bytes;       // Pixels in all of them.
+	bool verify;           // Check CRCs and Adler-32 checksums.
+} PngSet;
+
+// One kernel with one set of parameters. run() calls the version in src/,
+// run_ref() the reference; both leave their output in their own buffer, with
+// its length in out_len / ref_len.
+typedef struct Case Case;
+struct Case
+{
+	char name[64];
+	void (*run)(Case *c);
+	void (*run_ref)(Case *c);
+	size_t bytes;          // Input bytes processed per call.
+
+	// Parameters; each kernel uses what it needs.
+	int angle;
+	int tilesize;
+	uint32_t flags;
+	int lim;               // Clip frames to lim pixels in each direction, or -1.
+	int planes;
+	int depth;
+	uint32_t order;
+	bool reverse;
+	DataFormat fmt;
+	PalFormat pal;
+	InflateBackend inflate;
+	CpuIsa isa;
+
+	const uint8_t *in;
+	size_t in_size;        // For kernels whose input size isn't bytes.
+	const PngSet *pngs;
+	uint8_t *scratch;      // Copy of the input for kernels that erase it.
+	uint8_t *out;
+	uint8_t *ref;
+	size_t out_len;
+	size_t ref_len;
+};
+
+typedef struct Buffers
+{
+	uint8_t *img;          // IMG_W x IMG_H indexed image.
+	uint8_t *chr;          // CHR_LEN of 8bpp pixel data.
+	uint8_t *rgba;         // PAL_COLORS RGBA colors.
+	uint8_t *csp;          // CSP_FRAMES windows of sprite blobs.
+	uint8_t *zlib[3];      // img, chr and csp, compressed as LodePNG does.
+	size_t zlib_size[3];
+	PngSet pngs[PNG_SET_COUNT];
+	const char *png_names[PNG_SET_COUNT];
+	int png_set_count;
+} Buffers;
+
+// -----------------------------------------------------------------------------
+// tileread.h
+// -----------------------------------------------------------------------------
+
+// Reads every frame of the image, as conv_entry_read() does. Erasing reads
+// work on a fresh copy of the image each time.
+static size_t frame_pass(Case *c, uint8_t *out, bool ref)
+{
+	uint8_t *px = (uint8_t *)c->in;
+	if (c->flags & TILE_READ_FLAG_ERASE)
+	{
+		memcpy(c->scratch, c->in, IMG_W * IMG_H);
+		px = c->scratch;
+	}
+	const int fw = 32;
+	const int fh = 32;
+	uint8_t *chr_w = out;
+	for (int fy = 0; fy < IMG_H / fh; fy++)
+	{
+		for (int fx = 0; fx < IMG_W / fw; fx++)
+		{
+			const int lim_x = (c->lim < 0) ? -1 : (fx * fw) + c->lim;
+			const int lim_y = (c->lim < 0) ? -1 : (fy * fh) + c->lim;
+			if (ref)
+			{
+				chr_w = ref_tile_read_frame(px, IMG_W, IMG_H, fx, fy, fw, fh,
+				                            c->tilesize, c->angle, lim_x, lim_y,
+				                            c->flags, chr_w);
+			}
+			else
+			{
+				chr_w = tile_read_frame(px, IMG_W, IMG_H, fx, fy, fw, fh,
+				                        c->tilesize, c->angle, lim_x, lim_y,
+				                        c->flags, chr_w);
+			}
+		}
+	}
+	return chr_w - out;
+}
+
+static void run_frame(Case *c) { c->out_len = frame_pass(c, c->out, false); }
+static void run_frame_ref(Case *c) { c->ref_len = frame_pass(c, c->ref, true); }
+
+// Reads every frame with tile_read_lines(); the reference is
+// ref_tile_read_frame() with a tilesize of 1.
+static void run_lines(Case *c)
+{
+	const int fw = 32;
+	const int fh = 32;
+	uint8_t *chr_w = c->out;
+	for (int fy = 0; fy < IMG_H / fh; fy++)
+	{
+		for (int fx = 0; fx < IMG_W / fw; fx++)
+		{
+			chr_w = tile_read_lines((uint8_t *)c->in, IMG_W, fx, fy, fw, fh,
+			                        c->angle, chr_w);
+		}
+	}
+	c->out_len = chr_w - c->out;
+}
+
+// Reads the image as 16x16 tiles, clipped to 12x12 when lim is set.
+static size_t tile_pass(Case *c, uint8_t *out, bool ref)
+{
+	uint8_t *px = (uint8_t *)c->in;
+	const int lim = (c->lim < 0) ? 16 : c->lim;
+	uint8_t *chr_w = out;
+	for (int ty = 0; ty < IMG_H; ty += 16)
+	{
+		for (int tx = 0; tx < IMG_W; tx += 16)
+		{
+			uint8_t *px_tile = &px[(ty * IMG_W) + tx];
+			if (ref)
+			{
+				chr_w = ref_tile_read_tile(px_tile, IMG_W, 16, 16, lim, lim,
+				                           c->angle, c->flags, chr_w);
+			}
+			else
+			{
+				chr_w = tile_read_tile(px_tile, IMG_W, 16, 16, lim, lim,
+				                       c->angle, c->flags, chr_w);
+			}
+		}
+	}
+	return chr_w - out;
+}
+
+static void run_tile(Case *c) { c->out_len = tile_pass(c, c->out, false); }
+static void run_tile_ref(Case *c) { c->ref_len = tile_pass(c, c->ref, true); }
+
+// -----------------------------------------------------------------------------
+// transpose.c
+// -----------------------------------------------------------------------------
+
+// A block a little smaller than the image, so that every edge case of the
+// tiling is met.
+#define TRANSPOSE_W (IMG_W - 3)
+#define TRANSPOSE_H (IMG_H - 5)
+
+static void run_transpose(Case *c)
+{
+	transpose_block_isa(c->isa, c->in, IMG_W, c->out, TRANSPOSE_H, TRANSPOSE_W, TRANSPOSE_H);
+	c->out_len = TRANSPOSE_W * TRANSPOSE_H;
+}
+
+static void run_transpose_ref(Case *c)
+{
+	for (int x = 0; x < TRANSPOSE_W; x++)
+	{
+		for (int y = 0; y < TRANSPOSE_H; y++)
+		{
+			c->ref[(x * TRANSPOSE_H) + y] = c->in[(y * IMG_W) + x];
+		}
+	}
+	c->ref_len = TRANSPOSE_W * TRANSPOSE_H;
+}
+
+// -----------------------------------------------------------------------------
+// pxutil.c
+// -----------------------------------------------------------------------------
+
+// Rotates every tile of a copy of the image.
+static size_t rotate_pass(Case *c, uint8_t *out, bool ref)
+{
+	memcpy(out, c->in, IMG_W * IMG_H);
+	for (int ty = 0; ty < IMG_H; ty += c->tilesize)
+	{
+		for (int tx = 0; tx < IMG_W; tx += c->tilesize)
+		{
+			if (ref) ref_rotate_tile(out, tx, ty, IMG_W, c->tilesize, c->angle);
+			else pxutil_rotate_tile(out, tx, ty, IMG_W, c->tilesize, c->angle);
+		}
+	}
+	return IMG_W * IMG_H;
+}
+
+static void run_rotate(Case *c) { c->out_len = rotate_pass(c, c->out, false); }
+static void run_rotate_ref(Case *c) { c->ref_len = rotate_pass(c, c->ref, true); }
+
+static void run_planar(Case *c)
+{
+	uint8_t *out = c->out;
+	for (size_t i = 0; i < CHR_LEN; i += 8)
+	{
+		pxutil_pack_planar(&c->in[i], c->planes, c->order, c->reverse, out);
+		out += c->planes;
+	}
+	c->out_len = out - c->out;
+}
+
+static void run_planar_ref(Case *c)
+{
+	uint8_t *out = c->ref;
+	for (size_t i = 0; i < CHR_LEN; i += 8)
+	{
+		ref_pack_planar(&c->in[i], c->planes, c->order, c->reverse, out);
+		out += c->planes;
+	}
+	c->ref_len = out - c->ref;
+}
+
+// flags is 1 for inverted output.
+static void run_planar_rows(Case *c)
+{
+	pxutil_pack_planar_rows_isa(c->isa, c->in, 8, CHR_LEN / 8, c->planes, c->order,
+	                            c->reverse, c->flags & 1, c->out);
+	c->out_len = (CHR_LEN / 8) * c->planes;
+}
+
+static void run_planar_rows_ref(Case *c)
+{
+	uint8_t *out = c->ref;
+	for (size_t i = 0; i < CHR_LEN; i += 8)
+	{
+		ref_pack_planar(&c->in[i], c->planes, c->order, c->reverse, out);
+		for (int plane = 0; plane < c->planes; plane++)
+		{
+			if (c->flags & 1) out[plane] = ~out[plane];
+		}
+		out += c->planes;
+	}
+	c->ref_len = out - c->ref;
+}
+
+static void run_linear(Case *c)
+{
+	uint8_t *out = c->out;
+	for (size_t i = 0; i < CHR_LEN; i += 8)
+	{
+		pxutil_pack_linear(&c->in[i], c->depth, c->reverse, out);
+		out += c->depth;
+	}
+	c->out_len = out - c->out;
+}
+
+static void run_linear_ref(Case *c)
+{
+	uint8_t *out = c->ref;
+	for (size_t i = 0; i < CHR_LEN; i += 8)
+	{
+		ref_pack_linear(&c->in[i], c->depth, c->reverse, out);
+		out += c->depth;
+	}
+	c->ref_len = out - c->ref;
+}
+
+// flags is 1 for swapped pairs and 2 for hi bytes.
+static void run_nibbles(Case *c)
+{
+	const bool hi = c->flags & 2;
+	pxutil_pack_nibbles_isa(c->isa, c->in, CHR_LEN / 2, c->flags & 1, hi, c->out);
+	c->out_len = hi ? CHR_LEN : CHR_LEN / 2;
+}
+
+static void run_nibbles_ref(Case *c)
+{
+	const bool hi = c->flags & 2;
+	ref_pack_nibbles(c->in, CHR_LEN / 2, c->flags & 1, hi, c->ref);
+	c->ref_len = hi ? CHR_LEN : CHR_LEN / 2;
+}
+
+static void run_nibble_columns(Case *c)
+{
+	pxutil_pack_nibble_columns_isa(c->isa, c->in, CHR_LEN / 64, c->out);
+	c->out_len = CHR_LEN / 2;
+}
+
+static void run_nibble_columns_ref(Case *c)
+{
+	ref_pack_nibble_columns(c->in, CHR_LEN / 64, c->ref);
+	c->ref_len = CHR_LEN / 2;
+}
+
+// -----------------------------------------------------------------------------
+// entry_emit.c
+// -----------------------------------------------------------------------------
+
+// Packs straight into the output buffer, as entries streamed during
+// conversion are, so only the packing loop is timed.
+static void run_emit(Case *c)
+{
+	Entry e;
+	memset(&e, 0, sizeof(e));
+	e.frame_cfg.data_format = c->fmt;
+	e.frame_cfg.depth = c->depth;
+	e.frame_cfg.tilesize = c->tilesize;
+	e.chr = (uint8_t *)c->in;
+	e.chr_bytes = CHR_LEN;
+
+	c->out_len = entry_chr_size(&e);
+	entry_pack_chr(&e, c->out);
+}
+
+static void run_emit_ref(Case *c)
+{
+	c->ref_len = ref_emit_chr(c->fmt, c->depth, c->tilesize,
+	                          c->in, CHR_LEN, c->ref) - c->ref;
+}
+
+// -----------------------------------------------------------------------------
+// crc32.c
+// -----------------------------------------------------------------------------
+
+static void run_crc32(Case *c)
+{
+	const uint32_t crc = crc32_bytes(c->in, CHR_LEN);
+	memcpy(c->out, &crc, sizeof(crc));
+	c->out_len = sizeof(crc);
+}
+
+static void run_crc32_ref(Case *c)
+{
+	const uint32_t crc = ref_crc32_bytes(c->in, CHR_LEN);
+	memcpy(c->ref, &crc, sizeof(crc));
+	c->ref_len = sizeof(crc);
+}
+
+// -----------------------------------------------------------------------------
+// pal.c
+// -----------------------------------------------------------------------------
+
+static void run_pal(Case *c)
+{
+	uint16_t *out = (uint16_t *)c->out;
+	for (int i = 0; i < PAL_COLORS; i++)
+	{
+		const uint8_t *rgba = &c->in[i * 4];
+		out[i] = pal_pack_entry(c->pal, rgba[0], rgba[1], rgba[2]);
+	}
+	c->out_len = PAL_COLORS * sizeof(uint16_t);
+}
+
+static void run_pal_ref(Case *c)
+{
+	uint16_t *out = (uint16_t *)c->ref;
+	for (int i = 0; i < PAL_COLORS; i++)
+	{
+		const uint8_t *rgba = &c->in[i * 4];
+		out[i] = ref_pal_pack_entry(c->pal, rgba[0], rgba[1], rgba[2]);
+	}
+	c->ref_len = PAL_COLORS * sizeof(uint16_t);
+}
+
+// -----------------------------------------------------------------------------
+// mdcsp_claim.c
+// -----------------------------------------------------------------------------
+
+typedef ClaimSize (*ClaimFunc)(const uint8_t *imgdat,
+                               int sx, int sy, int sw, int sh,
+                               int iw, int ih,
+                               int *col, int *row);
+
+// Claims sprites out of each window until it is empty, erasing each claim
+// the way conv_entry_read() does. Every claim is recorded in out.
+static size_t claim_pass(Case *c, ClaimFunc claim, uint8_t *out)
+{
+	memcpy(c->scratch, c->in, CSP_FRAMES * CSP_WIN_W * CSP_WIN_H);
+	uint8_t *rec = out;
+	for (int i = 0; i < CSP_FRAMES; i++)
+	{
+		uint8_t *win = &c->scratch[i * CSP_WIN_W * CSP_WIN_H];
+		int col, row;
+		ClaimSize size;
+		while ((size = claim(win, 0, 0, CSP_SW, CSP_SH, CSP_WIN_W, CSP_WIN_H,
+		                     &col, &row)))
+		{
+			*rec++ = size;
+			*rec++ = col;
+			*rec++ = row;
+			const int w = mdcsp_w_for_claim(size) * 8;
+			const int h = mdcsp_h_for_claim(size) * 8;
+			for (int y = row; y < row + h && y < CSP_SH; y++)
+			{
+				for (int x = col; x < col + w && x < CSP_SW; x++)
+				{
+					win[(y * CSP_WIN_W) + x] = 0;
+				}
+			}
+		}
+	}
+	return rec - out;
+}
+
+static void run_claim(Case *c) { c->out_len = claim_pass(c, mdcsp_claim, c->out); }
+static void run_claim_ref(Case *c) { c->ref_len = claim_pass(c, ref_mdcsp_claim, c->ref); }
+
+// -----------------------------------------------------------------------------
+// inflate.c
+// -----------------------------------------------------------------------------
+
+// The reference is LodePNG's own inflate, which the backends stand in for.
+// bytes is the size inflated, which pngdec knows ahead.
+static void run_inflate(Case *c)
+{
+	uint8_t *out = NULL;
+	size_t out_size = 0;
+	if (inflate_zlib(c->inflate, &out, &out_size, c->in, c->in_size, c->bytes, true) != 0)
+	{
+		out_size = 0;
+	}
+	memcpy(c->out, out, out_size);
+	c->out_len = out_size;
+	free(out);
+}
+
+static void run_inflate_ref(Case *c)
+{
+	LodePNGDecompressSettings settings;
+	lodepng_decompress_settings_init(&settings);
+	uint8_t *out = NULL;
+	size_t out_size = 0;
+	if (lodepng_zlib_decompress(&out, &out_size, c->in, c->in_size, &settings) != 0)
+	{
+		out_size = 0;
+	}
+	memcpy(c->ref, out, out_size);
+	c->ref_len = out_size;
+	free(out);
+}
+
+// -----------------------------------------------------------------------------
+// pngdec.c
+// -----------------------------------------------------------------------------
+
+// Notes what decoding one file gave: the error, then unless there was one,
+// the size, palette and pixels.
+static uint8_t *png_record(uint8_t *out, unsigned int error, unsigned int w, unsigned int h,
+                           const uint8_t *palette, int palette_size, const uint8_t *px)
+{
+	memcpy(out, &error, sizeof(error));
+	out += sizeof(error);
+	if (error) return out;
+	memcpy(out, &w, sizeof(w));
+	memcpy(out + 4, &h, sizeof(h));
+	memcpy(out + 8, &palette_size, sizeof(palette_size));
+	out += 12;
+	memcpy(out, palette, palette_size * 4);
+	out += palette_size * 4;
+	memcpy(out, px, (size_t)w * h);
+	return out + ((size_t)w * h);
+}
+
+// The reference is LodePNG, decoding to 8bpp indices as image.c has it do.
+static void run_pngdec_ref(Case *c)
+{
+	const PngSet *set = c->pngs;
+	uint8_t *rec = c->ref;
+	for (int i = 0; i < set->count; i++)
+	{
+		LodePNGState state;
+		lodepng_state_init(&state);
+		state.decoder.ignore_crc = !set->verify;
+		state.decoder.zlibsettings.ignore_adler32 = !set->verify;
+		state.info_raw.colortype = LCT_PALETTE;
+		state.info_raw.bitdepth = 8;
+		uint8_t *px = NULL;
+		unsigned int w = 0;
+		unsigned int h = 0;
+		unsigned int error = lodepng_decode(&px, &w, &h, &state, set->png[i], set->size[i]);
+		// The row decoder only has to fail where LodePNG does.
+		if (c->flags && error) error = 1;
+		rec = png_record(rec, error, w, h, state.info_png.color.palette,
+		                 state.info_png.color.palettesize, px);
+		free(px);
+		lodepng_state_cleanup(&state);
+	}
+	c->ref_len = rec - c->ref;
+}
+
+static void run_pngdec(Case *c)
+{
+	const PngSet *set = c->pngs;
+	uint8_t *rec = c->out;
+	for (int i = 0; i < set->count; i++)
+	{
+		Image img;
+		memset(&img, 0, sizeof(img));
+		img.png = set->png[i];
+		img.file_size = set->size[i];
+		const unsigned int error = pngdec_decode(&img, set->verify, INFLATE_BACKEND_FAST);
+		rec = png_record(rec, error, img.w, img.h, img.palette, img.palette_size, img.px);
+		free(img.buf.px);
+	}
+	c->out_len = rec - c->out;
+}
+
+// Reads a few rows at a time, as --low-memory does.
+static void run_pngdec_rows(Case *c)
+{
+	const PngSet *set = c->pngs;
+	uint8_t *rec = c->out;
+	for (int i = 0; i < set->count; i++)
+	{
+		PngDecRows r;
+		unsigned int error = pngdec_rows_begin(&r, set->png[i], set->size[i], set->verify);
+		for (unsigned int y = 0; !error && y < r.h; y += 3)
+		{
+			const unsigned int count = (r.h - y < 3) ? (r.h - y) : 3;
+			error = pngdec_rows_read(&r, &c->scratch[(size_t)y * r.w], count);
+		}
+		if (!error) error = pngdec_rows_end(&r);
+		rec = png_record(rec, error ? 1 : 0, r.w, r.h, r.palette, r.palette_size, c->scratch);
+		pngdec_rows_free(&r);
+	}
+	c->out_len = rec - c->out;
+}
+
+// ================
+// Case generation
+// ================
+
+#define CASES_MAX 160
+
+static int s_case_count;
+static Case s_cases[CASES_MAX];
+
+static Case *case_add(const char *name, void (*run)(Case *), void (*run_ref)(Case *),
+                      const uint8_t *in, size_t bytes)
+{
+	if (s_case_count >= CASES_MAX) return NULL;
+	Case *c = &s_cases[s_case_count++];
+	memset(c, 0, sizeof(*c));
+	snprintf(c->name, sizeof(c->name), "%s", name);
+	c->run = run;
+	c->run_ref = run_ref;
+	c->in = in;
+	c->bytes = bytes;
+	c->lim = -1;
+	return c;
+}
+
+static void cases_init(const Buffers *b)
+{
+	static const int k_angles[] = {0, 90, 180, 270};
+	char name[64];
+
+	for (int a = 0; a < 4; a++)
+	{
+		for (int x_major = 0; x_major < 2; x_major++)
+		{
+			for (int ts = 8; ts <= 16; ts += 8)
+			{
+				snprintf(name, sizeof(name), "tile_read_frame/%d/%s/t%d",
+				         k_angles[a], x_major ? "x" : "y", ts);
+				Case *c = case_add(name, run_frame, run_frame_ref, b->img, IMG_W * IMG_H);
+				c->angle = k_angles[a];
+				c->tilesize = ts;
+				c->flags = x_major ? TILE_READ_FLAG_X_MAJOR : 0;
+			}
+		}
+		// SP013 reads frames a line at a time.
+		snprintf(name, sizeof(name), "tile_read_frame/%d/y/t1", k_angles[a]);
+		Case *c = case_add(name, run_frame, run_frame_ref, b->img, IMG_W * IMG_H);
+		c->angle = k_angles[a];
+		c->tilesize = 1;
+		snprintf(name, sizeof(name), "tile_read_lines/%d", k_angles[a]);
+		c = case_add(name, run_lines, run_frame_ref, b->img, IMG_W * IMG_H);
+		c->angle = k_angles[a];
+		c->tilesize = 1;
+		// Clipped against a limit, erasing what is read, as MD CSP does.
+		snprintf(name, sizeof(name), "tile_read_frame/%d/x/t8/lim+erase", k_angles[a]);
+		c = case_add(name, run_frame, run_frame_ref, b->img, IMG_W * IMG_H);
+		c->angle = k_angles[a];
+		c->tilesize = 8;
+		c->lim = 28;
+		c->flags = TILE_READ_FLAG_X_MAJOR | TILE_READ_FLAG_ERASE;
+	}
+
+	for (int a = 0; a < 4; a++)
+	{
+		snprintf(name, sizeof(name), "tile_read_tile/%d", k_angles[a]);
+		Case *c = case_add(name, run_tile, run_tile_ref, b->img, IMG_W * IMG_H);
+		c->angle = k_angles[a];
+		snprintf(name, sizeof(name), "tile_read_tile/%d/lim", k_angles[a]);
+		c = case_add(name, run_tile, run_tile_ref, b->img, IMG_W * IMG_H);
+		c->angle = k_angles[a];
+		c->lim = 12;
+	}
+
+	for (CpuIsa isa = 0; isa <= cpu_isa_best(); isa++)
+	{
+		snprintf(name, sizeof(name), "transpose_block/%s", cpu_string_for_isa(isa));
+		Case *c = case_add(name, run_transpose, run_transpose_ref, b->img,
+		                   TRANSPOSE_W * TRANSPOSE_H);
+		c->isa = isa;
+	}
+
+	for (int a = 1; a < 4; a++)
+	{
+		for (int ts = 8; ts <= 16; ts += 8)
+		{
+			snprintf(name, sizeof(name), "pxutil_rotate_tile/%d/t%d", k_angles[a], ts);
+			Case *c = case_add(name, run_rotate, run_rotate_ref, b->img, IMG_W * IMG_H);
+			c->angle = k_angles[a];
+			c->tilesize = ts;
+		}
+	}
+
+	static const struct
+	{
+		int planes;
+		uint32_t order;
+	} k_planar[] =
+	{
+		{4, 0x3210},
+		{4, 0x0123},
+		{3, 0x210},
+		{2, 0x10},
+		{8, 0x76543210},
+		{8, 0x01234567},
+	};
+	for (size_t i = 0; i < sizeof(k_planar) / sizeof(k_planar[0]); i++)
+	{
+		for (int rev = 0; rev < 2; rev++)
+		{
+			snprintf(name, sizeof(name), "pxutil_pack_planar/%d/%X%s",
+			         k_planar[i].planes, k_planar[i].order, rev ? "/rev" : "");
+			Case *c = case_add(name, run_planar, run_planar_ref, b->chr, CHR_LEN);
+			c->planes = k_planar[i].planes;
+			c->order = k_planar[i].order;
+			c->reverse = rev;
+		}
+	}
+
+	for (CpuIsa isa = 0; isa <= cpu_isa_best(); isa++)
+	{
+		for (size_t i = 0; i < sizeof(k_planar) / sizeof(k_planar[0]); i++)
+		{
+			// Alternating, so each shows up once each way.
+			const bool rev = i & 1;
+			const bool inv = !(i & 2);
+			snprintf(name, sizeof(name), "pxutil_pack_planar_rows/%s/%d/%X%s%s",
+			         cpu_string_for_isa(isa), k_planar[i].planes, k_planar[i].order,
+			         rev ? "/rev" : "", inv ? "/inv" : "");
+			Case *c = case_add(name, run_planar_rows, run_planar_rows_ref, b->chr, CHR_LEN);
+			c->isa = isa;
+			c->planes = k_planar[i].planes;
+			c->order = k_planar[i].order;
+			c->reverse = rev;
+			c->flags = inv ? 1 : 0;
+		}
+	}
+
+	for (int depth = 1; depth <= 4; depth *= 2)
+	{
+		for (int rev = 0; rev < 2; rev++)
+		{
+			snprintf(name, sizeof(name), "pxutil_pack_linear/%d%s", depth, rev ? "/rev" : "");
+			Case *c = case_add(name, run_linear, run_linear_ref, b->chr, CHR_LEN);
+			c->depth = depth;
+			c->reverse = rev;
+		}
+	}
+
+	for (CpuIsa isa = 0; isa <= cpu_isa_best(); isa++)
+	{
+		for (uint32_t flags = 0; flags < 4; flags++)
+		{
+			snprintf(name, sizeof(name), "pxutil_pack_nibbles/%s%s%s", cpu_string_for_isa(isa),
+			         (flags & 1) ? "/swap" : "", (flags & 2) ? "/hi" : "");
+			Case *c = case_add(name, run_nibbles, run_nibbles_ref, b->chr, CHR_LEN);
+			c->isa = isa;
+			c->flags = flags;
+		}
+		snprintf(name, sizeof(name), "pxutil_pack_nibble_columns/%s", cpu_string_for_isa(isa));
+		Case *c = case_add(name, run_nibble_columns, run_nibble_columns_ref, b->chr, CHR_LEN);
+		c->isa = isa;
+	}
+
+	// One of each packing loop in entry_pack_chr().
+	static const struct
+	{
+		DataFormat fmt;
+		int depth;
+		int tilesize;
+	} k_emit[] =
+	{
+		{DATA_FORMAT_DIRECT,      8, 16},
+		{DATA_FORMAT_SP013,       4, 16},
+		{DATA_FORMAT_SP013,       8, 16},
+		{DATA_FORMAT_BG038,       4, 16},
+		{DATA_FORMAT_BG038,       8, 16},
+		{DATA_FORMAT_CPS_BG,      4,  8},
+		{DATA_FORMAT_CPS_SPR,     4, 16},
+		{DATA_FORMAT_MD_SPR,      4,  8},
+		{DATA_FORMAT_TOA_GCU_SPR, 4,  8},
+		{DATA_FORMAT_NEO_FIX,     4,  8},
+		{DATA_FORMAT_NEO_SPR,     4, 16},
+	};
+	for (size_t i = 0; i < sizeof(k_emit) / sizeof(k_emit[0]); i++)
+	{
+		snprintf(name, sizeof(name), "entry_pack_chr/%s/%d",
+		         string_for_data_format(k_emit[i].fmt), k_emit[i].depth);
+		Case *c = case_add(name, run_emit, run_emit_ref, b->chr, CHR_LEN);
+		c->fmt = k_emit[i].fmt;
+		c->depth = k_emit[i].depth;
+		c->tilesize = k_emit[i].tilesize;
+	}
+
+	case_add("crc32_bytes", run_crc32, run_crc32_ref, b->chr, CHR_LEN);
+
+	for (PalFormat pal = PAL_FORMAT_UNSPECIFIED + 1; pal < PAL_FORMAT_COUNT; pal++)
+	{
+		snprintf(name, sizeof(name), "pal_pack_entry/%s", pal_string_for_format(pal));
+		Case *c = case_add(name, run_pal, run_pal_ref, b->rgba, PAL_COLORS * 4);
+		c->pal = pal;
+	}
+
+	case_add("mdcsp_claim", run_claim, run_claim_ref, b->csp,
+	         CSP_FRAMES * CSP_WIN_W * CSP_WIN_H);
+
+	static const char *k_zlib_names[3] = {"img", "chr", "csp"};
+	const size_t zlib_raw[3] = {IMG_W * IMG_H, CHR_LEN, CSP_FRAMES * CSP_WIN_W * CSP_WIN_H};
+	for (InflateBackend be = 0; be < INFLATE_BACKEND_COUNT; be++)
+	{
+		// LodePNG is the reference, and zlib may not be built in.
+		if (be == INFLATE_BACKEND_LODEPNG) continue;
+		if (inflate_backend_for_string(inflate_string_for_backend(be)) != be) continue;
+		for (int i = 0; i < 3; i++)
+		{
+			snprintf(name, sizeof(name), "inflate_zlib/%s/%s",
+			         inflate_string_for_backend(be), k_zlib_names[i]);
+			Case *c = case_add(name, run_inflate, run_inflate_ref, b->zlib[i], zlib_raw[i]);
+			c->in_size = b->zlib_size[i];
+			c->inflate = be;
+		}
+	}
+
+	// pngdec against LodePNG, whole and a few rows at a time.
+	for (int i = 0; i < b->png_set_count; i++)
+	{
+		snprintf(name, sizeof(name), "pngdec_decode/%s", b->png_names[i]);
+		Case *c = case_add(name, run_pngdec, run_pngdec_ref, NULL, b->pngs[i].px_bytes);
+		c->pngs = &b->pngs[i];
+		snprintf(name, sizeof(name), "pngdec_rows/%s", b->png_names[i]);
+		c = case_add(name, run_pngdec_rows, run_pngdec_ref, NULL, b->pngs[i].px_bytes);
+		c->pngs = &b->pngs[i];
+		c->flags = 1;
+	}
+}
+
+// Pixels are mostly low indices with some transparency, as in a 4bpp sheet,
+// with the occasional full byte to exercise the high bits.
+static void buffers_fill(Buffers *b)
+{
+	uint32_t seed = 0x13579BDF;
+	for (int i = 0; i < IMG_W * IMG_H; i++)
+	{
+		const uint32_t r = rng(&seed);
+		b->img[i] = ((r & 0x3) == 0) ? 0 : ((r >> 8) & 0x0F);
+	}
+	for (int i = 0; i < CHR_LEN; i++)
+	{
+		const uint32_t r = rng(&seed);
+		b->chr[i] = ((r & 0x1F) == 0) ? (r >> 8) : ((r >> 8) & 0x0F);
+	}
+	for (int i = 0; i < PAL_COLORS * 4; i++)
+	{
+		b->rgba[i] = rng(&seed);
+	}
+
+	// Each window holds an ellipse of a random size and position, with a
+	// few stray pixels around it, including some past the frame that claims
+	// have to leave alone. Strays stay off the frame's bottom row, as a lone
+	// pixel there can't be claimed.
+	memset(b->csp, 0, CSP_FRAMES * CSP_WIN_W * CSP_WIN_H);
+	for (int i = 0; i < CSP_FRAMES; i++)
+	{
+		uint8_t *win = &b->csp[i * CSP_WIN_W * CSP_WIN_H];
+		const int rx = 4 + (rng(&seed) % 20);
+		const int ry = 4 + (rng(&seed) % 20);
+		const int cx = rx + (rng(&seed) % (CSP_SW - (2 * rx) + 1));
+		const int cy = ry + (rng(&seed) % (CSP_SH - (2 * ry) + 1));
+		for (int y = 0; y < CSP_WIN_H; y++)
+		{
+			for (int x = 0; x < CSP_WIN_W; x++)
+			{
+				const int dx = x - cx;
+				const int dy = y - cy;
+				const bool in_frame = (x < CSP_SW && y < CSP_SH);
+				const bool in_blob = ((dx * dx * ry * ry) + (dy * dy * rx * rx) <= (rx * rx * ry * ry));
+				const uint32_t r = rng(&seed);
+				const bool stray = ((r % 97) == 0) && (y != CSP_SH - 1);
+				if ((in_frame && in_blob) || stray)
+				{
+					win[(y * CSP_WIN_W) + x] = 1 + ((r >> 8) % 15);
+				}
+			}
+		}
+	}
+}
+
+// Compresses the buffers for the inflate kernels, with LodePNG's defaults
+// as in the PNGs it writes.
+static bool buffers_compress(Buffers *b)
+{
+	const uint8_t *raw[3] = {b->img, b->chr, b->csp};
+	const size_t raw_size[3] = {IMG_W * IMG_H, CHR_LEN, CSP_FRAMES * CSP_WIN_W * CSP_WIN_H};
+	LodePNGCompressSettings settings;
+	lodepng_compress_settings_init(&settings);
+	for (int i = 0; i < 3; i++)
+	{
+		b->zlib[i] = NULL;
+		b->zlib_size[i] = 0;
+		if (lodepng_zlib_compress(&b->zlib[i], &b->zlib_size[i], raw[i], raw_size[i], &settings))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// Takes a copy of png as the next file in set.
+static bool png_set_add(PngSet *set, const uint8_t *png, size_t size, size_t px_bytes)
+{
+	if (set->count >= set->cap)
+	{
+		const int cap = set->cap ? (set->cap * 2) : 64;
+		uint8_t **pngs = realloc(set->png, sizeof(*pngs) * cap);
+		if (!pngs) return false;
+		set->png = pngs;
+		size_t *sizes = realloc(set->size, sizeof(*sizes) * cap);
+		if (!sizes) return false;
+		set->size = sizes;
+		set->cap = cap;
+	}
+	uint8_t *copy = malloc(size);
+	if (!copy) return false;
+	memcpy(copy, png, size);
+	set->png[set->count] = copy;
+	set->size[set->count] = size;
+	set->count++;
+	set->px_bytes += px_bytes;
+	return true;
+}
+
+static void png_set_free(PngSet *set)
+{
+	for (int i = 0; i < set->count; i++) free(set->png[i]);
+	free(set->png);
+	free(set->size);
+}
+
+static uint8_t png_paeth(uint8_t a, uint8_t b, uint8_t c)
+{
+	const int p = a + b - c;
+	const int pa = abs(p - a);
+	const int pb = abs(p - b);
+	const int pc = abs(p - c);
+	if (pa <= pb && pa <= pc) return a;
+	if (pb <= pc) return b;
+	return c;
+}
+
+// Filters a row of len bytes against prev, the row above it unfiltered.
+static void png_filter_row(uint8_t *out, const uint8_t *row, const uint8_t *prev, size_t len,
+                           uint8_t filter)
+{
+	for (size_t i = 0; i < len; i++)
+	{
+		const uint8_t a = i ? row[i - 1] : 0;
+		const uint8_t b = prev[i];
+		const uint8_t c = i ? prev[i - 1] : 0;
+		switch (filter)
+		{
+			case 1: out[i] = row[i] - a; break;
+			case 2: out[i] = row[i] - b; break;
+			case 3: out[i] = row[i] - ((a + b) >> 1); break;
+			case 4: out[i] = row[i] - png_paeth(a, b, c); break;
+			default: out[i] = row[i]; break;
+		}
+	}
+}
+
+typedef struct PngSpec
+{
+	int w, h;
+	int depth;
+	int palette_size;
+	int index_limit;       // Indices go up to one below this.
+	bool dup_color;        // The second color is the same as the first.
+	bool black_first;      // The first color is black, which indices past the
+	                       // palette take.
+	int filter;            // Filter type of the first row; each one after takes the next.
+	bool bad_filter;       // The last row has a filter type that doesn't exist.
+	int idat_max;          // Largest IDAT chunk, or 0 for all of it in one.
+} PngSpec;
+
+// Writes an indexed PNG of random pixels to png, which is grown as needed.
+// The padding bits at the end of each row are random too.
+static bool png_make(const PngSpec *spec, uint32_t *seed, uint8_t **png, size_t *size)
+{
+	const size_t line_bytes = (((size_t)spec->w * spec->depth) + 7) / 8;
+	const size_t scan_size = (line_bytes + 1) * spec->h;
+	uint8_t *rows = calloc(line_bytes, spec->h + 1);
+	uint8_t *scan = malloc(scan_size);
+	if (!rows || !scan)
+	{
+		free(rows);
+		free(scan);
+		return false;
+	}
+
+	// Row 0 of rows stays zero, as the row above the first.
+	for (int y = 0; y < spec->h; y++)
+	{
+		uint8_t *row = &rows[(y + 1) * line_bytes];
+		for (size_t i = 0; i < line_bytes; i++) row[i] = rng(seed);
+		for (int x = 0; x < spec->w; x++)
+		{
+			const int shift = 8 - (((x * spec->depth) & 7) + spec->depth);
+			const int mask = ((1 << spec->depth) - 1) << shift;
+			const int idx = rng(seed) % spec->index_limit;
+			uint8_t *b = &row[(x * spec->depth) / 8];
+			*b = (*b & ~mask) | (idx << shift);
+		}
+		uint8_t *out = &scan[y * (line_bytes + 1)];
+		out[0] = (spec->filter + y) % 5;
+		png_filter_row(&out[1], row, &rows[y * line_bytes], line_bytes, out[0]);
+	}
+	if (spec->bad_filter) scan[(spec->h - 1) * (line_bytes + 1)] = 5;
+
+	LodePNGCompressSettings settings;
+	lodepng_compress_settings_init(&settings);
+	uint8_t *z = NULL;
+	size_t z_size = 0;
+	unsigned int error = lodepng_zlib_compress(&z, &z_size, scan, scan_size, &settings);
+	free(rows);
+	free(scan);
+
+	static const uint8_t k_signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+	*size = 0;
+	*png = realloc(*png, sizeof(k_signature));
+	if (!*png) error = 83;
+	if (!error)
+	{
+		memcpy(*png, k_signature, sizeof(k_signature));
+		*size = sizeof(k_signature);
+		const uint8_t ihdr[13] =
+		{
+			spec->w >> 24, spec->w >> 16, spec->w >> 8, spec->w,
+			spec->h >> 24, spec->h >> 16, spec->h >> 8, spec->h,
+			spec->depth, LCT_PALETTE, 0, 0, 0,
+		};
+		error = lodepng_chunk_create(png, size, sizeof(ihdr), "IHDR", ihdr);
+	}
+	if (!error)
+	{
+		uint8_t plte[256 * 3];
+		for (int i = 0; i < spec->palette_size * 3; i++) plte[i] = rng(seed);
+		if (spec->black_first) memset(plte, 0, 3);
+		if (spec->dup_color) memcpy(&plte[3], &plte[0], 3);
+		error = lodepng_chunk_create(png, size, spec->palette_size * 3, "PLTE", plte);
+	}
+	for (size_t pos = 0; !error && pos < z_size; )
+	{
+		size_t len = z_size - pos;
+		if (spec->idat_max > 0)
+		{
+			const size_t piece = 1 + (rng(seed) % spec->idat_max);
+			if (piece < len) len = piece;
+		}
+		error = lodepng_chunk_create(png, size, len, "IDAT", &z[pos]);
+		pos += len;
+	}
+	if (!error) error = lodepng_chunk_create(png, size, 0, "IEND", NULL);
+	free(z);
+	return error == 0;
+}
+
+// Builds the PNG sets for pngdec. For each bit depth, rows take every filter
+// type in turn at odd and even widths, which leave padding bits to skip, with the image data in one IDAT
+// chunk or split over many. The damaged sets have files cut short at every
+// length past the header, and with each byte past the header changed in
+// turn, which has to be rejected the same way and never read past the end.
+static bool buffers_pngs(Buffers *b)
+{
+	static const struct
+	{
+		int depth;
+		const char *name;
+	} k_depths[] =
+	{
+		{1, "1bpp"},
+		{2, "2bpp"},
+		{4, "4bpp"},
+		{8, "8bpp"},
+	};
+	static const int k_w[] = {1, 3, 7, 13, 31, 64, 257};
+	static const int k_h[] = {1, 2, 9, 40};
+	static const PngSpec k_damaged[] =
+	{
+		{.w = 13, .h = 9, .depth = 8, .palette_size = 16, .index_limit = 16, .filter = 1, .idat_max = 7},
+		{.w = 6, .h = 5, .depth = 8, .palette_size = 9, .index_limit = 9, .filter = 3},
+		{.w = 13, .h = 9, .depth = 4, .palette_size = 16, .index_limit = 16, .filter = 2, .idat_max = 5},
+		{.w = 11, .h = 6, .depth = 2, .palette_size = 3, .index_limit = 4, .black_first = true, .filter = 4},
+		{.w = 9, .h = 7, .depth = 1, .palette_size = 2, .index_limit = 2, .filter = 0, .idat_max = 3},
+	};
+
+	uint32_t seed = 0x2468ACE1;
+	uint8_t *png = NULL;
+	size_t size = 0;
+	bool ok = true;
+	b->png_set_count = 0;
+	for (size_t d = 0; ok && d < sizeof(k_depths) / sizeof(k_depths[0]); d++)
+	{
+		const int depth = k_depths[d].depth;
+		PngSet *set = &b->pngs[b->png_set_count];
+		b->png_names[b->png_set_count++] = k_depths[d].name;
+		set->verify = true;
+		int k = 0;
+		for (size_t x = 0; ok && x < sizeof(k_w) / sizeof(k_w[0]); x++)
+		{
+			for (size_t y = 0; ok && y < sizeof(k_h) / sizeof(k_h[0]); y++)
+			{
+				PngSpec spec = {.w = k_w[x], .h = k_h[y], .depth = depth};
+				spec.palette_size = (depth == 8) ? 200 : (1 << depth);
+				spec.index_limit = spec.palette_size;
+				spec.dup_color = (k % 3) == 0;
+				spec.filter = k % 5;
+				spec.idat_max = (k & 1) ? 1 + (k % 16) : 0;
+				ok = png_make(&spec, &seed, &png, &size) &&
+				     png_set_add(set, png, size, (size_t)spec.w * spec.h);
+				k++;
+			}
+		}
+		// Past the end of the palette, 8bpp indices are kept as they are.
+		if (ok && depth == 8)
+		{
+			const PngSpec spec = {.w = 33, .h = 7, .depth = 8, .palette_size = 200,
+			                      .index_limit = 256, .filter = 2, .idat_max = 5};
+			ok = png_make(&spec, &seed, &png, &size) && png_set_add(set, png, size, 33 * 7);
+		}
+		// Below 8bpp, they take black if the palette has it, and are an
+		// error if it doesn't. The last file only has them in the padding
+		// bits, which have to be left alone.
+		for (int v = 0; ok && depth < 8 && v < 3; v++)
+		{
+			const int palette_size = (depth == 1) ? 1 : (1 << depth) - 2;
+			const PngSpec spec = {.w = 5 + (depth * 2), .h = 6, .depth = depth,
+			                      .palette_size = palette_size,
+			                      .index_limit = (v == 2) ? palette_size : 1 << depth,
+			                      .black_first = v == 1, .filter = 1 + v, .idat_max = 2};
+			ok = png_make(&spec, &seed, &png, &size) &&
+			     png_set_add(set, png, size, (size_t)spec.w * spec.h);
+		}
+	}
+
+	PngSet *cut = &b->pngs[b->png_set_count];
+	b->png_names[b->png_set_count++] = "truncated";
+	cut->verify = true;
+	PngSet *bad = &b->pngs[b->png_set_count];
+	b->png_names[b->png_set_count++] = "corrupt";
+	bad->verify = false;
+	for (size_t i = 0; ok && i < sizeof(k_damaged) / sizeof(k_damaged[0]); i++)
+	{
+		const PngSpec *spec = &k_damaged[i];
+		const size_t px_bytes = (size_t)spec->w * spec->h;
+		ok = png_make(spec, &seed, &png, &size);
+		for (size_t len = 33; ok && len < size; len++) ok = png_set_add(cut, png, len, px_bytes);
+		for (size_t pos = 33; ok && pos < size; pos++)
+		{
+			png[pos] ^= 0xA5;
+			ok = png_set_add(bad, png, size, px_bytes);
+			png[pos] ^= 0xA5;
+		}
+
+		// And a filter type that doesn't exist.
+		PngSpec bad_filter = *spec;
+		bad_filter.bad_filter = true;
+		if (ok) ok = png_make(&bad_filter, &seed, &png, &size) && png_set_add(bad, png, size, px_bytes);
+	}
+	free(png);
+	return ok;
+}
+
+// ========
+// Running
+// ========
+
+static bool case_check(Case *c)
+{
+	c->run(c);
+	c->run_ref(c);
+	if (c->out_len != c->ref_len)
+	{
+		printf("%-40s MISMATCH: %zu bytes out, expected %zu\n", c->name, c->out_len, c->ref_len);
+		return false;
+	}
+	for (size_t i = 0; i < c->out_len; i++)
+	{
+		if (c->out[i] == c->ref[i]) continue;
+		printf("%-40s MISMATCH at byte %zu: $%02X, expected $%02X\n",
+		       c->name, i, c->out[i], c->ref[i]);
+		return false;
+	}
+	return true;
+}
+
+// Calls run repeatedly for at least min_ns, and returns the time per call.
+static double case_time(Case *c, void (*run)(Case *), uint64_t min_ns)
+{
+	uint64_t iters = 1;
+	while (true)
+	{
+		const uint64_t start = now_ns();
+		for (uint64_t i = 0; i < iters; i++) run(c);
+		const uint64_t elapsed = now_ns() - start;
+		if (elapsed >= min_ns) return (double)elapsed / iters;
+		iters = (elapsed == 0) ? (iters * 16) : (iters * 2);
+	}
+}
+
+// Times the kernel and its reference in alternating rounds, keeping the
+// fastest round of each, so that both see the same machine load.
+static void case_bench(Case *c, uint64_t min_ns, int rounds, double *ns, double *ref_ns)
+{
+	*ns = 0.0;
+	*ref_ns = 0.0;
+	for (int i = 0; i < rounds; i++)
+	{
+		const double t = case_time(c, c->run, min_ns / rounds);
+		const double ref_t = case_time(c, c->run_ref, min_ns / rounds);
+		if (i == 0 || t < *ns) *ns = t;
+		if (i == 0 || ref_t < *ref_ns) *ref_ns = ref_t;
+	}
+}
+
+static void print_usage(const char *argv0)
+{
+	printf("Usage: %s [options]\n", argv0);
+	printf("  --filter STR    Only run kernels whose name contains STR\n");
+	printf("  --ms N          Minimum time spent timing each kernel (default 100)\n");
+	printf("  --rounds N      Rounds the time is split into; the fastest is kept (default 5)\n");
+	printf("  --check         Compare outputs only, without timing anything\n");
+}
+
+int main(int argc, char **argv)
+{
+	const char *filter = NULL;
+	int ms = 100;
+	int rounds = 5;
+	bool check_only = false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) filter = argv[++i];
+		else if (strcmp(argv[i], "--ms") == 0 && i + 1 < argc) ms = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--rounds") == 0 && i + 1 < argc) rounds = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--check") == 0) check_only = true;
+		else
+		{
+			print_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (ms < 1) ms = 1;
+	if (rounds < 1) rounds = 1;
+
+	Buffers b;
+	b.img = malloc(IMG_W * IMG_H);
+	b.chr = malloc(CHR_LEN);
+	b.rgba = malloc(PAL_COLORS * 4);
+	b.csp = malloc(CSP_FRAMES * CSP_WIN_W * CSP_WIN_H);
+	// Outputs are sized for the largest, the 8x8 CPS BG data at double size.
+	const size_t out_size = (2 * CHR_LEN) + 1;
+	uint8_t *out = malloc(out_size);
+	uint8_t *ref = malloc(out_size);
+	uint8_t *scratch = malloc(IMG_W * IMG_H);
+	if (!b.img || !b.chr || !b.rgba || !b.csp || !out || !ref || !scratch)
+	{
+		fprintf(stderr, "Couldn't allocate buffers\n");
+		return 1;
+	}
+	buffers_fill(&b);
+	if (!buffers_compress(&b))
+	{
+		fprintf(stderr, "Couldn't compress buffers\n");
+		return 1;
+	}
+	if (!buffers_pngs(&b))
+	{
+		fprintf(stderr, "Couldn't write PNG files\n");
+		return 1;
+	}
+	cases_init(&b);
+
+	if (!check_only)
+	{
+		printf("%-40s %10s %10s %10s %8s\n", "Kernel", "us/call", "MB/s", "ref MB/s", "speedup");
+	}
+
+	int failures = 0;
+	int run_count = 0;
+	for (int i = 0; i < s_case_count; i++)
+	{
+		Case *c = &s_cases[i];
+		if (filter && !strstr(c->name, filter)) continue;
+		c->out = out;
+		c->ref = ref;
+		c->scratch = scratch;
+		run_count++;
+
+		if (!case_check(c))
+		{
+			failures++;
+			continue;
+		}
+		if (check_only) continue;
+
+		const uint64_t min_ns = (uint64_t)ms * 1000000ULL;
+		double ns, ref_ns;
+		case_bench(c, min_ns, rounds, &ns, &ref_ns);
+		printf("%-40s %10.2f %10.1f %10.1f %7.2fx\n", c->name, ns / 1000.0,
+		       c->bytes * 1000.0 / ns, c->bytes * 1000.0 / ref_ns, ref_ns / ns);
+	}
+
+	printf("%d kernels checked, %d mismatched.\n", run_count, failures);
+
+	free(scratch);
+	free(ref);
+	free(out);
+	for (int i = 0; i < 3; i++) free(b.zlib[i]);
+	for (int i = 0; i < b.png_set_count; i++) png_set_free(&b.pngs[i]);
+	free(b.csp);
+	free(b.rgba);
+	free(b.chr);
+	free(b.img);
+	return failures ? 1 : 0;
+}
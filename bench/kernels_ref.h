@@ -0,0 +1,873 @@
+//
+// Velella
+// bench/kernels_ref.h
+//
+// Reference copies of the pixel kernels, frozen as plain scalar code. The
+// kernel benchmark checks that the versions in src/ still produce exactly
+// the same output as these, so the ones in src/ may be rewritten for speed
+// while these stay as they are.
+//
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "format.h"
+#include "mdcsp_claim.h"
+#include "pal.h"
+
+// =============
+// tileread.h
+// =============
+
+// px_frame: source image data (top left)
+// src_w: source image width
+// src_h: source image height
+// tw: width
+// th: height
+// angle: rotation angle (90 degree only)
+// chr_w: handle to output buffer
+// returns new output buffer handle, advanced by pixel count (sw * sh)
+static inline uint8_t *ref_tile_read_tile(uint8_t *px_frame, int src_w,
+                                          int tw, int th,
+                                          int tw_lim, int th_lim,
+                                          int angle,
+                                          uint32_t flags, uint8_t *chr_w)
+{
+	const bool yoko = ((angle == 0) || (angle == 180));
+	const int touter_lim = yoko ? th : tw;
+	const int tinner_lim = yoko ? tw : th;
+
+	// The inner and outer iteration order is based on the orientation
+	// of the sprite, as in general the hardware works in yoko terms.
+
+	// Tile outer iteration
+	for (int to = 0; to < touter_lim; to++)  // h in yoko, w in tate
+	{
+		// Tile inner iteration
+		for (int ti = 0; ti < tinner_lim; ti++)  // w in yoko, h in tate
+		{
+			// Index calculation.
+			int yoffs = 0;
+			int xoffs = 0;
+			switch (angle)
+			{
+				case 0:
+					yoffs = to;
+					xoffs = ti;
+					break;
+				case 270:
+					xoffs = to;
+					yoffs = th - 1 - ti;
+					break;
+				case 180:
+					yoffs = th - 1 - to;
+					xoffs = tw - 1 - ti;
+					break;
+				case 90:
+					xoffs = tw - 1 - to;
+					yoffs = ti;
+					break;
+				default:
+					break;
+			}
+
+			if (xoffs >= tw_lim || yoffs >= th_lim)
+			{
+				*chr_w++ = 0;
+			}
+			else
+			{
+				const unsigned int px_idx = (yoffs*src_w) + xoffs;
+				const uint8_t pixel = px_frame[px_idx];
+				*chr_w++ = pixel;
+				if (flags & TILE_READ_FLAG_ERASE) px_frame[px_idx] = 0;
+			};
+
+		}
+
+	}
+	return chr_w;
+}
+
+static inline void ref_get_tx_ty(int tile_inner, int tile_inner_count,
+                                 int tile_outer, int tile_outer_count,
+                                 int angle, bool x_major,
+                                 int *tx, int *ty)
+{
+	if (x_major)
+	{
+		switch (angle)
+		{
+			default:
+
+			case 0:
+				*ty = tile_inner;
+				*tx = tile_outer;
+				break;
+
+			case 90:
+				*tx = tile_outer_count - 1 - tile_outer;
+				*ty = tile_outer;
+				break;
+
+			case 180:
+				*ty = tile_inner_count - 1 - tile_inner;
+				*tx = tile_outer_count - 1 - tile_outer;
+				break;
+
+			case 270:
+				*tx = tile_inner;
+				*ty = tile_outer_count - 1 - tile_outer;
+				break;
+		}
+	}
+	else
+	{
+		switch (angle)
+		{
+			default:
+
+			case 0:
+				*ty = tile_outer;
+				*tx = tile_inner;
+				break;
+
+			case 90:
+				*tx = tile_inner_count - 1 - tile_inner;
+				*ty = tile_inner;
+				break;
+
+			case 180:
+				*ty = tile_outer_count - 1 - tile_outer;
+				*tx = tile_inner_count - 1 - tile_inner;
+				break;
+
+			case 270:
+				*tx = tile_outer;
+				*ty = tile_inner_count - 1 - tile_inner;
+				break;
+		}
+	}
+}
+
+static inline uint8_t *ref_tile_read_frame(uint8_t *px,
+                                           int png_w, int png_h,
+                                           int png_x, int png_y,
+                                           int sw_adj, int sh_adj,
+                                           int tilesize,
+                                           int angle,
+                                           int lim_x, int lim_y,
+                                           uint32_t flags,
+                                           uint8_t *chr_w)
+{
+	// TODO: Complain about junk tilesize
+	if (tilesize <= 0) return chr_w;
+
+	const bool coords_direct = flags & TILE_READ_POS_DIRECT;
+	const int src_x_coef = coords_direct ? 1 : sw_adj;
+	const int src_y_coef = coords_direct ? 1 : sh_adj;
+
+	// Set up tile iteration
+	int tile_outer_count = 0;
+	int tile_inner_count = 0;
+	const bool yoko_angle = (angle == 0 || angle == 180);
+	const bool x_major = flags & TILE_READ_FLAG_X_MAJOR;
+	if ((yoko_angle && !x_major) || (!yoko_angle && x_major))
+	{
+		tile_outer_count = sh_adj / tilesize;
+		tile_inner_count = sw_adj / tilesize;
+	}
+	else
+	{
+		tile_outer_count = sw_adj / tilesize;
+		tile_inner_count = sh_adj / tilesize;
+	}
+
+	for (int tile_outer = 0; tile_outer < tile_outer_count; tile_outer++)
+	{
+		for (int tile_inner = 0; tile_inner < tile_inner_count; tile_inner++)
+		{
+			int tx, ty;
+			ref_get_tx_ty(tile_inner, tile_inner_count,
+			              tile_outer, tile_outer_count,
+			              angle, x_major, &tx, &ty);
+
+			const int src_y = ((png_y * src_y_coef) + (ty * tilesize));
+			const int src_x = ((png_x * src_x_coef) + (tx * tilesize));
+
+			const int base_idx = (src_y * png_w) + src_x;
+			uint8_t *px_frame = &px[base_idx];  // Top-left of frame.
+			int clip_w = (tilesize <= 0) ? sw_adj : tilesize;
+			int clip_h = (tilesize <= 0) ? sh_adj : tilesize;
+
+			int clip_lim_w = clip_w;
+			int clip_lim_h = clip_h;
+
+			if (lim_x >= 0 && src_x + clip_lim_w > lim_x) clip_lim_w = lim_x - src_x;
+			if (lim_y >= 0 && src_y + clip_lim_h > lim_y) clip_lim_h = lim_y - src_y;
+
+			chr_w = ref_tile_read_tile(px_frame, png_w, clip_w, clip_h, clip_lim_w, clip_lim_h, angle, flags, chr_w);
+		}
+	}
+	return chr_w;
+}
+
+// =============
+// pxutil.c
+// =============
+
+// Rotates a tile in place.
+static void ref_rotate_tile(uint8_t *imgdat, int x, int y, int line_w,
+                            int tsize, int angle)
+{
+	if (angle == 0) return;
+	uint8_t *imgcopy = malloc(sizeof(uint8_t) * tsize * tsize);
+	if (!imgcopy)
+	{
+		fprintf(stderr, "Couldn't allocate for tile rotation.\n");
+		return;
+	}
+
+	switch (angle % 360)
+	{
+		case 0:
+			break;
+		case 90:
+			for (int dy = 0; dy < tsize; dy++)
+			{
+				for (int dx = 0; dx < tsize; dx++)
+				{
+					const int sy = tsize - dx - 1;
+					const int sx = dy;
+					imgcopy[dy*tsize + dx] = imgdat[((y+sy)*line_w) + (x+sx)];
+				}
+			}
+			break;
+		case 270:
+			for (int dy = 0; dy < tsize; dy++)
+			{
+				for (int dx = 0; dx < tsize; dx++)
+				{
+					const int sy = dx;
+					const int sx = tsize - dy - 1;
+					imgcopy[dy*tsize + dx] = imgdat[((y+sy)*line_w) + (x+sx)];
+				}
+			}
+			break;
+		case 180:
+			for (int dy = 0; dy < tsize; dy++)
+			{
+				for (int dx = 0; dx < tsize; dx++)
+				{
+					const int sy = tsize - dy - 1;
+					const int sx = tsize - dx - 1;
+					imgcopy[dy*tsize + dx] = imgdat[((y+sy)*line_w) + (x+sx)];
+				}
+			}
+			break;
+		default:
+			fprintf(stderr, "Unsupported rotation angle %d\n", angle);
+			break;
+	}
+
+	for (int cy = 0; cy < tsize; cy++)
+	{
+		for (int cx = 0; cx < tsize; cx++)
+		{
+			imgdat[(cy+y)*line_w + x + cx] = imgcopy[cy*tsize + cx];
+		}
+	}
+
+	free(imgcopy);
+}
+
+
+static bool ref_pack_planar(const uint8_t *in, int planes,
+                            uint32_t order, bool reverse, uint8_t *out)
+{
+	if (planes > 8)
+	{
+		fprintf(stderr, "More than eight bitplanes are not supported.\n");
+		return false;
+	}
+	for (int plane = 0; plane < planes; plane++)
+	{
+		const int plane_bit = order & 0x7;
+		if (plane_bit >= planes)
+		{
+			fprintf(stderr, "Plane bit %d used despite plane count of %d\n",
+			       plane_bit, planes);
+			return false;
+		}
+
+		out[plane] = 0;
+		const uint8_t testbits = (1 << plane_bit);
+
+		for (int i = 0; i < 8; i++)
+		{
+			if (!(in[i] & testbits)) continue;
+
+			if (reverse) out[plane] |= (0x01 << i);
+			else out[plane] |= (0x80 >> i);
+		}
+		order = order >> 4;
+	}
+	return true;
+}
+
+// Pass a pointer to eight pixels and linear data comes out.
+//
+// in: pointer to linear array of 8 pixels (one byte per)
+// depth: bits per pixel (power of two)
+// reverse: if true, data is emitted horizontally flipped
+// out: pointer to destination buffer (1 * depth in size)
+static bool ref_pack_linear(const uint8_t *in, unsigned int depth,
+                            bool reverse, uint8_t *out)
+{
+	if (depth >= 8)
+	{
+		fprintf(stderr, "8bpp depth is not supported.\n");
+		return false;
+	}
+	if (((depth & (depth - 1)) != 0) || depth <= 0)
+	{
+		fprintf(stderr, "Only power of two depths are supported.\n");
+		return false;
+	}
+
+	int out_idx = 0;
+	const int out_bit_init = 7 - depth;
+	int out_bit = out_bit_init;
+	out[out_idx] = 0;
+	for (int i = 0; i < 8; i++)
+	{
+		const int in_idx = reverse ? (7 - i) : i;
+		const int data_mask = (1 << depth) - 1;
+		const int px = in[in_idx] & data_mask;
+		out[out_idx] |= (px << out_bit);
+		out_bit -= depth;
+		if (out_bit < 0)
+		{
+			out_bit = out_bit_init;
+			out_idx++;
+			out[out_idx] = 0;
+		}
+	}
+	return true;
+}
+
+// The nibble packing loops of entry_pack_chr() for SP013 (swap) and BG038,
+// or the MD formats without hi.
+static void ref_pack_nibbles(const uint8_t *chr, size_t pairs, bool swap, bool hi,
+                             uint8_t *out)
+{
+	for (size_t i = 0; i < pairs; i++)
+	{
+		const uint8_t fetchpx0 = *chr++;
+		const uint8_t fetchpx1 = *chr++;
+
+		const uint8_t px0 = swap ? fetchpx1 : fetchpx0;
+		const uint8_t px1 = swap ? fetchpx0 : fetchpx1;
+
+		const uint8_t lowbyte = ((px0 << 4) & 0xF0) | (px1 & 0x0F);
+		const uint8_t hibyte = (px0 & 0xF0) | ((px1 >> 4) & 0x0F);
+
+		*out++ = lowbyte;
+		if (hi) *out++ = hibyte;
+	}
+}
+
+// The NEO FIX loop of entry_pack_chr().
+static void ref_pack_nibble_columns(const uint8_t *chr, size_t tiles, uint8_t *out)
+{
+	for (size_t i = 0; i < tiles; i++)
+	{
+		const uint8_t *chr_tile = &chr[i*8*8];
+		static const int column_pair_order_tbl[4] = {2, 3, 0, 1};
+		for (int colset = 0; colset < 4; colset++)
+		{
+			for (int row = 0; row < 8; row++)
+			{
+				const int source_x_offset = column_pair_order_tbl[colset]*2;
+
+				const uint8_t px_lo = (chr_tile[(row*8) + source_x_offset +1] & 0xF) << 4;
+				const uint8_t px_hi = (chr_tile[(row*8) + source_x_offset] & 0xF);
+				*out++ = px_lo | px_hi;
+			}
+		}
+	}
+}
+
+// =============
+// entry_emit.c
+// =============
+
+// entry_pack_chr(), with the output stored to out. Returns the end of the
+// data written.
+static uint8_t *ref_emit_chr(DataFormat fmt, int depth, int tilesize,
+                             const uint8_t *chr, size_t chr_bytes, uint8_t *out)
+{
+	switch (fmt)
+	{
+		// 8bpp as-is
+		case DATA_FORMAT_DIRECT:
+			for (size_t i = 0; i < chr_bytes; i++) *out++ = chr[i];
+			break;
+
+		// sp013 special 4bpp/8bpp hybrid
+		case DATA_FORMAT_SP013:
+			for (size_t i = 0; i < chr_bytes/2; i++)
+			{
+				const uint8_t fetchpx0 = *chr++;
+				const uint8_t fetchpx1 = *chr++;
+
+				// Inverted data order for SP013.
+				const uint8_t px0 = fetchpx1;
+				const uint8_t px1 = fetchpx0;
+
+				const uint8_t lowbyte = ((px0 << 4) & 0xF0) | (px1 & 0x0F);
+				const uint8_t hibyte = (px0 & 0xF0) | ((px1 >> 4) & 0x0F);
+
+				*out++ = lowbyte;
+				if (depth == 8) *out++ = hibyte;
+			}
+			break;
+
+		case DATA_FORMAT_BG038:
+			for (size_t i = 0; i < chr_bytes/2; i++)
+			{
+				const uint8_t px0 = *chr++;
+				const uint8_t px1 = *chr++;
+
+				const uint8_t lowbyte = ((px0 << 4) & 0xF0) | (px1 & 0x0F);
+				const uint8_t hibyte = (px0 & 0xF0) | ((px1 >> 4) & 0x0F);
+
+				*out++ = lowbyte;
+				if (depth == 8) *out++ = hibyte;
+			}
+			break;
+
+		case DATA_FORMAT_CPS_BG:
+			if (tilesize == 8)
+			{
+				for (size_t i = 0; i < chr_bytes/(8*8); i++)
+				{
+					for (size_t j = 0; j < 8; j++)
+					{
+						uint8_t even[4] = {0};
+						for (size_t k = 0; k < 8; k++)
+						{
+							for (int bit = 0; bit < 4; bit++)
+							{
+								even[bit] = even[bit] << 1;
+								even[bit] |= ((chr[(j*8)+k]   & (1<<bit)) ? 1 : 0);
+							}
+						}
+						for (int bit = 0; bit < 4; bit++) *out++ = ~even[bit];
+						for (int bit = 0; bit < 4; bit++) *out++ = ~even[bit];
+					}
+					chr += 8*8;
+				}
+				break;
+			}
+			else if (tilesize == 32)
+			{
+				break;
+			}
+			__attribute__((fallthrough));
+
+		case DATA_FORMAT_CPS_SPR:
+			for (size_t i = 0; i < chr_bytes/(16*16); i++)
+			{
+				for (size_t j = 0; j < 16; j++)
+				{
+					uint8_t even[4] = {0};
+					uint8_t odd[4] = {0};
+					for (size_t k = 0; k < 8; k++)
+					{
+						for (int bit = 0; bit < 4; bit++)
+						{
+							even[bit] = even[bit] << 1;
+							odd[bit]  = odd[bit] << 1;
+							even[bit] |= ((chr[(j*16)+k]   & (1<<bit)) ? 1 : 0);
+							odd[bit]  |= ((chr[(j*16)+k+8] & (1<<bit)) ? 1 : 0);
+						}
+					}
+
+					for (int bit = 0; bit < 4; bit++) *out++ = ~even[bit];
+					for (int bit = 0; bit < 4; bit++) *out++ = ~odd[bit];
+				}
+				chr += 16*16;
+			}
+			break;
+
+		case DATA_FORMAT_MD_SPR:
+		case DATA_FORMAT_MD_BG:
+		case DATA_FORMAT_MD_CSP:
+		case DATA_FORMAT_TOA_TXT:
+			for (size_t i = 0; i < chr_bytes/2; i++)
+			{
+				const uint8_t px0 = *chr++;
+				const uint8_t px1 = *chr++;
+
+				const uint8_t lowbyte = ((px0 << 4) & 0xF0) | (px1 & 0x0F);
+
+				*out++ = lowbyte;
+			}
+			break;
+
+		// 4bpp planar
+		case DATA_FORMAT_TOA_GCU_SPR:
+		case DATA_FORMAT_TOA_GCU_BG:
+			for (size_t i = 0; i < (chr_bytes)/(8); i++)
+			{
+				const uint8_t *chr_row = &chr[i*8];
+
+				for (size_t plane = 0; plane < 4; plane++)
+				{
+					uint8_t row_out = 0;
+					const uint8_t mask = 1 << plane;
+					for (size_t col = 0; col < 8; col++)
+					{
+						row_out = row_out << 1;
+						if (chr_row[col] & mask) row_out |= 0x01;
+					}
+					*out++ = row_out;
+				};
+			}
+			break;
+
+		// Linear, in a funny order
+		case DATA_FORMAT_NEO_FIX:
+			for (size_t i = 0; i < chr_bytes/(8*8); i++)
+			{
+				const uint8_t *chr_tile = &chr[i*8*8];
+				static const int column_pair_order_tbl[4] = {2, 3, 0, 1};
+				for (int colset = 0; colset < 4; colset++)
+				{
+					for (int row = 0; row < 8; row++)
+					{
+						const int source_x_offset = column_pair_order_tbl[colset]*2;
+
+						const uint8_t px_lo = (chr_tile[(row*8) + source_x_offset +1] & 0xF) << 4;
+						const uint8_t px_hi = (chr_tile[(row*8) + source_x_offset] & 0xF);
+						*out++ = px_lo | px_hi;
+					}
+				}
+			}
+			break;
+
+		// Planar
+		case DATA_FORMAT_NEO_SPR:
+			for (size_t i = 0; i < chr_bytes/(16*16); i++)  // per tile
+			{
+				const uint8_t *chr_tile16 = &chr[i*16*16];
+				for (int tx = 1; tx >= 0; tx--)
+				{
+					for (int y = 0; y < 16; y++)
+					{
+						const uint8_t *chr_row = &chr_tile16[(tx*8)+(y*16)];
+						ref_pack_planar(chr_row, 4, 0x3210, true, out);
+						out += 4;
+					}
+				}
+			}
+			break;
+
+		default:
+			break;
+	}
+	return out;
+}
+
+// =============
+// crc32.c
+// =============
+
+static uint32_t ref_crc32_bytes(const uint8_t *data, size_t len)
+{
+	uint32_t crc = 0xFFFFFFFF;
+	for (size_t i = 0; i < len; i++)
+	{
+		const uint32_t byte = data[i];
+		crc = crc ^ byte;
+		for (int j = 7; j >= 0; j--)
+		{
+			const uint32_t mask = ~(crc & 1);
+			crc = (crc >> 1) ^ (0xEDB88320 & mask);
+		}
+	}
+	return ~crc;
+}
+
+// =============
+// pal.c
+// =============
+
+static uint16_t ref_pal_pack_entry(PalFormat fmt, uint8_t r, uint8_t g, uint8_t b)
+{
+	switch (fmt)
+	{
+		case PAL_FORMAT_ATLUS:
+			r = r >> 3;
+			g = g >> 3;
+			b = b >> 3;
+			return (r << 5) | (g << 10) | b;
+
+		case PAL_FORMAT_X68000:
+			r = r >> 3;
+			g = g >> 3;
+			b = b >> 3;
+			return (r << 6) | (g << 11) | (b << 1);
+
+		case PAL_FORMAT_MD:
+			return ((r >> 3 & 1) ? 0x1000 : 0x0000) |
+			       ((g >> 3 & 1) ? 0x2000 : 0x0000) |
+			       ((b >> 3 & 1) ? 0x4000 : 0x0000) |
+			       (((r >> 4) & 0x0F)) |
+			       (((g >> 4) & 0x0F) << 4) |
+			       (((b >> 4) & 0x0F) << 8);
+
+		case PAL_FORMAT_CPS:
+			r = r >> 4;
+			g = g >> 4;
+			b = b >> 4;
+			return 0xF000 | (r << 8) | (g << 4) | (b);
+
+		case PAL_FORMAT_TOA:
+			r = r >> 3;
+			g = g >> 3;
+			b = b >> 3;
+			return (g << 5) | (b << 10) | r;
+
+		case PAL_FORMAT_NEO:
+			{
+				// Logic taken from the neo geo development wiki. What in the world
+				const int luma = (int)(((54.213f*r) + (182.376f*g) + (18.411f*b))) & 1;
+				r = r >> 3;
+				g = g >> 3;
+				b = b >> 3;
+
+				return (luma ? 0x0000 : 0x8000) | 
+				       ((r & 0x01) << 14) |
+				       ((g & 0x01) << 13) |
+				       ((b & 0x01) << 12) |
+				       ((r >> 1) << 8) |
+				       ((g >> 1) << 4) |
+				       ((b >> 1));
+				// TODO: Considerations for the dark bit
+			}
+			break;
+
+		default:
+			fprintf(stderr, "[pal] Unhandled palette type %d\n", fmt);
+			return 0;
+	}
+	return 0;
+}
+
+// =============
+// mdcsp_claim.c
+// =============
+
+#define REF_TSIZE 8
+
+static bool ref_empty_test(const uint8_t *imgdat,
+                           int iw, int ih,
+                           int sx, int sy, int sw, int sh)
+{
+	// safety check
+	int xlim = sx+sw;
+	if (xlim > iw) xlim = iw;
+	int ylim = sy+sh;
+	if (ylim > ih) ylim = ih;
+	// test region
+	for (int y = sy; y < ylim; y++)
+	{
+		for (int x = sx; x < xlim; x++)
+		{
+			if (imgdat[x + (y * iw)] == 0) continue;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static ClaimSize ref_mdcsp_claim(const uint8_t *imgdat,
+                                 int sx, int sy, int sw, int sh,
+                                 int iw, int ih,
+                                 int *col, int *row)
+{
+	int max_h = 4;
+	int tiles_x = 4;
+	int tiles_y = max_h;
+
+	bool satisfied = false;
+	do
+	{
+		// 1) Walk down row by row looking for non-transparent pixel data.
+		*row = -1;
+		for (int y = sy; y < sy + sh; y++)
+		{
+			for (int x = sx; x < sx + sw; x++)
+			{
+				if (imgdat[x + (y * iw)] == 0) continue;
+				// Note the row image data was found on, and break out.
+				*row = y;
+				break;
+			}
+			// Break out if we are done searching.
+			if (*row >= 0) break;
+		}
+		if (*row < 0) return CLAIM_SIZE_NONE;  // Image is empty.
+
+		// 2) We have the top row, but we need to scan within a block to find a
+		// viable sprite chunk to extract. Scan rightwards to find a left edge.
+		*col = -1;
+		const int test_h_px = REF_TSIZE * max_h;
+		for (int x = sx; x < sx + sw; x++)
+		{
+			// As our test column extends TEST_H_PX below the starting line, we must
+			// ensure we don't exceed the boundaries of the sprite clipping region
+			// or the source image data.
+			int ylim = *row + test_h_px;
+			if (ylim >= sy + sh) ylim = sy + sh - 1;
+			for (int y = *row; y < ylim; y++)
+			{
+				if (imgdat[x + (y * iw)] == 0) continue;
+				// Found it; break out.
+				*col = x;
+				break;
+			}
+			// If the column is set, we are done.
+			if (*col >= 0) break;
+		}
+		// Sanity check that something hasn't gone wrong.
+		if (*col < 0)
+		{
+			printf("Unexpectedly empty strip from row %d?\n", *row);
+			return CLAIM_SIZE_NONE;
+		}
+
+		// 3) We now have a 32xh box, at *col, *row. First comes the most obvious
+		// optimization which is shrinking it down if it extends outside the frame.
+		tiles_x = 4;
+		tiles_y = max_h;
+
+		const int tiles_to_right  = ((sx+sw) - (*col - (REF_TSIZE-1))) / REF_TSIZE;
+		const int tiles_to_bottom = ((sy+sh) - (*row - (REF_TSIZE-1))) / REF_TSIZE;
+
+		if (tiles_x > tiles_to_right) tiles_x = tiles_to_right;
+		if (tiles_y > tiles_to_bottom) tiles_y = tiles_to_bottom;
+		if (tiles_x <= 0 || tiles_y <= 0)
+		{
+			printf("Unexpectedly low tile dimensions %d x %d\n", tiles_x, tiles_y);
+			return CLAIM_SIZE_NONE;
+		}
+
+		// 4) Try to reduce the size. As we searched from the top-left, col and
+		// row will never be changed.
+
+		bool reduction_done = false;
+		while (!reduction_done)
+		{
+			reduction_done = true;
+			// Try reducing on the right.
+			if (tiles_x > 1)
+			{
+				const int test_x = *col + ((tiles_x - 1) * REF_TSIZE);
+				const int test_y = *row;
+				const int test_w = REF_TSIZE;
+				const int test_h = tiles_y * REF_TSIZE;
+				if (ref_empty_test(imgdat, iw, ih, test_x, test_y, test_w, test_h))
+				{
+					tiles_x--;
+					reduction_done = false;
+				}
+			}
+			// Try the bottom too.
+			if (tiles_y > 1)
+			{
+				const int test_x = *col;
+				const int test_y = *row + ((tiles_y - 1) * REF_TSIZE);
+				const int test_w = tiles_x * REF_TSIZE;
+				const int test_h = REF_TSIZE;
+				if (ref_empty_test(imgdat, iw, ih, test_x, test_y, test_w, test_h))
+				{
+					tiles_y--;
+					reduction_done = false;
+				}
+			}
+		}
+
+		// 5) Eliminate particularly bad case where only the right and bottom
+		//    edges are being utilized due to the previous clip. Re-do with a
+		//    reduced maximum height if so.
+
+		if (tiles_x > 1 && tiles_y >= 3)
+		{
+			satisfied = false;
+			int row_util[4];
+			for (int ty = 0; ty < tiles_y; ty++)
+			{
+				row_util[ty] = 0;
+				for (int tx = 0; tx < tiles_x; tx++)
+				{
+					if (!ref_empty_test(imgdat, iw, ih,
+						*col + (REF_TSIZE * tx), *row + (REF_TSIZE * ty),
+									REF_TSIZE, REF_TSIZE))
+					{
+						row_util[ty]++;
+					}
+				}
+			}
+
+			for (int i = 0; i < tiles_y - 2; i++)
+			{
+				if (row_util[i] > 1) satisfied = true;
+			}
+		}
+		else
+		{
+			satisfied = true;
+		}
+
+		if (max_h == 1) satisfied = true;
+		else if (!satisfied) max_h--;
+	} while (!satisfied);
+
+	switch (tiles_x)
+	{
+		case 4:
+			if (tiles_y == 4) return CLAIM_SIZE_4x4;
+			if (tiles_y == 3) return CLAIM_SIZE_4x3;
+			if (tiles_y == 2) return CLAIM_SIZE_4x2;
+			if (tiles_y == 1) return CLAIM_SIZE_4x1;
+			return CLAIM_SIZE_NONE;
+		case 3:
+			if (tiles_y == 4) return CLAIM_SIZE_3x4;
+			if (tiles_y == 3) return CLAIM_SIZE_3x3;
+			if (tiles_y == 2) return CLAIM_SIZE_3x2;
+			if (tiles_y == 1) return CLAIM_SIZE_3x1;
+			return CLAIM_SIZE_NONE;
+		case 2:
+			if (tiles_y == 4) return CLAIM_SIZE_2x4;
+			if (tiles_y == 3) return CLAIM_SIZE_2x3;
+			if (tiles_y == 2) return CLAIM_SIZE_2x2;
+			if (tiles_y == 1) return CLAIM_SIZE_2x1;
+			return CLAIM_SIZE_NONE;
+		case 1:
+			if (tiles_y == 4) return CLAIM_SIZE_1x4;
+			if (tiles_y == 3) return CLAIM_SIZE_1x3;
+			if (tiles_y == 2) return CLAIM_SIZE_1x2;
+			if (tiles_y == 1) return CLAIM_SIZE_1x1;
+			return CLAIM_SIZE_NONE;
+		default:
+			return CLAIM_SIZE_NONE;
+	}
+}
@@ -0,0 +1,176 @@
+#include "cache.h"
+#include "hash.h"
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CACHE_MAGIC 0x434C4556  // "VELC"
+// Bump when the conversion output or the cache layout changes.
+#define CACHE_VERSION 1
+
+typedef struct CacheHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t entry_size;  // sizeof(Entry), to catch layout changes.
+	uint32_t pad;
+	uint64_t key;
+} CacheHeader;
+
+static atomic_uint s_tmp_serial;
+
+uint64_t cache_key(uint64_t src_hash, const FrameCfg *frame_cfg)
+{
+	uint64_t hash = HASH_INIT;
+	hash = hash_int(hash, CACHE_VERSION);
+	hash = hash_bytes(hash, &src_hash, sizeof(src_hash));
+	// Only the settings that influence conversion; the code is assigned later.
+	hash = hash_int(hash, frame_cfg->w);
+	hash = hash_int(hash, frame_cfg->h);
+	hash = hash_int(hash, frame_cfg->angle);
+	hash = hash_int(hash, frame_cfg->tilesize);
+	hash = hash_int(hash, frame_cfg->depth);
+	hash = hash_int(hash, frame_cfg->pal_format);
+	hash = hash_int(hash, frame_cfg->data_format);
+	hash = hash_int(hash, frame_cfg->center);
+	return hash;
+}
+
+static void cache_fname(const char *dir, uint64_t key, char *buf, size_t len)
+{
+	snprintf(buf, len, "%s/%016llX.vch", dir, (unsigned long long)key);
+}
+
+bool cache_load(const char *dir, uint64_t key, Entry *e)
+{
+	char fname[512];
+	cache_fname(dir, key, fname, sizeof(fname));
+	FILE *f = fopen(fname, "rb");
+	if (!f) return false;
+
+	bool ret = false;
+	uint8_t *chr = NULL;
+	CacheHeader hdr;
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1) goto done;
+	if (hdr.magic != CACHE_MAGIC || hdr.version != CACHE_VERSION ||
+	    hdr.entry_size != sizeof(Entry) || hdr.key != key)
+	{
+		goto done;
+	}
+
+	// Read into a scratch entry so a truncated file leaves e untouched.
+	Entry *c = malloc(sizeof(*c));
+	if (!c) goto done;
+	bool ok = true;
+	ok = ok && fread(&c->frame_cfg, sizeof(c->frame_cfg), 1, f) == 1;
+	ok = ok && fread(&c->pal_size, sizeof(c->pal_size), 1, f) == 1;
+	ok = ok && (c->pal_size >= 0 && c->pal_size <= 256);
+	ok = ok && fread(c->pal, sizeof(c->pal[0]), c->pal_size, f) == (size_t)c->pal_size;
+	ok = ok && fread(&c->code_per, sizeof(c->code_per), 1, f) == 1;
+	ok = ok && fread(&c->code_count, sizeof(c->code_count), 1, f) == 1;
+	ok = ok && fread(&c->frames, sizeof(c->frames), 1, f) == 1;
+	ok = ok && fread(&c->sp013, sizeof(c->sp013), 1, f) == 1;
+	ok = ok && fread(&c->cps_spr, sizeof(c->cps_spr), 1, f) == 1;
+	ok = ok && fread(&c->md_spr, sizeof(c->md_spr), 1, f) == 1;
+	ok = ok && fread(&c->md_csp, sizeof(c->md_csp), 1, f) == 1;
+	ok = ok && fread(&c->gcu_spr, sizeof(c->gcu_spr), 1, f) == 1;
+	ok = ok && fread(&c->neo_cspr, sizeof(c->neo_cspr), 1, f) == 1;
+	ok = ok && fread(&c->map_bytes, sizeof(c->map_bytes), 1, f) == 1;
+	ok = ok && fread(&c->chr_bytes, sizeof(c->chr_bytes), 1, f) == 1;
+	if (ok)
+	{
+		chr = malloc(c->chr_bytes ? c->chr_bytes : 1);
+		ok = chr && fread(chr, 1, c->chr_bytes, f) == c->chr_bytes;
+	}
+
+	if (ok)
+	{
+		// The code is not part of the key, so keep the one from the script.
+		const uint32_t code = e->frame_cfg.code;
+		e->frame_cfg = c->frame_cfg;
+		e->frame_cfg.code = code;
+		e->pal_size = c->pal_size;
+		memcpy(e->pal, c->pal, sizeof(e->pal[0]) * c->pal_size);
+		e->code_per = c->code_per;
+		e->code_count = c->code_count;
+		e->frames = c->frames;
+		e->sp013 = c->sp013;
+		e->cps_spr = c->cps_spr;
+		e->md_spr = c->md_spr;
+		e->md_csp = c->md_csp;
+		e->gcu_spr = c->gcu_spr;
+		e->neo_cspr = c->neo_cspr;
+		e->map_bytes = c->map_bytes;
+		e->chr_bytes = c->chr_bytes;
+		e->chr = chr;
+		chr = NULL;
+		ret = true;
+	}
+	free(c);
+
+done:
+	free(chr);
+	fclose(f);
+	return ret;
+}
+
+bool cache_store(const char *dir, uint64_t key, const Entry *e)
+{
+	if (mkdir(dir, 0777) != 0 && errno != EEXIST)
+	{
+		fprintf(stderr, "[CACHE] Couldn't create directory %s\n", dir);
+		return false;
+	}
+
+	// Write to a private temporary name first, so readers never see a
+	// partially written file.
+	char fname[512];
+	char tmp_fname[600];
+	cache_fname(dir, key, fname, sizeof(fname));
+	snprintf(tmp_fname, sizeof(tmp_fname), "%s.%ld.%u", fname, (long)getpid(),
+	         atomic_fetch_add(&s_tmp_serial, 1));
+	FILE *f = fopen(tmp_fname, "wb");
+	if (!f)
+	{
+		fprintf(stderr, "[CACHE] Couldn't open %s for writing\n", tmp_fname);
+		return false;
+	}
+
+	CacheHeader hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = CACHE_MAGIC;
+	hdr.version = CACHE_VERSION;
+	hdr.entry_size = sizeof(Entry);
+	hdr.key = key;
+
+	bool ok = true;
+	ok = ok && fwrite(&hdr, sizeof(hdr), 1, f) == 1;
+	ok = ok && fwrite(&e->frame_cfg, sizeof(e->frame_cfg), 1, f) == 1;
+	ok = ok && fwrite(&e->pal_size, sizeof(e->pal_size), 1, f) == 1;
+	ok = ok && fwrite(e->pal, sizeof(e->pal[0]), e->pal_size, f) == (size_t)e->pal_size;
+	ok = ok && fwrite(&e->code_per, sizeof(e->code_per), 1, f) == 1;
+	ok = ok && fwrite(&e->code_count, sizeof(e->code_count), 1, f) == 1;
+	ok = ok && fwrite(&e->frames, sizeof(e->frames), 1, f) == 1;
+	ok = ok && fwrite(&e->sp013, sizeof(e->sp013), 1, f) == 1;
+	ok = ok && fwrite(&e->cps_spr, sizeof(e->cps_spr), 1, f) == 1;
+	ok = ok && fwrite(&e->md_spr, sizeof(e->md_spr), 1, f) == 1;
+	ok = ok && fwrite(&e->md_csp, sizeof(e->md_csp), 1, f) == 1;
+	ok = ok && fwrite(&e->gcu_spr, sizeof(e->gcu_spr), 1, f) == 1;
+	ok = ok && fwrite(&e->neo_cspr, sizeof(e->neo_cspr), 1, f) == 1;
+	ok = ok && fwrite(&e->map_bytes, sizeof(e->map_bytes), 1, f) == 1;
+	ok = ok && fwrite(&e->chr_bytes, sizeof(e->chr_bytes), 1, f) == 1;
+	ok = ok && fwrite(e->chr, 1, e->chr_bytes, f) == e->chr_bytes;
+	if (fclose(f) != 0) ok = false;
+
+	if (!ok || rename(tmp_fname, fname) != 0)
+	{
+		fprintf(stderr, "[CACHE] Couldn't write %s\n", fname);
+		remove(tmp_fname);
+		return false;
+	}
+	return true;
+}
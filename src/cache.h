@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "types.h"
+
+//
+// Content-addressed cache of converted entries.
+//
+// Each cache file is named after a hash of the source PNG bytes and the
+// settings that affect conversion. It holds the converted 8bpp CHR data,
+// packed palette, format-specific blocks and counters for the entry, so an
+// unchanged entry can skip decoding and tile reading entirely. Code values
+// and data offsets are not cached, as those are assigned afterwards.
+//
+
+// Derives the cache key from the source file hash and conversion settings.
+uint64_t cache_key(uint64_t src_hash, const FrameCfg *frame_cfg);
+
+// Fills in the converted data for e from the cache.
+// Returns false if there is no usable cache file for the key.
+bool cache_load(const char *dir, uint64_t key, Entry *e);
+
+// Writes the converted data for e to the cache.
+bool cache_store(const char *dir, uint64_t key, const Entry *e);
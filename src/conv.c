@@ -1,6 +1,15 @@
 #include "conv.h"
+#include "cache.h"
+#include "entry_emit.h"
+#include "image.h"
+#include "imgcache.h"
+#include "palcache.h"
+#include "stats.h"
+#include "jobs.h"
 #include "pal.h"
+#include "pngdec.h"
 #include "tileread.h"
+#include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -26,11 +35,20 @@ static bool validate_angle(int angle)
 	}
 }
 
+// Checks value against a format's allowed values, which are powers of two
+// OR'd together, or 0 for any.
+static bool validate_option(int allowed, int value)
+{
+	if (allowed == 0) return true;
+	return value > 0 && (value & (value - 1)) == 0 && (value & allowed);
+}
+
 bool conv_init(Conv *s)
 {
 	memset(s, 0, sizeof(*s));
 	s->frame_cfg.depth = DEPTH_DEFAULT;
 	s->frame_cfg.tilesize = TILESIZE_DEFAULT;
+	s->jobs = 1;
 	return true;
 }
 
@@ -60,134 +78,37 @@ bool conv_validate(Conv *s)
 	}
 
 	// Tilesize and depth checks.
-	switch (s->frame_cfg.data_format)
+	if (frame_cfg->data_format == DATA_FORMAT_UNSPECIFIED)
 	{
-		case DATA_FORMAT_UNSPECIFIED:
-			fprintf(stderr, "[CONV] No data format specified!\n");
-			return false;
-
-		case DATA_FORMAT_DIRECT:
-			break;
-
-		case DATA_FORMAT_SP013:
-			if (frame_cfg->tilesize != 16)
-			{
-				fprintf(stderr, "[CONV] WARNING: Tilesize %dpx specified, but "
-				        "specified hardware only supports 16px.\n",
-				        frame_cfg->tilesize);
-				return false;
-			}
-
-			if (frame_cfg->depth != 4 && frame_cfg->depth != 8)
-			{
-				fprintf(stderr, "[CONV] sp013 supports 4bpp or 8bpp tiles.\n");
-				return false;
-			}
-			break;
-
-		case DATA_FORMAT_BG038:
-			// Limit to supported formats.
-			if (frame_cfg->tilesize != 8 && frame_cfg->tilesize != 16)
-			{
-				fprintf(stderr, "[CONV] Tilesize %dpx unsupported; "
-				        "BG038 only supports 8px or 16px.\n",
-				         frame_cfg->tilesize);
-				return false;
-			}
-
-			if (frame_cfg->depth != 4 && frame_cfg->depth != 8)
-			{
-				fprintf(stderr, "[CONV] bg038 supports 4bpp or 8bpp tiles.\n");
-				return false;
-			}
-			break;
-
-		case DATA_FORMAT_CPS_SPR:
-			if (frame_cfg->tilesize != 16)
-			{
-				fprintf(stderr, "[CONV] WARNING: Tilesize %dpx specified, but "
-				        "specified hardware only supports 16px.\n",
-				        frame_cfg->tilesize);
-				return false;
-			}
-
-			if (frame_cfg->depth != 4)
-			{
-				fprintf(stderr, "[CONV] CPS only supports 4bpp tile data.\n");
-				return false;
-			}
-			break;
-
-		case DATA_FORMAT_CPS_BG:
-			if (frame_cfg->tilesize != 8 && frame_cfg->tilesize != 16 && frame_cfg->tilesize != 32)
-			{
-				fprintf(stderr, "[CONV] Tilesize %dpx NG)", frame_cfg->tilesize);
-				return false;
-			}
-			if (frame_cfg->depth != 4)
-			{
-				fprintf(stderr, "[CONV] CPS only supports 4bpp tile data.\n");
-				return false;
-			}
-			break;
-
-		case DATA_FORMAT_TOA_GCU_BG:
-			if (frame_cfg->tilesize != 16)
-			{
-				fprintf(stderr, "[CONV] GCU background only supports 16x16 tiles.n");
-				return false;
-			}
-			break;
-
-		case DATA_FORMAT_TOA_GCU_SPR:
-			if (frame_cfg->w > 128 || frame_cfg->w > 128)
-			{
-				fprintf(stderr, "[CONV] Max GCU sprite size is 128x128.\n");
-				return false;
-			}
-			[[fallthrough]];
-		case DATA_FORMAT_MD_SPR:
-		case DATA_FORMAT_MD_BG:
-		case DATA_FORMAT_TOA_TXT:
-			if ((frame_cfg->w && frame_cfg->w < 8) ||
-			    (frame_cfg->h && frame_cfg->h < 8))
-			{
-				fprintf(stderr, "[CONV] Frame w/h must be at least the tilesize.\n");
-				return false;
-			}
-			if (frame_cfg->tilesize != 8)
-			{
-				fprintf(stderr, "[CONV] Only 8x8 tiles are supported for this format.\n");
-				return false;
-			}
-			[[fallthrough]];
-		case DATA_FORMAT_MD_CSP:
-		case DATA_FORMAT_MD_CBG:
-		case DATA_FORMAT_NEO_FIX:
-			if (frame_cfg->depth != 4)
-			{
-				fprintf(stderr, "[CONV] Only 4bpp tile data is supported for this format.\n");
-				return false;
-			}
-			break;
-
-		case DATA_FORMAT_NEO_SPR:
-		case DATA_FORMAT_NEO_CSPR:
-			if (frame_cfg->tilesize != 16)
-			{
-				fprintf(stderr, "[CONV] Only 16x16 tiles are supported for this format.\n");
-				return false;
-			}
-			if (frame_cfg->depth != 4)
-			{
-				fprintf(stderr, "[CONV] Only 4bpp tile data is supported for this format.\n");
-				return false;
-			}
-			break;
+		fprintf(stderr, "[CONV] No data format specified!\n");
+		return false;
+	}
 
-		default:
-			fprintf(stderr, "[CONV] Data format %d NG!\n", frame_cfg->data_format);
-			break;
+	const FormatDesc *desc = format_desc(frame_cfg->data_format);
+	const char *format_str = string_for_data_format(frame_cfg->data_format);
+	if (frame_cfg->data_format == DATA_FORMAT_TOA_GCU_SPR &&
+	    (frame_cfg->w > 128 || frame_cfg->h > 128))
+	{
+		fprintf(stderr, "[CONV] Max GCU sprite size is 128x128.\n");
+		return false;
+	}
+	if ((frame_cfg->w && frame_cfg->w < desc->min_frame) ||
+	    (frame_cfg->h && frame_cfg->h < desc->min_frame))
+	{
+		fprintf(stderr, "[CONV] Frame w/h must be at least the tilesize.\n");
+		return false;
+	}
+	if (!validate_option(desc->tilesizes, frame_cfg->tilesize))
+	{
+		fprintf(stderr, "[CONV] Tilesize %dpx unsupported by %s.\n",
+		        frame_cfg->tilesize, format_str);
+		return false;
+	}
+	if (!validate_option(desc->depths, frame_cfg->depth))
+	{
+		fprintf(stderr, "[CONV] %dbpp tile data unsupported by %s.\n",
+		        frame_cfg->depth, format_str);
+		return false;
 	}
 
 	if (!pal_validate_selection(frame_cfg->pal_format))
@@ -242,99 +163,65 @@ bool conv_entry_add(Conv *s)
 	{
 		e->symbol_upper[i] = toupper(e->symbol[i]);
 	}
+	strncpy(e->src, s->src, sizeof(e->src));
+	e->src[sizeof(e->src)-1] = '\0';
 	e->frame_cfg = s->frame_cfg;
 
-	e->chr_offs = s->chr_pos;
-	e->map_offs = s->map_pos;
-
-	FrameCfg *frame_cfg = &e->frame_cfg;
+	// The code value is only known once the entries before this one have been
+	// converted, so just note whether the script has set it explicitly.
+	e->code_set = s->code_set;
+	s->code_set = false;
 
-	//
-	// Load image data into 8bpp buffer.
-	//
-	const char *fname = s->src;
-	unsigned int png_w;
-	unsigned int png_h;
-	size_t png_fsize;
-	uint8_t *png;
-	int error = lodepng_load_file(&png, &png_fsize, fname);
-	LodePNGState state;
-	if (error)
-	{
-		fprintf(stderr, "[ENTRY $%03X: %s] LodePNG error %u: %s\n", e->id, fname, error,
-		        lodepng_error_text(error));
-		return false;
-	}
-	lodepng_state_init(&state);
-	state.info_raw.colortype = LCT_PALETTE;
-	state.info_raw.bitdepth = 8;
-	uint8_t *px;
-	error = lodepng_decode(&px, &png_w, &png_h, &state, png, png_fsize);
-	if (error)
-	{
-		fprintf(stderr, "[ENTRY $%03X: %s] LodePNG error %u: %s\n", e->id, fname, error,
-		        lodepng_error_text(error));
-		free(png);
-		return false;
-	}
+	if (s->imgcache) imgcache_expect(s->imgcache, e->src);
 
-	//
-	// Make native palette data (host endianness)
-	//
-	e->pal_size = state.info_png.color.palettesize;
-	pal_pack_set(frame_cfg->pal_format, state.info_png.color.palette, e->pal, state.info_png.color.palettesize);
-	e->pal_ref = NULL;
-	
-	// See if another entry has the same palette, and get a reference to it if so.
-	Entry *f = s->entry_head;
-	while (f && (f != e))
-	{
-		bool match = true;
-		// Palette size of other is >= this one's palette, and data matches
-		if (f->pal_size >= e->pal_size)
-		{
-			for (int i = 0; i < e->pal_size; i++)
-			{
-				if (e->pal[i] == f->pal[i]) continue;
-				match = false;
-				break;
-			}
-		}
-		else
-		{
-			match = false;
-		}
+	s->entry_count++;
+	return true;
+}
 
-		if (match)
-		{
-			e->pal_ref = f;
-			break;
-		}
+// A claim may test up to one tile past the right and bottom of its frame.
+#define CONV_CSP_WIN_PAD 8
 
-		f = f->next;
+// Copies the frame at (fx, fy) and what lies just past it into win, leaving
+// anything outside of the image as transparent. Claims only erase within the
+// frame, so the frames past it are still as they were in the image.
+static void conv_csp_window(const Image *img, int fx, int fy,
+                            int win_w, int win_h, uint8_t *win)
+{
+	memset(win, 0, win_w * win_h);
+	int copy_w = img->w - fx;
+	int copy_h = img->h - fy;
+	if (copy_w > win_w) copy_w = win_w;
+	if (copy_h > win_h) copy_h = win_h;
+	for (int y = 0; y < copy_h; y++)
+	{
+		memcpy(&win[y * win_w], &img->px[((fy + y) * img->w) + fx], copy_w);
 	}
+}
+
+typedef struct ConvLayout
+{
+	int sw_adj, sh_adj;          // Frame size, rounded down to whole tiles.
+	int frame_count_x, frame_count_y;
+	int chr_bytes_per;           // 8bpp CHR for one frame.
+} ConvLayout;
+
+// Works out the frame size, frame count, code use and size codes of an entry
+// from the dimensions of its source image. Nothing here depends on the pixels.
+static bool conv_entry_layout(Entry *e, int png_w, int png_h, ConvLayout *l)
+{
+	FrameCfg *frame_cfg = &e->frame_cfg;
 
 	//
 	// Set size and sprite count information.
 	//
-	switch (frame_cfg->data_format)
+	// Background tiles set the tilesize and "frame" width this way in order
+	// to support interleaved tile order; "tiles" become "frames" and the
+	// tile size is used as the unit that tiles are built from.
+	if (format_desc(frame_cfg->data_format)->tile_frames)
 	{
-		// Background tiles set the tilesize and "frame" width this way in order
-		// to support interleaved tile order; "tiles" become "frames" and the
-		// tile size is used as the unit that tiles are built from.
-		case DATA_FORMAT_BG038:
-			frame_cfg->w = frame_cfg->tilesize;
-			frame_cfg->h = frame_cfg->tilesize;
-			frame_cfg->tilesize = 8;
-			break;
-
-		case DATA_FORMAT_TOA_GCU_BG:
-			frame_cfg->w = frame_cfg->tilesize;
-			frame_cfg->h = frame_cfg->tilesize;
-			frame_cfg->tilesize = 8;
-
-		default:
-			break;
+		frame_cfg->w = frame_cfg->tilesize;
+		frame_cfg->h = frame_cfg->tilesize;
+		frame_cfg->tilesize = 8;
 	}
 
 	// A size < 0 means the whole image width/height is used for a frame.
@@ -351,6 +238,8 @@ bool conv_entry_add(Conv *s)
 	// Effective frame height by rounding down to tile count.
 	const int sw_adj = (frame_cfg->tilesize*frame_tiles_x);
 	const int sh_adj = (frame_cfg->tilesize*frame_tiles_y);
+	l->sw_adj = sw_adj;
+	l->sh_adj = sh_adj;
 
 	const bool yoko = ((frame_cfg->angle == 0) || (frame_cfg->angle == 180));
 
@@ -381,8 +270,6 @@ bool conv_entry_add(Conv *s)
 				{
 					fprintf(stderr, "[CONV] CPS 8x8 tiles must be sourced from a "
 					                "file with an even column count.\n");
-					free(png);
-					free(px);
 					return false;
 				}
 				e->code_per /= 2;
@@ -398,8 +285,6 @@ bool conv_entry_add(Conv *s)
 			if (frame_cfg->angle != 0)
 			{
 				fprintf(stderr, "[CONV] MD composites do not yet support rotation.\n");
-				free(png);
-				free(px);
 				return false;
 			}
 			// code_per is set at each iteration of the sprite claim routine.
@@ -419,8 +304,6 @@ bool conv_entry_add(Conv *s)
 			if (frame_cfg->angle != 0)
 			{
 				fprintf(stderr, "[CONV] MD composites do not yet support rotation.\n");
-				free(png);
-				free(px);
 				return false;
 			}
 			// code_per is set at each iteration of the sprite claim routine.
@@ -444,228 +327,546 @@ bool conv_entry_add(Conv *s)
 			break;
 	}
 
+	// sprite quantities within the sheet
+	l->frame_count_x = png_w / sw_adj;
+	l->frame_count_y = png_h / sh_adj;
+	l->chr_bytes_per = sw_adj * sh_adj;
+	return true;
+}
+
+// A sprite claimed out of an MD CSP frame.
+typedef struct ConvClaim
+{
+	ClaimSize size;
+	int x, y;
+} ConvClaim;
+
+// Claims made in one MD CSP frame, before they are added to the entry.
+typedef struct ConvCspFrame
+{
+	ConvClaim *claims;
+	int claim_count;
+	uint8_t *tiles;          // 8bpp data of every claimed tile, in order.
+	int tile_count;
+} ConvCspFrame;
+
+// The frames of one entry, read in chunks that may be spread across threads.
+typedef struct ConvFrames ConvFrames;
+struct ConvFrames
+{
+	Entry *e;
+	const Image *img;
+	ConvLayout layout;
+	int frame_count;
+	ConvCspFrame *csp;       // Per frame, for MD CSP.
+
+	// Chunks are handed out under the run's lock.
+	int chunk_frames;
+	int chunk_count;
+	int next_chunk;
+	int chunks_done;
+	bool ok;
+	ConvFrames *next;        // Next in the run's list of open entries.
+};
+
+typedef struct ConvJob
+{
+	Conv *s;
+	Entry *e;
+	int conv_idx;
+	uint8_t *packed;     // CHR packed for streaming, until it is written.
+	bool ok;
+	bool done;
+} ConvJob;
+
+typedef struct ConvRun
+{
+	ConvJob *jobs;
+	int count;
+	int next;            // Next job to be placed.
+	int ahead;           // How far past next a streamed entry may be started.
+	bool draining;       // A thread is placing jobs and writing their CHR.
+	int unconverted;     // Entries still being converted, or waiting to be.
+	int helpers;         // Jobs past the entries, which only help read frames.
+	bool *conv_ok;       // Whether each script has converted so far.
+	ConvFrames *open;    // Entries with chunks of frames left to hand out.
+	pthread_mutex_t lock;
+	pthread_cond_t cond; // Chunks were opened or finished, jobs were placed, or all
+	                     // entries converted.
+} ConvRun;
+
+// Claims sprites out of one frame until it is empty, noting each claim and
+// the tiles it takes. win is scratch space for the frame's window.
+static bool conv_csp_claim_frame(ConvFrames *cf, int frame, uint8_t *win)
+{
+	const FrameCfg *frame_cfg = &cf->e->frame_cfg;
+	const int sw_adj = cf->layout.sw_adj;
+	const int sh_adj = cf->layout.sh_adj;
+	const int win_w = sw_adj + CONV_CSP_WIN_PAD;
+	const int win_h = sh_adj + CONV_CSP_WIN_PAD;
+	ConvCspFrame *cs = &cf->csp[frame];
+
+	// This is mostly a rewrite of claim() from png2csp.
+	conv_csp_window(cf->img, (frame % cf->layout.frame_count_x) * sw_adj,
+	                (frame / cf->layout.frame_count_x) * sh_adj,
+	                win_w, win_h, win);
+
+	static const int k_tile_bytes = 8*8*sizeof(uint8_t);
+	int claim_cap = 0;
+	int tile_cap = 0;
+
+	// Clip region determined by claim
+	int clip_x, clip_y;
+
+	ClaimSize claim_size;
+	while ((claim_size = mdcsp_claim(win, 0, 0,
+	                                 sw_adj, sh_adj,
+	                                 win_w, win_h,
+	                                 &clip_x, &clip_y)))
+	{
+		const int tiles_w = mdcsp_w_for_claim(claim_size);
+		const int tiles_h = mdcsp_h_for_claim(claim_size);
+		const int tiles_clipped = mdcsp_tiles_for_claim(claim_size);
+
+		if (cs->claim_count >= claim_cap)
+		{
+			claim_cap = claim_cap ? claim_cap * 2 : 16;
+			ConvClaim *claims = realloc(cs->claims, sizeof(*claims) * claim_cap);
+			if (!claims) return false;
+			cs->claims = claims;
+		}
+		if (cs->tile_count + tiles_clipped > tile_cap)
+		{
+			tile_cap = tile_cap ? tile_cap * 2 : 64;
+			uint8_t *tiles = realloc(cs->tiles, k_tile_bytes * tile_cap);
+			if (!tiles) return false;
+			cs->tiles = tiles;
+		}
+
+		// Stop it from scooping data from the adjacent frame.
+		const int limx = sw_adj;
+		const int limy = sh_adj;
+
+		const int clip_w = tiles_w*frame_cfg->tilesize;
+		const int clip_h = tiles_h*frame_cfg->tilesize;
+
+		// TODO: Handle rotation for non-0 degree config? maybe it works?
+		tile_read_frame(win,
+		                win_w, win_h,
+		                clip_x, clip_y,
+		                clip_w, clip_h,
+		                frame_cfg->tilesize,
+		                frame_cfg->angle,
+		                limx, limy,
+		                TILE_READ_FLAG_X_MAJOR|TILE_READ_FLAG_ERASE|TILE_READ_POS_DIRECT,
+		                &cs->tiles[k_tile_bytes * cs->tile_count]);
+
+		ConvClaim *claim = &cs->claims[cs->claim_count++];
+		claim->size = claim_size;
+		claim->x = clip_x;
+		claim->y = clip_y;
+		cs->tile_count += tiles_clipped;
+	}
+	return true;
+}
+
+// Adds the sprites claimed in one frame to the entry. Frames are added in
+// order, as each one's sprites and tiles follow those of the frame before.
+static void conv_csp_add_frame(Entry *e, const ConvLayout *l, const ConvCspFrame *cs,
+                               uint8_t **chr_w)
+{
+	const FrameCfg *frame_cfg = &e->frame_cfg;
+	const int sw_adj = l->sw_adj;
+	const int sh_adj = l->sh_adj;
+
+	static const int k_tile_bytes = 8*8*sizeof(uint8_t);
+	static const int k_md_static_spr_offs = 128;
+	const int base_spr_index = e->md_csp.spr_count;
+	int spr_in_sprite = 0;
+	const int base_tile_index = e->md_csp.tile_count;
+	int tiles_for_sprite = 0;
+
+	// TODO: Support more than center origin, using origin_for_sp()
+	const int ox = sw_adj/2;
+	const int oy = sh_adj/2;
+
+	// The relative x/y is used to bake in the 128px offset.
+	int last_vx = -k_md_static_spr_offs;
+	int last_vy = -k_md_static_spr_offs;
+	int last_fvx = -k_md_static_spr_offs;
+	int last_fvy = -k_md_static_spr_offs;
+
+	const uint8_t *tile_data = cs->tiles;
+	for (int i = 0; i < cs->claim_count; i++)
+	{
+		const ConvClaim *claim = &cs->claims[i];
+		spr_in_sprite++;
+
+		const int tiles_w = mdcsp_w_for_claim(claim->size);
+		const int tiles_h = mdcsp_h_for_claim(claim->size);
+		const int tiles_clipped = mdcsp_tiles_for_claim(claim->size);
+
+		// Copy the claimed tiles into CHR.
+		memcpy(*chr_w, tile_data, k_tile_bytes * tiles_clipped);
+		tile_data += k_tile_bytes * tiles_clipped;
+		e->md_csp.tile_count += tiles_clipped;
+
+		*chr_w += k_tile_bytes * tiles_clipped;
+
+		// Record the hardware sprite entry.
+		const int vx = ((claim->x % sw_adj) - ox);
+		const int vy = ((claim->y % sh_adj) - oy);
+
+		int fvx = -1 * ((claim->x % sw_adj) - ox);
+		int fvy = -1 * ((claim->y % sh_adj) - oy);
+		fvx -= tiles_w * frame_cfg->tilesize;
+		fvy -= tiles_h * frame_cfg->tilesize;
+
+		MdCspSpr *spr = &e->md_csp.spr_dat[e->md_csp.spr_count];
+		e->md_csp.spr_count++;
+
+		spr->dx = vx - last_vx;
+		spr->dy = vy - last_vy;
+		spr->w = tiles_w;
+		spr->h = tiles_h;
+		spr->tile = tiles_for_sprite;
+		spr->flip_dx = fvx - last_fvx;
+		spr->flip_dy = fvy - last_fvy;
+
+		last_vx = vx;
+		last_vy = vy;
+		last_fvx = fvx;
+		last_fvy = fvy;
+
+		tiles_for_sprite += tiles_clipped;
+		if (e->md_csp.dma_buffer_tiles < tiles_for_sprite)
+		{
+			e->md_csp.dma_buffer_tiles = tiles_for_sprite;
+		}
+	}
+
+	// Once all tiles have been claimed, make a ref entry for the sprites.
+	e->chr_bytes += tiles_for_sprite * k_tile_bytes;  // in 8bpp terms.
+	MdCspRef *ref = &e->md_csp.ref_dat[e->md_csp.ref_count];
+	ref->spr_count = spr_in_sprite;  // Hardware sprite count.
+	ref->spr_index = base_spr_index;
+	ref->tile_index = base_tile_index;
+	ref->tile_count = tiles_for_sprite;
+
+	e->code_per = tiles_for_sprite;
+
+	e->md_csp.ref_count++;
+}
+
+// Reads the frame at (fx, fy) of a fixed-size format into chr_w.
+static void conv_read_frame(const FrameCfg *frame_cfg, const ConvLayout *l, uint8_t *px,
+                            int png_w, int png_h, int fx, int fy, uint8_t *chr_w)
+{
+	switch (format_desc(frame_cfg->data_format)->read)
+	{
+		case FORMAT_READ_Y_MAJOR:
+			tile_read_frame(px,
+			                png_w, png_h,
+			                fx, fy,
+			                l->sw_adj, l->sh_adj,
+			                frame_cfg->tilesize,
+			                frame_cfg->angle,
+			                -1, -1,
+			                0, chr_w);
+			break;
+
+		case FORMAT_READ_X_MAJOR:
+			tile_read_frame(px,
+			                png_w, png_h,
+			                fx, fy,
+			                l->sw_adj, l->sh_adj,
+			                frame_cfg->tilesize,
+			                frame_cfg->angle,
+			                -1, -1,
+			                TILE_READ_FLAG_X_MAJOR, chr_w);
+			break;
+
+		// Unusual line-based system
+		case FORMAT_READ_LINES:
+			tile_read_lines(px, png_w,
+			                fx, fy,
+			                l->sw_adj, l->sh_adj,
+			                frame_cfg->angle, chr_w);
+			break;
+
+		default:
+			break;
+	}
+}
+
+// Reads one chunk of frames. Fixed-size formats go straight to their place
+// in CHR; MD CSP claims are kept per frame to be added in order later.
+static bool conv_read_chunk(ConvFrames *cf, int chunk)
+{
+	Entry *e = cf->e;
+	const FrameCfg *frame_cfg = &e->frame_cfg;
+	const ConvLayout *l = &cf->layout;
+	const int first = chunk * cf->chunk_frames;
+	int last = first + cf->chunk_frames;
+	if (last > cf->frame_count) last = cf->frame_count;
+
+	// The image may be shared with other entries, so it is only ever read.
+	uint8_t *px = (uint8_t *)cf->img->px;
+	const unsigned int png_w = cf->img->w;
+	const unsigned int png_h = cf->img->h;
+
+	if (format_desc(frame_cfg->data_format)->read != FORMAT_READ_CLAIM)
+	{
+		for (int frame = first; frame < last; frame++)
+		{
+			// Frames are taken from top to bottom, left to right.
+			conv_read_frame(frame_cfg, l, px, png_w, png_h,
+			                frame % l->frame_count_x, frame / l->frame_count_x,
+			                &e->chr[(size_t)frame * l->chr_bytes_per]);
+		}
+		return true;
+	}
+
+	// Composite sprites erase pixel data as it is claimed, so each frame is
+	// claimed from a private window of the image instead.
+	uint8_t *win = malloc((l->sw_adj + CONV_CSP_WIN_PAD) * (l->sh_adj + CONV_CSP_WIN_PAD));
+	if (!win) return false;
+	bool ret = true;
+	for (int frame = first; frame < last && ret; frame++)
+	{
+		ret = conv_csp_claim_frame(cf, frame, win);
+	}
+	free(win);
+	return ret;
+}
+
+// Reads the frames of a fixed-size entry as rows of the image are decoded,
+// one row of frames at a time. Each frame is read from the band of rows it
+// lies in, so no more of the image than that is held decoded at once. Each
+// band is timed on its own, and the time spent decoding is added to decode_ns.
+static unsigned int conv_read_bands(ConvFrames *cf, PngDecRows *rows, uint64_t *decode_ns)
+{
+	Entry *e = cf->e;
+	const ConvLayout *l = &cf->layout;
+	const unsigned int png_w = rows->w;
+	uint8_t *band = malloc((size_t)png_w * l->sh_adj);
+	if (!band) return 83;
+
+	unsigned int error = 0;
+	for (int fy = 0; fy < l->frame_count_y && !error; fy++)
+	{
+		const uint64_t start = stats_now();
+		error = pngdec_rows_read(rows, band, l->sh_adj);
+		const uint64_t dur = stats_now() - start;
+		stats_phase_span(&e->stats, STATS_PHASE_DECODE, start, dur);
+		*decode_ns += dur;
+		for (int fx = 0; fx < l->frame_count_x && !error; fx++)
+		{
+			const int frame = (fy * l->frame_count_x) + fx;
+			conv_read_frame(&e->frame_cfg, l, band, png_w, l->sh_adj, fx, 0,
+			                &e->chr[(size_t)frame * l->chr_bytes_per]);
+		}
+	}
+	free(band);
+
+	// The rest still has to be checked, as it would be by a whole decode.
+	if (!error)
+	{
+		const uint64_t start = stats_now();
+		error = pngdec_rows_end(rows);
+		const uint64_t dur = stats_now() - start;
+		stats_phase_span(&e->stats, STATS_PHASE_DECODE, start, dur);
+		*decode_ns += dur;
+	}
+	return error;
+}
+
+// Takes the next chunk from the run's open entries, or from only that entry
+// if it is given. Called with the run locked.
+static ConvFrames *conv_take_chunk(ConvRun *run, ConvFrames *only, int *chunk)
+{
+	ConvFrames **link = &run->open;
+	while (only && *link && *link != only) link = &(*link)->next;
+	ConvFrames *cf = *link;
+	if (!cf) return NULL;
+
+	*chunk = cf->next_chunk++;
+	if (cf->next_chunk >= cf->chunk_count) *link = cf->next;
+	return cf;
+}
+
+// Reads a chunk with the run unlocked. Called with the run locked.
+static void conv_work_chunk(ConvRun *run, ConvFrames *cf, int chunk)
+{
+	pthread_mutex_unlock(&run->lock);
+	const bool ok = conv_read_chunk(cf, chunk);
+	pthread_mutex_lock(&run->lock);
+
+	if (!ok) cf->ok = false;
+	cf->chunks_done++;
+	if (cf->chunks_done >= cf->chunk_count) pthread_cond_broadcast(&run->cond);
+}
+
+// Reads every frame of an entry. If the run has helpers, the frames are
+// offered to them in chunks, and read here as well until none are left.
+static bool conv_read_frames(ConvRun *run, ConvFrames *cf)
+{
+	const int threads = (run ? run->helpers : 0) + 1;
+	cf->chunk_frames = cf->frame_count / (threads * 4);
+	if (cf->chunk_frames < 1) cf->chunk_frames = 1;
+	cf->chunk_count = (cf->frame_count + cf->chunk_frames - 1) / cf->chunk_frames;
+	cf->ok = true;
+
+	if (threads <= 1 || cf->chunk_count <= 1)
+	{
+		for (int i = 0; i < cf->chunk_count && cf->ok; i++) cf->ok = conv_read_chunk(cf, i);
+		return cf->ok;
+	}
+
+	pthread_mutex_lock(&run->lock);
+	cf->next = run->open;
+	run->open = cf;
+	pthread_cond_broadcast(&run->cond);
+
+	int chunk;
+	while (conv_take_chunk(run, cf, &chunk)) conv_work_chunk(run, cf, chunk);
+	while (cf->chunks_done < cf->chunk_count) pthread_cond_wait(&run->cond, &run->lock);
+	pthread_mutex_unlock(&run->lock);
+	return cf->ok;
+}
+
+// Reads chunks of frames for other entries until every entry is converted.
+static void conv_help(ConvRun *run)
+{
+	pthread_mutex_lock(&run->lock);
+	while (true)
+	{
+		int chunk;
+		ConvFrames *cf = conv_take_chunk(run, NULL, &chunk);
+		if (cf)
+		{
+			conv_work_chunk(run, cf, chunk);
+			continue;
+		}
+		if (run->unconverted <= 0) break;
+		pthread_cond_wait(&run->cond, &run->lock);
+	}
+	pthread_mutex_unlock(&run->lock);
+}
+
+// Converts an entry from its decoded image, or if rows is given, from the
+// image as it is decoded; a decoding error is then returned in rows_error
+// rather than reported.
+static bool conv_entry_read(const Conv *s, Entry *e, const Image *img, PngDecRows *rows,
+                            unsigned int *rows_error, ConvRun *run)
+{
+	FrameCfg *frame_cfg = &e->frame_cfg;
+	const unsigned int png_w = img->w;
+	const unsigned int png_h = img->h;
+	const uint8_t *palette = rows ? rows->palette : img->palette;
+	const int palette_size = rows ? rows->palette_size : img->palette_size;
+
 	//
-	// Based on image dimensions allocate CHR space and set chr_bytes.
+	// Make native palette data (host endianness)
 	//
+	uint64_t phase_start = stats_now();
+	e->pal_size = palette_size;
+	if (s->palcache)
+	{
+		palcache_pack(s->palcache, frame_cfg->pal_format, palette, e->pal, palette_size);
+	}
+	else
+	{
+		pal_pack_set(frame_cfg->pal_format, palette, e->pal, palette_size);
+	}
+	e->pal_ref = NULL;
+	stats_phase(&e->stats, STATS_PHASE_PAL, phase_start);
+	phase_start = stats_now();
 
-	// sprite quantities within the sheet
-	const int frame_count_x = png_w / sw_adj;
-	const int frame_count_y = png_h / sh_adj;
+	ConvFrames cf;
+	memset(&cf, 0, sizeof(cf));
+	cf.e = e;
+	cf.img = img;
+	if (!conv_entry_layout(e, png_w, png_h, &cf.layout)) return false;
+	cf.frame_count = cf.layout.frame_count_x * cf.layout.frame_count_y;
+
+	//
+	// Based on image dimensions allocate CHR space and set chr_bytes.
+	//
 
 	// TODO: For CPS, iterate through the image, create a bitmap of tile skips,
 	// and get the actual used chr size before allocating.
 
-	const int chr_bytes_per = sw_adj * sh_adj;
-	const size_t expected_chr_bytes = (frame_count_x * frame_count_y) * chr_bytes_per;
+	const int chr_bytes_per = cf.layout.chr_bytes_per;
+	const size_t expected_chr_bytes = (size_t)cf.frame_count * chr_bytes_per;
 	e->chr_bytes = 0;
 	e->chr = malloc(expected_chr_bytes);
 	if (!e->chr)
 	{
 		fprintf(stderr, "[ENTRY $%03X] Couldn't allocate CHR %lu bytes\n", e->id,
 		        expected_chr_bytes);
-		free(png);
-		free(px);
 		return false;
 	}
 
+	const FormatRead read = format_desc(frame_cfg->data_format)->read;
+	if (read == FORMAT_READ_CLAIM)
+	{
+		cf.csp = calloc(sizeof(*cf.csp), cf.frame_count + 1);
+		if (!cf.csp)
+		{
+			fprintf(stderr, "[ENTRY $%03X] Couldn't allocate frame claims\n", e->id);
+			return false;
+		}
+	}
+
 	//
 	// Copy image data as 8bpp CHR data.
 	//
-	int frame_no = 0;
+	bool ret;
+	uint64_t decode_ns = 0;
+	if (rows)
+	{
+		*rows_error = conv_read_bands(&cf, rows, &decode_ns);
+		phase_start += decode_ns;
+		ret = (*rows_error == 0);
+	}
+	else
+	{
+		ret = conv_read_frames(run, &cf);
+		if (!ret) fprintf(stderr, "[ENTRY $%03X] Couldn't allocate frame data\n", e->id);
+	}
+
 	uint8_t *chr_w = e->chr;
+	for (int frame = 0; ret && frame < cf.frame_count; frame++)
+	{
+		switch (read)
+		{
+			case FORMAT_READ_NONE:
+				break;
+
+			case FORMAT_READ_CLAIM:
+				conv_csp_add_frame(e, &cf.layout, &cf.csp[frame], &chr_w);
+				break;
 
-	// Frames are taken from top to bottom, left to right.
-	const int png_outer = frame_count_y;
-	const int png_inner = frame_count_x;
+			default:
+				e->chr_bytes += chr_bytes_per;
+				break;
+		}
+		e->code_count += e->code_per;  // Move base code value forward
+		                               // for the next entry.
+	}
+	e->frames = cf.frame_count;
 
-	for (int outer = 0; outer < png_outer; outer++)
+	if (cf.csp)
 	{
-		for (int inner = 0; inner < png_inner; inner++)
+		for (int i = 0; i < cf.frame_count; i++)
 		{
-			const int png_src_y = outer;
-			const int png_src_x = inner;
-
-			switch (frame_cfg->data_format)
-			{
-				// Y Major standard formats.
-				case DATA_FORMAT_DIRECT:
-				case DATA_FORMAT_BG038:
-				case DATA_FORMAT_CPS_SPR:  // TODO: For CPS SPR, pass in a tile skip flag.
-				case DATA_FORMAT_CPS_BG:
-				case DATA_FORMAT_MD_BG:
-				case DATA_FORMAT_TOA_GCU_SPR:
-				case DATA_FORMAT_TOA_GCU_BG:
-					chr_w = tile_read_frame(px,
-					                        png_w, png_h,
-					                        png_src_x, png_src_y,
-					                        sw_adj, sh_adj,
-					                        frame_cfg->tilesize,
-					                        frame_cfg->angle,
-					                        -1, -1,
-					                        0, chr_w);
-					e->chr_bytes += chr_bytes_per;
-					break;
-
-				// X Major standard formats.
-				case DATA_FORMAT_MD_SPR:
-				case DATA_FORMAT_TOA_TXT:
-				case DATA_FORMAT_NEO_FIX:
-				case DATA_FORMAT_NEO_SPR:
-					chr_w = tile_read_frame(px,
-					                        png_w, png_h,
-					                        png_src_x, png_src_y,
-					                        sw_adj, sh_adj,
-					                        frame_cfg->tilesize,
-					                        frame_cfg->angle,
-					                        -1, -1,
-					                        TILE_READ_FLAG_X_MAJOR, chr_w);
-					e->chr_bytes += chr_bytes_per;
-					break;
-				
-				// Unusual line-based system
-				case DATA_FORMAT_SP013:
-					chr_w = tile_read_frame(px,
-					                        png_w, png_h,
-					                        png_src_x, png_src_y,
-					                        sw_adj, sh_adj,
-					                        /*tilesize=*/1,
-					                        frame_cfg->angle,
-					                        -1, -1,
-					                        0,  chr_w);
-					e->chr_bytes += chr_bytes_per;
-					break;
-
-				// Composite sprite (optimized with mapping) format(s)
-				case DATA_FORMAT_MD_CSP:
-					// This is mostly a rewrite of claim() from png2csp.
-					{
-						static const int k_tile_bytes = 8*8*sizeof(uint8_t);
-						static const int k_md_static_spr_offs = 128;
-						const int base_spr_index = e->md_csp.spr_count;
-						int spr_in_sprite = 0;
-						const int base_tile_index = e->md_csp.tile_count;
-						int tiles_for_sprite = 0;
-
-						// TODO: Support more than center origin, using origin_for_sp()
-						const int ox = sw_adj/2;
-						const int oy = sh_adj/2;
-
-						// Clip region determined by claim
-						int clip_x, clip_y;
-
-						// The relative x/y is used to bake in the 128px offset.
-						int last_vx = -k_md_static_spr_offs;
-						int last_vy = -k_md_static_spr_offs;
-						int last_fvx = -k_md_static_spr_offs;
-						int last_fvy = -k_md_static_spr_offs;
-
-						ClaimSize claim_size;
-						while ((claim_size = mdcsp_claim(px, png_src_x*sw_adj, png_src_y*sh_adj,
-						                                 sw_adj, sh_adj,
-						                                 png_w, png_h,
-						                                 &clip_x, &clip_y)))
-						{
-							spr_in_sprite++;
-							//
-							// Store the PCG data for one claim's worth of tiles.
-							//
-							uint8_t tile_data[k_tile_bytes * 4 * 4];  // Up to one 32x32px sprite (16 tiles).
-							int tiles_clipped = 0;
-
-							const int tiles_w = mdcsp_w_for_claim(claim_size);
-							const int tiles_h = mdcsp_h_for_claim(claim_size);
-
-							//printf("F%02d Sp%02d: %d, %d %dx%d\n", e->md_csp.ref_count, e->md_csp.spr_count, clip_x, clip_y, tiles_w, tiles_h);
-
-							// Stop it from scooping data from the adjacent frame.
-							const int limx = png_src_x*sw_adj + sw_adj;
-							const int limy = png_src_y*sh_adj + sh_adj;
-
-							const int clip_w = tiles_w*frame_cfg->tilesize;
-							const int clip_h = tiles_h*frame_cfg->tilesize;
-
-							// Copy tiles into local tile_data cache.
-
-							// TODO: Handle rotation for non-0 degree config? maybe it works?
-							uint8_t *tile_data_w = tile_data;
-
-							tile_read_frame(px,
-							                png_w, png_h,
-							                clip_x, clip_y,
-							                clip_w, clip_h,
-							                frame_cfg->tilesize,
-							                frame_cfg->angle,
-							                limx, limy,
-							                TILE_READ_FLAG_X_MAJOR|TILE_READ_FLAG_ERASE|TILE_READ_POS_DIRECT,
-							                tile_data_w);
-
-							tiles_clipped += mdcsp_tiles_for_claim(claim_size);
-
-							// Copy the claimed tiles into CHR.
-							memcpy(chr_w, tile_data, k_tile_bytes * tiles_clipped);
-							e->md_csp.tile_count += tiles_clipped;
-
-							chr_w += k_tile_bytes * tiles_clipped;
-
-							// Record the hardware sprite entry.
-							const int vx = ((clip_x % sw_adj) - ox);
-							const int vy = ((clip_y % sh_adj) - oy);
-
-							int fvx = -1 * ((clip_x % sw_adj) - ox);
-							int fvy = -1 * ((clip_y % sh_adj) - oy);
-							//		fvx -= (fvx - ox);
-							fvx -= tiles_w * frame_cfg->tilesize;
-							//		fvy -= (fvy - oy);
-							fvy -= tiles_h * frame_cfg->tilesize;
-
-							MdCspSpr *spr = &e->md_csp.spr_dat[e->md_csp.spr_count];
-							e->md_csp.spr_count++;
-
-							spr->dx = vx - last_vx;
-							spr->dy = vy - last_vy;
-							spr->w = tiles_w;
-							spr->h = tiles_h;
-							spr->tile = tiles_for_sprite;
-							spr->flip_dx = fvx - last_fvx;
-							spr->flip_dy = fvy - last_fvy;
-
-							last_vx = vx;
-							last_vy = vy;
-							last_fvx = fvx;
-							last_fvy = fvy;
-
-							tiles_for_sprite += tiles_clipped;
-							if (e->md_csp.dma_buffer_tiles < tiles_for_sprite)
-							{
-								e->md_csp.dma_buffer_tiles = tiles_for_sprite;
-							}
-						}
-						// Once all tiles have been claimed, make a ref entry for the sprites.
-						// printf("F%02d: %d sprites, %d tiles\n", e->md_csp.ref_count, spr_in_sprite, tiles_for_sprite);
-
-						e->chr_bytes += tiles_for_sprite * k_tile_bytes;  // in 8bpp terms.
-						MdCspRef *ref = &e->md_csp.ref_dat[e->md_csp.ref_count];
-						ref->spr_count = spr_in_sprite;  // Hardware sprite count.
-						ref->spr_index = base_spr_index;
-						ref->tile_index = base_tile_index;
-						ref->tile_count = tiles_for_sprite;
-
-						e->code_per = tiles_for_sprite;
-
-						e->md_csp.ref_count++;
-
-						//
-					}
-					break;
-				default:
-					break;
-			}
-			frame_no++;
-			s->frame_cfg.code += e->code_per;  // Move base code value forward
-			                                   // for the next entry.
+			free(cf.csp[i].claims);
+			free(cf.csp[i].tiles);
 		}
+		free(cf.csp);
 	}
-	e->frames = frame_no;
+	if (!ret) return false;
 
 	// Close out any mapping data and advance
 
@@ -678,9 +879,194 @@ bool conv_entry_add(Conv *s)
 		default:
 			break;
 	}
+
+	stats_phase(&e->stats, STATS_PHASE_READ, phase_start);
+	return true;
+}
+
+// Copies the result of converting another entry with the same key.
+static bool conv_entry_copy_result(Entry *e, const Entry *src)
+{
+	uint8_t *chr = malloc(src->chr_bytes ? src->chr_bytes : 1);
+	if (!chr)
+	{
+		fprintf(stderr, "[ENTRY $%03X] Couldn't allocate CHR %lu bytes\n", e->id,
+		        src->chr_bytes);
+		return false;
+	}
+	memcpy(chr, src->chr, src->chr_bytes);
+
+	// The code is not part of the key, so keep the one from the script.
+	const uint32_t code = e->frame_cfg.code;
+	e->frame_cfg = src->frame_cfg;
+	e->frame_cfg.code = code;
+	e->pal_size = src->pal_size;
+	memcpy(e->pal, src->pal, sizeof(e->pal[0]) * src->pal_size);
+	e->code_per = src->code_per;
+	e->code_count = src->code_count;
+	e->frames = src->frames;
+	e->sp013 = src->sp013;
+	e->cps_spr = src->cps_spr;
+	e->md_spr = src->md_spr;
+	e->md_csp = src->md_csp;
+	e->gcu_spr = src->gcu_spr;
+	e->neo_cspr = src->neo_cspr;
+	e->map_bytes = src->map_bytes;
+	e->chr_bytes = src->chr_bytes;
+	e->chr = chr;
+	return true;
+}
+
+// Whether an entry is read from its image as it is decoded: when asked for,
+// for formats read a frame at a time, and if the image is neither used by
+// another entry nor decoded already.
+static bool conv_entry_streams(const Conv *s, const Entry *e, const Image *img)
+{
+	if (!s->stream_rows || !conv_format_fixed_size(e->frame_cfg.data_format)) return false;
+	if (s->imgcache && !imgcache_sole_use(s->imgcache, e->src)) return false;
+	return !img->px && img->png && pngdec_supported(img->png, img->file_size);
+}
+
+// Loads and converts the source image for an entry. This does not touch any
+// state shared with other entries, so entries may be converted in parallel.
+// Frames may be read by helpers of the run as well.
+static bool conv_entry_convert(const Conv *s, Entry *e, ConvRun *run)
+{
+	// Source images come from the shared image cache if there is one, or are
+	// read just for this entry otherwise.
+	Image local_img;
+	const Image *img = NULL;
+	unsigned int error = 0;
+	uint64_t phase_start = stats_now();
+	if (s->imgcache)
+	{
+		img = imgcache_get(s->imgcache, e->src, false, &error);
+	}
+	else
+	{
+		error = image_load(&local_img, e->src, s->key_entries);
+		if (!error) img = &local_img;
+	}
+	stats_phase(&e->stats, STATS_PHASE_LOAD, phase_start);
+	if (error)
+	{
+		fprintf(stderr, "[ENTRY $%03X: %s] LodePNG error %u: %s\n", e->id, e->src, error,
+		        lodepng_error_text(error));
+		if (s->imgcache) imgcache_done(s->imgcache, e->src);
+		else image_free(&local_img);
+		return false;
+	}
+
+	// Hashing every source file would be wasted on a one-off conversion.
+	if (s->key_entries) e->key = cache_key(img->hash, &e->frame_cfg);
+	bool ret = true;
+
+	// An unchanged entry from a previous run can be taken as-is.
+	for (const Entry *prev = s->prev_head; prev; prev = prev->next)
+	{
+		if (prev->key != e->key || !prev->chr) continue;
+		ret = conv_entry_copy_result(e, prev);
+		e->stats.cached = true;
+		goto done;
+	}
+
+	// Likewise for one in the cache directory, without decoding.
+	const bool use_cache = (s->cache_dir[0] != '\0');
+	if (use_cache && cache_load(s->cache_dir, e->key, e))
+	{
+		e->stats.cached = true;
+		goto done;
+	}
+
+	// An image that no other entry uses may be decoded a band at a time as
+	// the frames are read. If that fails, it is decoded whole after all, to
+	// report the error as LodePNG would.
+	if (conv_entry_streams(s, e, img))
+	{
+		const Entry before = *e;
+		const bool verify = !s->imgcache || !s->imgcache->skip_checksums;
+		PngDecRows rows;
+		unsigned int rows_error = pngdec_rows_begin(&rows, img->png, img->file_size, verify);
+		if (!rows_error) ret = conv_entry_read(s, e, img, &rows, &rows_error, run);
+		pngdec_rows_free(&rows);
+		if (!rows_error)
+		{
+			if (ret && use_cache) cache_store(s->cache_dir, e->key, e);
+			goto done;
+		}
+		free(e->chr);
+		stats_free(&e->stats);
+		*e = before;
+	}
+
+	phase_start = stats_now();
+	if (s->imgcache) img = imgcache_get(s->imgcache, e->src, true, &error);
+	else error = image_decode(&local_img, NULL, true, INFLATE_BACKEND_FAST);
+	stats_phase(&e->stats, STATS_PHASE_DECODE, phase_start);
+	if (error)
+	{
+		fprintf(stderr, "[ENTRY $%03X: %s] LodePNG error %u: %s\n", e->id, e->src, error,
+		        lodepng_error_text(error));
+		ret = false;
+		goto done;
+	}
+
+	ret = conv_entry_read(s, e, img, NULL, NULL, run);
+	if (ret && use_cache) cache_store(s->cache_dir, e->key, e);
+
+done:
+	if (s->imgcache) imgcache_done(s->imgcache, e->src);
+	else image_free(&local_img);
+	return ret;
+}
+
+// Assigns the code value, data offsets and palette reference for an entry.
+// Entries are placed in script order after all of them have been converted,
+// so the result matches converting them one after another.
+static void conv_entry_place(Conv *s, Entry *e)
+{
+	// The first entry always takes the configured code.
+	if (e->code_set || e == s->entry_head) s->frame_cfg.code = e->frame_cfg.code;
+	e->frame_cfg.code = s->frame_cfg.code;
+	s->frame_cfg.code += e->code_count;
+
+	e->chr_offs = s->chr_pos;
+	e->map_offs = s->map_pos;
+
+	// See if another entry has the same palette, and get a reference to it if so.
+	const uint64_t phase_start = stats_now();
+	Entry *f = s->entry_head;
+	while (f && (f != e))
+	{
+		bool match = true;
+		// Palette size of other is >= this one's palette, and data matches
+		if (f->pal_size >= e->pal_size)
+		{
+			for (int i = 0; i < e->pal_size; i++)
+			{
+				if (e->pal[i] == f->pal[i]) continue;
+				match = false;
+				break;
+			}
+		}
+		else
+		{
+			match = false;
+		}
+
+		if (match)
+		{
+			e->pal_ref = f;
+			break;
+		}
+
+		f = f->next;
+	}
+	stats_phase(&e->stats, STATS_PHASE_PAL_DEDUP, phase_start);
+
 	s->map_pos += e->map_bytes;
 
-	switch (frame_cfg->depth)
+	switch (e->frame_cfg.depth)
 	{
 		case 1:
 			s->chr_pos += e->chr_bytes/8;
@@ -695,11 +1081,271 @@ bool conv_entry_add(Conv *s)
 			s->chr_pos += e->chr_bytes;
 			break;
 	}
+}
 
-	free(png);
-	free(px);
+// Places finished entries in script order, writing out and releasing their
+// CHR if the script streams it. Only one thread drains at a time, and the
+// run is unlocked while CHR is written. Called with the run locked.
+static void conv_drain(ConvRun *run)
+{
+	if (run->draining) return;
+	run->draining = true;
+	while (run->next < run->count && run->jobs[run->next].done)
+	{
+		ConvJob *job = &run->jobs[run->next];
+		if (!job->ok) run->conv_ok[job->conv_idx] = false;
+		Conv *s = job->s;
+		Entry *e = job->e;
+		if (run->conv_ok[job->conv_idx])
+		{
+			conv_entry_place(s, e);
+			if (s->stream_chr)
+			{
+				pthread_mutex_unlock(&run->lock);
+				writer_put(&s->out_chr.w, job->packed, e->stats.chr_bytes);
+				free(job->packed);
+				job->packed = NULL;
+				pthread_mutex_lock(&run->lock);
+			}
+		}
+		run->next++;
+		pthread_cond_broadcast(&run->cond);
+	}
+	run->draining = false;
+}
 
-	s->entry_count++;
+// Holds back a streamed entry until it is within run->ahead of the next one
+// to be placed, so packed CHR doesn't pile up behind a slow entry. The thread
+// helps read frames meanwhile.
+static void conv_wait_turn(ConvRun *run, int idx)
+{
+	pthread_mutex_lock(&run->lock);
+	while (idx >= run->next + run->ahead)
+	{
+		int chunk;
+		ConvFrames *cf = conv_take_chunk(run, NULL, &chunk);
+		if (cf)
+		{
+			conv_work_chunk(run, cf, chunk);
+			continue;
+		}
+		pthread_cond_wait(&run->cond, &run->lock);
+	}
+	pthread_mutex_unlock(&run->lock);
+}
+
+// Packs an entry's CHR for streaming as soon as it is converted, so that the
+// ordered drain only has to write it. The unpacked CHR isn't needed after.
+static bool conv_entry_pack(ConvJob *job)
+{
+	Entry *e = job->e;
+	const uint64_t phase_start = stats_now();
+	e->stats.chr_bytes = entry_chr_size(e);
+	if (e->stats.chr_bytes > 0)
+	{
+		job->packed = malloc(e->stats.chr_bytes);
+		if (!job->packed)
+		{
+			fprintf(stderr, "[ENTRY $%03X] Couldn't allocate packed CHR\n", e->id);
+			return false;
+		}
+		entry_pack_chr(e, job->packed);
+	}
+	free(e->chr);
+	e->chr = NULL;
+	stats_phase(&e->stats, STATS_PHASE_PACK, phase_start);
+	return true;
+}
+
+static void conv_entry_job(void *ctx, int idx)
+{
+	ConvRun *run = (ConvRun *)ctx;
+
+	// Jobs are handed out in order, so helpers only start once every entry
+	// has been taken.
+	if (idx >= run->count)
+	{
+		conv_help(run);
+		return;
+	}
+
+	ConvJob *job = &run->jobs[idx];
+	if (job->s->stream_chr) conv_wait_turn(run, idx);
+	job->ok = conv_entry_convert(job->s, job->e, run);
+	if (job->ok && job->s->stream_chr) job->ok = conv_entry_pack(job);
+
+	pthread_mutex_lock(&run->lock);
+	job->done = true;
+	run->unconverted--;
+	if (run->unconverted <= 0) pthread_cond_broadcast(&run->cond);
+	conv_drain(run);
+	pthread_mutex_unlock(&run->lock);
+}
+
+bool conv_run(Conv *s)
+{
+	return conv_run_many(s, 1, NULL);
+}
+
+bool conv_run_many(Conv *convs, int conv_count, bool *conv_ok)
+{
+	unsigned int count = 0;
+	for (int i = 0; i < conv_count; i++) count += convs[i].entry_count;
+
+	// Entries from every script go into one pool of jobs.
+	ConvRun run = {0};
+	run.count = count;
+	run.unconverted = count;
+	// Threads left without an entry help read the frames of those still going.
+	const int threads = convs[0].jobs;
+	run.helpers = (threads > 1 && count > 0) ? threads - 1 : 0;
+	run.ahead = (threads > 1) ? threads : 1;
+	run.jobs = calloc(sizeof(*run.jobs), count + 1);
+	run.conv_ok = conv_ok ? conv_ok : malloc(sizeof(*run.conv_ok) * conv_count);
+	if (!run.jobs || !run.conv_ok)
+	{
+		fprintf(stderr, "[CONV] Couldn't allocate job list\n");
+		free(run.jobs);
+		if (run.conv_ok != conv_ok) free(run.conv_ok);
+		return false;
+	}
+	pthread_mutex_init(&run.lock, NULL);
+	pthread_cond_init(&run.cond, NULL);
+
+	int idx = 0;
+	for (int i = 0; i < conv_count; i++)
+	{
+		run.conv_ok[i] = true;
+		for (Entry *e = convs[i].entry_head; e; e = e->next)
+		{
+			run.jobs[idx].s = &convs[i];
+			run.jobs[idx].e = e;
+			run.jobs[idx].conv_idx = i;
+			idx++;
+		}
+	}
+
+	jobs_run(count + run.helpers, threads, conv_entry_job, &run);
+
+	bool ret = true;
+	for (int i = 0; i < conv_count; i++)
+	{
+		if (!run.conv_ok[i]) ret = false;
+	}
+
+	// Left over if their script failed before they were written.
+	for (unsigned int i = 0; i < count; i++) free(run.jobs[i].packed);
+
+	pthread_cond_destroy(&run.cond);
+	pthread_mutex_destroy(&run.lock);
+	free(run.jobs);
+	if (run.conv_ok != conv_ok) free(run.conv_ok);
+	return ret;
+}
+
+typedef struct ConvPack
+{
+	Entry **entries;
+	size_t *offs;        // Where each entry starts in chr, plus the total.
+	uint8_t *chr;
+} ConvPack;
+
+static void conv_pack_job(void *ctx, int idx)
+{
+	ConvPack *pack = (ConvPack *)ctx;
+	Entry *e = pack->entries[idx];
+	const uint64_t phase_start = stats_now();
+	entry_pack_chr(e, &pack->chr[pack->offs[idx]]);
+	e->stats.chr_bytes = pack->offs[idx + 1] - pack->offs[idx];
+	stats_phase(&e->stats, STATS_PHASE_PACK, phase_start);
+}
+
+bool conv_pack_chr(Conv *s, Writer *w_chr)
+{
+	int count = 0;
+	for (Entry *e = s->entry_head; e; e = e->next) count++;
+
+	ConvPack pack = {0};
+	pack.entries = malloc(sizeof(*pack.entries) * (count + 1));
+	pack.offs = malloc(sizeof(*pack.offs) * (count + 1));
+	bool ret = pack.entries && pack.offs;
+	if (ret)
+	{
+		// Packed sizes are known up front, so every entry gets its own part of
+		// one image and they can all be packed at once.
+		int i = 0;
+		pack.offs[0] = 0;
+		for (Entry *e = s->entry_head; e; e = e->next, i++)
+		{
+			pack.entries[i] = e;
+			pack.offs[i + 1] = pack.offs[i] + entry_chr_size(e);
+		}
+		pack.chr = malloc(pack.offs[count] + 1);
+		ret = pack.chr != NULL;
+	}
+
+	if (ret)
+	{
+		jobs_run(count, s->jobs, conv_pack_job, &pack);
+		writer_put(w_chr, pack.chr, pack.offs[count]);
+	}
+	else
+	{
+		fprintf(stderr, "[CONV] Couldn't allocate packed CHR\n");
+	}
+
+	free(pack.chr);
+	free(pack.offs);
+	free(pack.entries);
+	return ret;
+}
+
+bool conv_format_fixed_size(DataFormat fmt)
+{
+	// Composite sprites take as many tiles as it takes to claim their pixels.
+	return format_desc(fmt)->read != FORMAT_READ_CLAIM;
+}
+
+// Sizes an entry from the header and palette of its source image alone.
+static bool conv_entry_plan(Entry *e)
+{
+	Image img;
+	const unsigned int error = image_load_header(&img, e->src);
+	if (error)
+	{
+		fprintf(stderr, "[ENTRY $%03X: %s] LodePNG error %u: %s\n", e->id, e->src, error,
+		        lodepng_error_text(error));
+		return false;
+	}
+
+	e->pal_size = img.palette_size;
+	pal_pack_set(e->frame_cfg.pal_format, img.palette, e->pal, img.palette_size);
+	e->pal_ref = NULL;
+
+	ConvLayout layout;
+	if (!conv_entry_layout(e, img.w, img.h, &layout)) return false;
+	e->frames = layout.frame_count_x * layout.frame_count_y;
+	if (!conv_format_fixed_size(e->frame_cfg.data_format))
+	{
+		e->code_per = 0;
+		return true;
+	}
+
+	e->code_count = e->frames * e->code_per;
+	if (format_desc(e->frame_cfg.data_format)->read != FORMAT_READ_NONE)
+	{
+		e->chr_bytes = (size_t)e->frames * layout.chr_bytes_per;
+	}
+	return true;
+}
+
+bool conv_plan(Conv *s)
+{
+	for (Entry *e = s->entry_head; e; e = e->next)
+	{
+		if (!conv_entry_plan(e)) return false;
+		conv_entry_place(s, e);
+	}
 	return true;
 }
 
@@ -709,9 +1355,11 @@ void conv_shutdown(Conv *s)
 	while (e)
 	{
 		if (e->chr) free(e->chr);
+		stats_free(&e->stats);
 		Entry *next = e->next;
 		free(e);
 		e = next;
 	}
+	outfile_abort(&s->out_chr);
 }
 
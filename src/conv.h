@@ -9,7 +9,25 @@
 
 bool conv_init(Conv *s);
 bool conv_validate(Conv *s);
+// Queues an entry using the current config state. No image data is read yet.
 bool conv_entry_add(Conv *s);
+// Converts all queued entries, assigning codes and offsets in script order as
+// they finish. If s->stream_chr is set, each entry's CHR is packed as soon as
+// it is converted, written to s->out_chr once it is placed, and then released.
+bool conv_run(Conv *s);
+// Same as conv_run() for several scripts at once, sharing one pool of jobs
+// sized by the first. A failed entry doesn't stop other scripts from being
+// placed; if conv_ok is given, it receives whether each script succeeded.
+bool conv_run_many(Conv *convs, int conv_count, bool *conv_ok);
+// Packs the CHR of every entry into w_chr in script order, spreading the
+// entries across s->jobs threads. For scripts that didn't stream it.
+bool conv_pack_chr(Conv *s, Writer *w_chr);
+// Works out the codes, offsets and sizes every queued entry would get, reading
+// only the header and palette of each image. Nothing is converted, so the
+// sizes of formats that depend on pixel content are left at zero.
+bool conv_plan(Conv *s);
+// Whether the size of a format's data follows from the image size alone.
+bool conv_format_fixed_size(DataFormat fmt);
 //
 // Release of conversion resources.
 //
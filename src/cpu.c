@@ -0,0 +1,25 @@
+#include "cpu.h"
+
+CpuIsa cpu_isa_best(void)
+{
+#ifdef CPU_X86
+	if (__builtin_cpu_supports("avx2")) return CPU_ISA_AVX2;
+	if (__builtin_cpu_supports("sse2")) return CPU_ISA_SSE2;
+#endif  // CPU_X86
+	return CPU_ISA_SCALAR;
+}
+
+const char *cpu_string_for_isa(CpuIsa isa)
+{
+	switch (isa)
+	{
+		case CPU_ISA_SCALAR:
+			return "scalar";
+		case CPU_ISA_SSE2:
+			return "sse2";
+		case CPU_ISA_AVX2:
+			return "avx2";
+		default:
+			return "(unknown)";
+	}
+}
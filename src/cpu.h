@@ -0,0 +1,21 @@
+#pragma once
+
+//
+// Instruction sets the pixel kernels have versions for, picked at run time.
+//
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_X86
+#endif
+
+typedef enum CpuIsa
+{
+	CPU_ISA_SCALAR,
+	CPU_ISA_SSE2,
+	CPU_ISA_AVX2,
+	CPU_ISA_COUNT
+} CpuIsa;
+
+// Returns the fastest set the CPU running this has.
+CpuIsa cpu_isa_best(void);
+const char *cpu_string_for_isa(CpuIsa isa);
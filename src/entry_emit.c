@@ -2,7 +2,6 @@
 #include "format.h"
 #include <stdlib.h>
 #include <string.h>
-#include "endian.h"
 #include "mdcsp_mapping.h"
 #include "pxutil.h"
 
@@ -223,196 +222,119 @@ void entry_emit_meta(const Entry *e, FILE *f_inc, int pal_offs, bool c_lang)
 	fprintf(f_inc, "\n");
 }
 
-void entry_emit_chr(const Entry *e, FILE *f_chr)
+// Packs the rows of eight pixels of chr in the order desc gives them.
+static void pack_planar(const FormatDesc *desc, const uint8_t *chr, size_t chr_bytes,
+                        int tilesize, uint8_t *out)
 {
-	// Dump CHR data into CHR file(s)
-	uint8_t *chr = e->chr;
-	switch (e->frame_cfg.data_format)
+	const int planes = desc->planes;
+	const uint32_t order = desc->plane_order;
+	const bool reverse = desc->plane_reverse;
+	const bool invert = desc->plane_invert;
+	switch (desc->rows)
 	{
-		// 8bpp as-is
-		case DATA_FORMAT_DIRECT:
-			for (size_t i = 0; i < e->chr_bytes; i++)
-			{
-				const uint8_t px = *chr++;
-				fputc(px, f_chr);
-			}
+		case FORMAT_ROWS_IN_ORDER:
+			pxutil_pack_planar_rows(chr, 8, chr_bytes/8, planes, order, reverse, invert, out);
 			break;
 
-		// sp013 special 4bpp/8bpp hybrid
-		case DATA_FORMAT_SP013:
-			for (size_t i = 0; i < e->chr_bytes/2; i++)
-			{
-				const uint8_t fetchpx0 = *chr++;
-				const uint8_t fetchpx1 = *chr++;
-
-				// Inverted data order for SP013.
-				const uint8_t px0 = fetchpx1;
-				const uint8_t px1 = fetchpx0;
-
-				const uint8_t lowbyte = ((px0 << 4) & 0xF0) | (px1 & 0x0F);
-				const uint8_t hibyte = (px0 & 0xF0) | ((px1 >> 4) & 0x0F);
-
-				fputc(lowbyte, f_chr);
-				if (e->frame_cfg.depth == 8) fputc(hibyte, f_chr);
-			}
-			break;
-
-		case DATA_FORMAT_BG038:
-			for (size_t i = 0; i < e->chr_bytes/2; i++)
+		case FORMAT_ROWS_NEO_SPR:
+			for (size_t i = 0; i < chr_bytes/(16*16); i++)  // per tile
 			{
-				const uint8_t px0 = *chr++;
-				const uint8_t px1 = *chr++;
-
-				const uint8_t lowbyte = ((px0 << 4) & 0xF0) | (px1 & 0x0F);
-				const uint8_t hibyte = (px0 & 0xF0) | ((px1 >> 4) & 0x0F);
-
-				// Put main plane on low bytes, upper 4bpp on even bytes
-				fputc(lowbyte, f_chr);
-				if (e->frame_cfg.depth == 8) fputc(hibyte, f_chr);
+				const uint8_t *chr_tile16 = &chr[i*16*16];
+				for (int tx = 1; tx >= 0; tx--)
+				{
+					pxutil_pack_planar_rows(&chr_tile16[tx*8], 16, 16, planes, order,
+					                        reverse, invert, out);
+					out += 16*planes;  // 16 rows of 8 px
+				}
 			}
 			break;
 
-		case DATA_FORMAT_CPS_BG:
-			if (e->frame_cfg.tilesize == 8)
+		case FORMAT_ROWS_CPS:
+			if (tilesize == 8)
 			{
 				// CPS-B only selects data from the "even" graphics for 8x8 tiles.
 				// Basically, we emit an 8x8 planar tile, followed by a blank tile.
-				for (size_t i = 0; i < e->chr_bytes/(8*8); i++)
+				for (size_t i = 0; i < chr_bytes/(8*8); i++)
 				{
+					uint8_t even[8*8];
+					pxutil_pack_planar_rows(chr, 8, 8, planes, order, reverse, invert, even);
 					for (size_t j = 0; j < 8; j++)
 					{
-						uint8_t even[4] = {0};
-						for (size_t k = 0; k < 8; k++)
-						{
-							for (int bit = 0; bit < 4; bit++)
-							{
-								even[bit] = even[bit] << 1;
-								even[bit] |= ((chr[(j*8)+k]   & (1<<bit)) ? 1 : 0);
-							}
-						}
-						for (int bit = 0; bit < 4; bit++) fputc(~even[bit], f_chr);
-						for (int bit = 0; bit < 4; bit++) fputc(~even[bit], f_chr);
+						memcpy(out, &even[j*planes], planes);
+						memcpy(out + planes, &even[j*planes], planes);
+						out += 2*planes;
 					}
 					chr += 8*8;
 				}
-				break;
-			}
-			else if (e->frame_cfg.tilesize == 32)
-			{
-				break;
 			}
-			__attribute__((fallthrough));
-
-		case DATA_FORMAT_CPS_SPR:
-			// spreads across 3-6, we have low 2bpp even tiles, low 2bpp odd tiles, high 2bpp even tiles, high 2bpp odd tiles
-			// 16x16 blocks at a time, emitted as planar data.
-			// for every 16x16 sprite:
-//			printf("CHR bytes: %lu\n", e->chr_bytes);
-//			printf("16x16 tile count: %lu\n", e->chr_bytes/(16*16));
-			for (size_t i = 0; i < e->chr_bytes/(16*16); i++)
+			else if (tilesize != 32)
 			{
-				for (size_t j = 0; j < 16; j++)
-				{
-					uint8_t even[4] = {0};
-					uint8_t odd[4] = {0};
-					for (size_t k = 0; k < 8; k++)
-					{
-						for (int bit = 0; bit < 4; bit++)
-						{
-							even[bit] = even[bit] << 1;
-							odd[bit]  = odd[bit] << 1;
-							even[bit] |= ((chr[(j*16)+k]   & (1<<bit)) ? 1 : 0);
-							odd[bit]  |= ((chr[(j*16)+k+8] & (1<<bit)) ? 1 : 0);
-						}
-					}
-
-					for (int bit = 0; bit < 4; bit++) fputc(~even[bit], f_chr);
-					for (int bit = 0; bit < 4; bit++) fputc(~odd[bit], f_chr);
-				}
-				chr += 16*16;
+				pxutil_pack_planar_rows(chr, 8, chr_bytes/8, planes, order, reverse, invert, out);
 			}
 			break;
+	}
+}
 
-		case DATA_FORMAT_MD_SPR:
-		case DATA_FORMAT_MD_BG:
-		case DATA_FORMAT_MD_CSP:
-		case DATA_FORMAT_TOA_TXT:
-			for (size_t i = 0; i < e->chr_bytes/2; i++)
-			{
-				const uint8_t px0 = *chr++;
-				const uint8_t px1 = *chr++;
+void entry_pack_chr(const Entry *e, uint8_t *out)
+{
+	// Copied out, as stores to out could otherwise alias the entry.
+	const uint8_t *chr = e->chr;
+	const size_t chr_bytes = e->chr_bytes;
+	const FormatDesc *desc = format_desc(e->frame_cfg.data_format);
+	switch (desc->pack)
+	{
+		case FORMAT_PACK_NONE:
+			break;
 
-				const uint8_t lowbyte = ((px0 << 4) & 0xF0) | (px1 & 0x0F);
+		case FORMAT_PACK_DIRECT:
+			memcpy(out, chr, chr_bytes);
+			break;
 
-				fputc(lowbyte, f_chr);
-			}
+		case FORMAT_PACK_NIBBLES:
+			pxutil_pack_nibbles(chr, chr_bytes/2, desc->nibble_swap,
+			                    desc->nibble_split && e->frame_cfg.depth == 8, out);
 			break;
 
-		// 4bpp planar
-		case DATA_FORMAT_TOA_GCU_SPR:
-		case DATA_FORMAT_TOA_GCU_BG:
-			for (size_t i = 0; i < (e->chr_bytes)/(8); i++)
-			{
-				const uint8_t *chr_row = &chr[i*8];
+		case FORMAT_PACK_NIBBLE_COLUMNS:
+			pxutil_pack_nibble_columns(chr, chr_bytes/(8*8), out);
+			break;
 
-				for (size_t plane = 0; plane < 4; plane++)
-				{
-					uint8_t row_out = 0;
-					const uint8_t mask = 1 << plane;
-					for (size_t col = 0; col < 8; col++)
-					{
-						row_out = row_out << 1;
-						if (chr_row[col] & mask) row_out |= 0x01;
-					}
-					fputc(row_out, f_chr);
-				};
-			}
+		case FORMAT_PACK_PLANAR:
+			pack_planar(desc, chr, chr_bytes, e->frame_cfg.tilesize, out);
 			break;
+	}
+}
 
-		// Linear, in a funny order
-		case DATA_FORMAT_NEO_FIX:
-			for (size_t i = 0; i < e->chr_bytes/(8*8); i++)
-			{
-				const uint8_t *chr_tile = &chr[i*8*8];
-				static const int column_pair_order_tbl[4] = {2, 3, 0, 1};
-				for (int colset = 0; colset < 4; colset++)
-				{
-					for (int row = 0; row < 8; row++)
-					{
-						const int source_x_offset = column_pair_order_tbl[colset]*2;
+size_t entry_chr_size(const Entry *e)
+{
+	const FormatDesc *desc = format_desc(e->frame_cfg.data_format);
+	switch (desc->pack)
+	{
+		case FORMAT_PACK_DIRECT:
+			return e->chr_bytes;
 
-						const uint8_t px_lo = (chr_tile[(row*8) + source_x_offset +1] & 0xF) << 4;
-						const uint8_t px_hi = (chr_tile[(row*8) + source_x_offset] & 0xF);
-						fputc(px_lo | px_hi, f_chr);
-					}
-				}
-			}
-			break;
+		case FORMAT_PACK_NIBBLES:
+			if (desc->nibble_split && e->frame_cfg.depth == 8) return e->chr_bytes;
+			return e->chr_bytes / 2;
 
-		// Planar
-		case DATA_FORMAT_NEO_SPR:
-			for (size_t i = 0; i < e->chr_bytes/(16*16); i++)  // per tile
+		case FORMAT_PACK_NIBBLE_COLUMNS:
+			return e->chr_bytes / 2;
+
+		case FORMAT_PACK_PLANAR:
+			if (desc->rows == FORMAT_ROWS_CPS)
 			{
-				const uint8_t *chr_tile16 = &chr[i*16*16];
-				for (int tx = 1; tx >= 0; tx--)
-				{
-					for (int y = 0; y < 16; y++)
-					{
-						const uint8_t *chr_row = &chr_tile16[(tx*8)+(y*16)];
-						uint8_t row_buffer[4];  // sized for 8 px @ 4bpp
-						pxutil_pack_planar(chr_row, 4, 0x3210, true, row_buffer);
-					fwrite(row_buffer, 1, sizeof(row_buffer), f_chr);
-					}
-				}
+				// 8x8 tiles are padded out with a blank tile each.
+				if (e->frame_cfg.tilesize == 8) return e->chr_bytes * desc->planes / 4;
+				if (e->frame_cfg.tilesize == 32) return 0;
 			}
-			break;
+			return e->chr_bytes * desc->planes / 8;
 
 		default:
-			break;
+			return 0;
 	}
 }
 
-void entry_emit_pal(Entry *e, FILE *f_pal, int *pal_offs)
+void entry_emit_pal(Entry *e, Writer *w_pal, int *pal_offs)
 {
 	// If this entry references another's palette, copy the entry offs, and
 	// do not add palette data.
@@ -426,10 +348,7 @@ void entry_emit_pal(Entry *e, FILE *f_pal, int *pal_offs)
 		// Otherwise, mark palette offs by the output position and write
 		// unique palette data.
 		e->pal_block_offs = *pal_offs;
-		for (int i = 0; i < e->pal_size; i++)
-		{
-			fwrite_uint16be(e->pal[i], f_pal);
-		}
+		writer_put16be_array(w_pal, e->pal, e->pal_size);
 		*pal_offs += e->pal_size * sizeof(uint16_t);
 	}
 }
@@ -570,14 +489,81 @@ void entry_emit_header_chr_size(FILE *f, const char *sym_name, size_t bytes)
 	free(sym_buf);
 }
 
-void entry_emit_map(const Entry *e, FILE *f_map)
+void entry_emit_map(const Entry *e, Writer *w_map)
 {
 	switch (e->frame_cfg.data_format)
 	{
 		case DATA_FORMAT_MD_CSP:
-			mdcsp_emit_mapping(e, f_map);
+			mdcsp_emit_mapping(e, w_map);
 			break;
 		default:
 			break;
 	}
 }
+
+// Writes a path for a Makefile rule, escaping characters make would mangle.
+static void emit_make_path(FILE *f, const char *path)
+{
+	for (const char *c = path; *c; c++)
+	{
+		switch (*c)
+		{
+			case ' ':
+			case '#':
+				fputc('\\', f);
+				fputc(*c, f);
+				break;
+			case '$':
+				fputs("$$", f);
+				break;
+			default:
+				fputc(*c, f);
+				break;
+		}
+	}
+}
+
+// True if the source for e was already listed, as the script or for an earlier entry.
+static bool depfile_src_listed(const Entry *head, const Entry *e, const char *script)
+{
+	if (strcmp(e->src, script) == 0) return true;
+	for (const Entry *g = head; g != e; g = g->next)
+	{
+		if (strcmp(g->src, e->src) == 0) return true;
+	}
+	return false;
+}
+
+void entry_emit_depfile(FILE *f, const char *out, const char **exts, int ext_count,
+                        const char *script, const Entry *head)
+{
+	// Every output depends on the script and each distinct source image.
+	for (int i = 0; i < ext_count; i++)
+	{
+		if (i > 0) fputc(' ', f);
+		emit_make_path(f, out);
+		fprintf(f, ".%s", exts[i]);
+	}
+	fprintf(f, ": \\\n ");
+	emit_make_path(f, script);
+	for (const Entry *e = head; e; e = e->next)
+	{
+		if (depfile_src_listed(head, e, script)) continue;
+		fprintf(f, " \\\n ");
+		emit_make_path(f, e->src);
+	}
+	fprintf(f, "\n");
+
+	// An empty rule for each prerequisite keeps make from stopping when an
+	// image is deleted or dropped from the script.
+	fprintf(f, "\n");
+	emit_make_path(f, script);
+	fprintf(f, ":\n");
+	for (const Entry *e = head; e; e = e->next)
+	{
+		if (depfile_src_listed(head, e, script)) continue;
+		fprintf(f, "\n");
+		emit_make_path(f, e->src);
+		fprintf(f, ":\n");
+	}
+}
@@ -2,15 +2,19 @@
 
 #include "types.h"
 #include <stdio.h>
+#include "writer.h"
 
 //
 // Entry emission functions.
 //
 
 void entry_emit_meta(const Entry *e, FILE *f_inc, int pal_offs, bool c_lang);
-void entry_emit_chr(const Entry *e, FILE *f_chr);
-void entry_emit_pal(Entry *e, FILE *f_pal, int *pal_offs);
-void entry_emit_map(const Entry *e, FILE *f_map);
+// Bytes of packed CHR for an entry.
+size_t entry_chr_size(const Entry *e);
+// Packs an entry's CHR into out, which has room for entry_chr_size() bytes.
+void entry_pack_chr(const Entry *e, uint8_t *out);
+void entry_emit_pal(Entry *e, Writer *w_pal, int *pal_offs);
+void entry_emit_map(const Entry *e, Writer *w_map);
 
 void entry_emit_header_top(FILE *f, bool c_lang);
 void entry_emit_header_divider(FILE *f, bool c_lang);
@@ -23,3 +27,7 @@ void entry_emit_header_data_decl(FILE *f, size_t pal_offs, size_t map_offs,
                                 const char *sym_name, bool c_lang);
 
 void entry_emit_header_chr_size(FILE *f, const char *sym_name, size_t bytes);
+
+// Make rule listing the script and source images as prerequisites of outputs.
+void entry_emit_depfile(FILE *f, const char *out, const char **exts, int ext_count,
+                        const char *script, const Entry *head);
@@ -39,3 +39,122 @@ const char *string_for_data_format(DataFormat fmt)
 	if (fmt < 0 || fmt >= DATA_FORMAT_COUNT) return kstring_for_data_format[DATA_FORMAT_UNSPECIFIED];
 	return kstring_for_data_format[fmt];
 }
+
+static const FormatDesc kformat_desc[DATA_FORMAT_COUNT] =
+{
+	[DATA_FORMAT_UNSPECIFIED] = {0},
+	[DATA_FORMAT_DIRECT] =
+	{
+		.read = FORMAT_READ_Y_MAJOR,
+		.pack = FORMAT_PACK_DIRECT,
+	},
+	// Lines of 4bpp, or 8bpp as a 4bpp hybrid; the second pixel goes on top.
+	[DATA_FORMAT_SP013] =
+	{
+		.read = FORMAT_READ_LINES,
+		.tilesizes = 16, .depths = 4 | 8,
+		.sprite = true,
+		.pack = FORMAT_PACK_NIBBLES,
+		.nibble_swap = true, .nibble_split = true,
+	},
+	// The main plane on low bytes, upper 4bpp on even bytes.
+	[DATA_FORMAT_BG038] =
+	{
+		.read = FORMAT_READ_Y_MAJOR,
+		.tilesizes = 8 | 16, .depths = 4 | 8,
+		.tile_frames = true,
+		.pack = FORMAT_PACK_NIBBLES,
+		.nibble_split = true,
+	},
+	// Spread across 3-6: low 2bpp even tiles, low 2bpp odd tiles, high 2bpp
+	// even tiles, high 2bpp odd tiles. For every 16x16 sprite, each row's
+	// even (left) half, then odd (right) half, which is every 8px row in the
+	// order it lies in CHR.
+	[DATA_FORMAT_CPS_SPR] =
+	{
+		.read = FORMAT_READ_Y_MAJOR,  // TODO: For CPS SPR, pass in a tile skip flag.
+		.tilesizes = 16, .depths = 4,
+		.sprite = true,
+		.pack = FORMAT_PACK_PLANAR,
+		.planes = 4, .plane_order = 0x3210, .plane_invert = true,
+	},
+	[DATA_FORMAT_CPS_BG] =
+	{
+		.read = FORMAT_READ_Y_MAJOR,
+		.tilesizes = 8 | 16 | 32, .depths = 4,
+		.pack = FORMAT_PACK_PLANAR,
+		.planes = 4, .plane_order = 0x3210, .plane_invert = true,
+		.rows = FORMAT_ROWS_CPS,
+	},
+	[DATA_FORMAT_MD_SPR] =
+	{
+		.read = FORMAT_READ_X_MAJOR,
+		.tilesizes = 8, .depths = 4, .min_frame = 8,
+		.sprite = true,
+		.pack = FORMAT_PACK_NIBBLES,
+	},
+	[DATA_FORMAT_MD_BG] =
+	{
+		.read = FORMAT_READ_Y_MAJOR,
+		.tilesizes = 8, .depths = 4, .min_frame = 8,
+		.pack = FORMAT_PACK_NIBBLES,
+	},
+	[DATA_FORMAT_MD_CSP] =
+	{
+		.read = FORMAT_READ_CLAIM,
+		.depths = 4,
+		.pack = FORMAT_PACK_NIBBLES,
+	},
+	[DATA_FORMAT_MD_CBG] =
+	{
+		.depths = 4,
+	},
+	[DATA_FORMAT_TOA_TXT] =
+	{
+		.read = FORMAT_READ_X_MAJOR,
+		.tilesizes = 8, .depths = 4, .min_frame = 8,
+		.pack = FORMAT_PACK_NIBBLES,
+	},
+	[DATA_FORMAT_TOA_GCU_SPR] =
+	{
+		.read = FORMAT_READ_Y_MAJOR,
+		.tilesizes = 8, .depths = 4, .min_frame = 8,
+		.sprite = true,
+		.pack = FORMAT_PACK_PLANAR,
+		.planes = 4, .plane_order = 0x3210,
+	},
+	[DATA_FORMAT_TOA_GCU_BG] =
+	{
+		.read = FORMAT_READ_Y_MAJOR,
+		.tilesizes = 16,
+		.tile_frames = true,
+		.pack = FORMAT_PACK_PLANAR,
+		.planes = 4, .plane_order = 0x3210,
+	},
+	// Linear, in a funny order.
+	[DATA_FORMAT_NEO_FIX] =
+	{
+		.read = FORMAT_READ_X_MAJOR,
+		.depths = 4,
+		.pack = FORMAT_PACK_NIBBLE_COLUMNS,
+	},
+	[DATA_FORMAT_NEO_SPR] =
+	{
+		.read = FORMAT_READ_X_MAJOR,
+		.tilesizes = 16, .depths = 4,
+		.sprite = true,
+		.pack = FORMAT_PACK_PLANAR,
+		.planes = 4, .plane_order = 0x3210, .plane_reverse = true,
+		.rows = FORMAT_ROWS_NEO_SPR,
+	},
+	[DATA_FORMAT_NEO_CSPR] =
+	{
+		.tilesizes = 16, .depths = 4,
+	},
+};
+
+const FormatDesc *format_desc(DataFormat fmt)
+{
+	if (fmt < 0 || fmt >= DATA_FORMAT_COUNT) return &kformat_desc[DATA_FORMAT_UNSPECIFIED];
+	return &kformat_desc[fmt];
+}
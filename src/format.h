@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 
 //
@@ -28,3 +29,62 @@ typedef enum DataFormat
 
 DataFormat data_format_for_string(const char *str);
 const char *string_for_data_format(DataFormat fmt);
+
+//
+// What each format is made of: how its frames are read, the settings it
+// allows, and how its CHR data is packed. Hardware size codes and the
+// symbols emitted for each format are still worked out where they're used.
+//
+
+// How frames are read out of the source image.
+typedef enum FormatRead
+{
+	FORMAT_READ_NONE,        // Nothing is read; the format makes no data yet.
+	FORMAT_READ_Y_MAJOR,     // Tiles a row at a time.
+	FORMAT_READ_X_MAJOR,     // Tiles a column at a time.
+	FORMAT_READ_LINES,       // Rows of pixels, as with a tilesize of 1.
+	FORMAT_READ_CLAIM,       // Sprites are claimed out of each frame, so the
+	                         // size of the data isn't fixed.
+} FormatRead;
+
+// How 8bpp CHR is packed for output.
+typedef enum FormatPack
+{
+	FORMAT_PACK_NONE,
+	FORMAT_PACK_DIRECT,          // 8bpp as-is.
+	FORMAT_PACK_NIBBLES,         // Pixel pairs to a byte each.
+	FORMAT_PACK_NIBBLE_COLUMNS,  // Pixel pairs of 8x8 tiles, a column pair at a time.
+	FORMAT_PACK_PLANAR,          // Rows of eight pixels to bitplanes.
+} FormatPack;
+
+// The order rows of eight pixels are packed in for planar data.
+typedef enum FormatRows
+{
+	FORMAT_ROWS_IN_ORDER,    // As they lie in CHR.
+	FORMAT_ROWS_NEO_SPR,     // The right half of each 16x16 tile, then the left.
+	FORMAT_ROWS_CPS,         // In order, but an 8x8 tile has each row twice, as
+	                         // CPS-B only reads the even half. 32x32 isn't done yet.
+} FormatRows;
+
+typedef struct FormatDesc
+{
+	FormatRead read;
+	int tilesizes;           // Sizes allowed, OR'd together; any if 0.
+	int depths;              // Likewise for bit depths.
+	int min_frame;           // Smallest frame width and height set, if not 0.
+	bool tile_frames;        // The tilesize set is the size of a frame of 8px tiles.
+	bool sprite;             // A frame takes one hardware sprite.
+
+	FormatPack pack;
+	bool nibble_swap;        // NIBBLES: the second pixel of a pair goes on top.
+	bool nibble_split;       // NIBBLES: 8bpp is kept, with a byte of high nibbles.
+	int planes;              // PLANAR: as pxutil_pack_planar().
+	uint32_t plane_order;
+	bool plane_reverse;
+	bool plane_invert;
+	FormatRows rows;
+} FormatDesc;
+
+// Returns the descriptor for fmt, which is empty for DATA_FORMAT_UNSPECIFIED
+// or anything out of range.
+const FormatDesc *format_desc(DataFormat fmt);
@@ -0,0 +1,24 @@
+// 64-bit FNV-1a hashing, used to identify file contents and settings.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HASH_INIT 0xCBF29CE484222325ULL
+
+static inline uint64_t hash_bytes(uint64_t hash, const void *data, size_t len)
+{
+	const uint8_t *p = (const uint8_t *)data;
+	for (size_t i = 0; i < len; i++)
+	{
+		hash ^= p[i];
+		hash *= 0x100000001B3ULL;
+	}
+	return hash;
+}
+
+static inline uint64_t hash_int(uint64_t hash, int32_t val)
+{
+	return hash_bytes(hash, &val, sizeof(val));
+}
@@ -0,0 +1,266 @@
+#include "image.h"
+#include "hash.h"
+#include "lodepng.h"
+#include "pngdec.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif  // _WIN32
+
+// Maps the file in, so that it is read straight from the page cache rather
+// than copied out first. Returns false if it can't be, or is empty.
+static bool image_map(Image *img, const char *path)
+{
+#ifdef _WIN32
+	(void)img;
+	(void)path;
+	return false;
+#else
+	const int fd = open(path, O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st;
+	void *map = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size > 0)
+	{
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	close(fd);
+	if (map == MAP_FAILED) return false;
+
+	img->png = (const uint8_t *)map;
+	img->png_mapped = true;
+	img->file_size = st.st_size;
+	return true;
+#endif  // _WIN32
+}
+
+static void image_release_png(Image *img)
+{
+#ifndef _WIN32
+	if (img->png_mapped) munmap((void *)img->png, img->file_size);
+	else
+#endif  // _WIN32
+	free((void *)img->png);
+	img->png = NULL;
+	img->png_mapped = false;
+}
+
+unsigned int image_load(Image *img, const char *path, bool hash)
+{
+	memset(img, 0, sizeof(*img));
+	snprintf(img->path, sizeof(img->path), "%s", path);
+
+	struct stat st;
+	if (stat(path, &st) == 0)
+	{
+		img->mtime = st.st_mtime;
+	}
+
+	if (!image_map(img, path))
+	{
+		uint8_t *png;
+		size_t png_fsize;
+		const unsigned int error = lodepng_load_file(&png, &png_fsize, path);
+		if (error) return error;
+		img->png = png;
+		img->file_size = png_fsize;
+	}
+	if (hash) img->hash = hash_bytes(HASH_INIT, img->png, img->file_size);
+
+	// The size is known up front, so that a pixel buffer can be found for it.
+	LodePNGState state;
+	lodepng_state_init(&state);
+	if (lodepng_inspect(&img->w, &img->h, &state, img->png, img->file_size) != 0)
+	{
+		img->w = img->h = 0;
+	}
+	lodepng_state_cleanup(&state);
+	return 0;
+}
+
+// Decodes with LodePNG, for anything pngdec doesn't handle.
+static unsigned int image_decode_lodepng(Image *img, bool verify, InflateBackend inflate)
+{
+	LodePNGState state;
+	lodepng_state_init(&state);
+	state.decoder.ignore_crc = !verify;
+	state.decoder.zlibsettings.ignore_adler32 = !verify;
+	inflate_hook_lodepng(&state.decoder.zlibsettings, inflate);
+	state.info_raw.colortype = LCT_PALETTE;
+	state.info_raw.bitdepth = 8;
+	uint8_t *px;
+	const unsigned int error = lodepng_decode(&px, &img->w, &img->h, &state,
+	                                          img->png, img->file_size);
+	if (error)
+	{
+		lodepng_state_cleanup(&state);
+		if (error == 110 && inflate != INFLATE_BACKEND_LODEPNG)
+		{
+			return image_decode_lodepng(img, verify, INFLATE_BACKEND_LODEPNG);
+		}
+		return error;
+	}
+
+	free(img->buf.px);
+	img->buf.px = px;
+	img->buf.size = image_px_size(img);
+	img->px = px;
+	img->palette_size = state.info_png.color.palettesize;
+	memcpy(img->palette, state.info_png.color.palette, img->palette_size * 4);
+	lodepng_state_cleanup(&state);
+	return 0;
+}
+
+unsigned int image_decode(Image *img, ImageBuf *spare, bool verify, InflateBackend inflate)
+{
+	if (img->px) return 0;
+	if (!img->png) return 48;  // LodePNG: empty input buffer.
+
+	if (!img->buf.px && spare && spare->px)
+	{
+		img->buf = *spare;
+		spare->px = NULL;
+		spare->size = 0;
+	}
+
+	const unsigned int error = pngdec_supported(img->png, img->file_size)
+	                           ? pngdec_decode(img, verify, inflate)
+	                           : image_decode_lodepng(img, verify, inflate);
+	if (error) return error;
+
+	image_release_png(img);
+	return 0;
+}
+
+ImageBuf image_take_buf(Image *img)
+{
+	const ImageBuf ret = img->buf;
+	img->buf.px = NULL;
+	img->buf.size = 0;
+	img->px = NULL;
+	return ret;
+}
+
+static uint32_t read32be(const uint8_t *d)
+{
+	return ((uint32_t)d[0] << 24) | ((uint32_t)d[1] << 16) | ((uint32_t)d[2] << 8) | d[3];
+}
+
+unsigned int image_load_header(Image *img, const char *path)
+{
+	memset(img, 0, sizeof(*img));
+	snprintf(img->path, sizeof(img->path), "%s", path);
+
+	FILE *f = fopen(path, "rb");
+	if (!f) return 78;  // LodePNG: failed to open file for reading.
+
+	// The signature and IHDR chunk, checked by LodePNG.
+	uint8_t head[33];
+	if (fread(head, 1, sizeof(head), f) != sizeof(head))
+	{
+		fclose(f);
+		return 27;  // LodePNG: smaller than a PNG header.
+	}
+	LodePNGState state;
+	lodepng_state_init(&state);
+	unsigned int error = lodepng_inspect(&img->w, &img->h, &state, head, sizeof(head));
+	const LodePNGColorType colortype = state.info_png.color.colortype;
+	lodepng_state_cleanup(&state);
+	if (error)
+	{
+		fclose(f);
+		return error;
+	}
+	// Only indexed images can be converted.
+	if (colortype != LCT_PALETTE)
+	{
+		fclose(f);
+		return 82;  // LodePNG: color isn't in palette.
+	}
+
+	// Walk the chunks up to the image data, skipping all but PLTE and tRNS.
+	// Chunk type followed by its data, as the CRC covers both.
+	uint8_t body[4 + (256 * 3)];
+	uint8_t *data = &body[4];
+	while (!error)
+	{
+		uint8_t chunk[8];
+		if (fread(chunk, 1, sizeof(chunk), f) != sizeof(chunk))
+		{
+			error = 30;  // LodePNG: chunk broken off at end of file.
+			break;
+		}
+		const uint32_t len = read32be(chunk);
+		const bool is_plte = (memcmp(&chunk[4], "PLTE", 4) == 0);
+		const bool is_trns = (memcmp(&chunk[4], "tRNS", 4) == 0);
+		if (memcmp(&chunk[4], "IDAT", 4) == 0 || memcmp(&chunk[4], "IEND", 4) == 0) break;
+		if (!is_plte && !is_trns)
+		{
+			if (fseek(f, (long)len + 4, SEEK_CUR) != 0) error = 30;
+			continue;
+		}
+
+		if (len > sizeof(body) - 4 || (is_plte && (len == 0 || len % 3 != 0)))
+		{
+			error = is_plte ? 38 : 39;  // LodePNG: palette / tRNS size.
+			break;
+		}
+		uint8_t crc[4];
+		if (fread(data, 1, len, f) != len || fread(crc, 1, sizeof(crc), f) != sizeof(crc))
+		{
+			error = 30;
+			break;
+		}
+		memcpy(body, &chunk[4], 4);
+		if (read32be(crc) != lodepng_crc32(body, len + 4))
+		{
+			error = 57;  // LodePNG: invalid CRC.
+			break;
+		}
+
+		if (is_plte)
+		{
+			img->palette_size = len / 3;
+			for (int i = 0; i < img->palette_size; i++)
+			{
+				img->palette[(i * 4) + 0] = data[(i * 3) + 0];
+				img->palette[(i * 4) + 1] = data[(i * 3) + 1];
+				img->palette[(i * 4) + 2] = data[(i * 3) + 2];
+				img->palette[(i * 4) + 3] = 255;
+			}
+		}
+		else
+		{
+			if ((int)len > img->palette_size)
+			{
+				error = 39;
+				break;
+			}
+			for (uint32_t i = 0; i < len; i++) img->palette[(i * 4) + 3] = data[i];
+		}
+	}
+	fclose(f);
+	if (!error && img->palette_size == 0) error = 106;  // LodePNG: no PLTE chunk.
+	return error;
+}
+
+bool image_stale(const Image *img)
+{
+	struct stat st;
+	if (stat(img->path, &st) != 0) return true;
+	return (st.st_mtime != img->mtime) || ((size_t)st.st_size != img->file_size);
+}
+
+void image_free(Image *img)
+{
+	image_release_png(img);
+	free(img->buf.px);
+	img->buf.px = NULL;
+	img->buf.size = 0;
+	img->px = NULL;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include "inflate.h"
+
+//
+// Source images, read from PNG files as 8bpp indexed pixel data.
+//
+
+// Storage for decoded pixels, which can be handed on to another image once
+// one is done with it.
+typedef struct ImageBuf
+{
+	uint8_t *px;
+	size_t size;
+} ImageBuf;
+
+typedef struct Image
+{
+	char path[256];
+	time_t mtime;          // Modification time of the file when it was read.
+	size_t file_size;
+	uint64_t hash;         // Hash of the file contents, if asked for.
+
+	// File contents, mapped in from the file where possible; released once
+	// decoded. The file shouldn't be rewritten in place while it is mapped.
+	const uint8_t *png;
+	bool png_mapped;
+
+	// Decoded image. px is NULL until decoded. w and h are set from the
+	// header when the file is loaded.
+	uint8_t *px;           // One byte per pixel, in buf.
+	ImageBuf buf;
+	unsigned int w, h;
+	uint8_t palette[256 * 4];  // RGBA
+	int palette_size;
+} Image;
+
+// Reads a PNG file without decoding it. Its contents are hashed if hash is
+// set. Returns a LodePNG error code, or 0 on success.
+unsigned int image_load(Image *img, const char *path, bool hash);
+
+// Decodes the loaded file into 8bpp indexed pixels and palette. If img has
+// no pixel buffer yet and spare is given, spare is taken over for the pixels
+// and cleared; a buffer that is too small is replaced. Unless verify is set,
+// PNG checksums are not checked. The image data is inflated with inflate.
+// Returns a LodePNG error code, or 0 on success.
+unsigned int image_decode(Image *img, ImageBuf *spare, bool verify, InflateBackend inflate);
+
+// Bytes of pixel data the image decodes to.
+static inline size_t image_px_size(const Image *img)
+{
+	return (size_t)img->w * img->h;
+}
+
+// Detaches the pixel buffer from img, to be given to another image.
+ImageBuf image_take_buf(Image *img);
+
+// Reads only the header and palette chunks of a PNG file, which sets w, h
+// and the palette without loading or decoding the image data.
+// Returns a LodePNG error code, or 0 on success.
+unsigned int image_load_header(Image *img, const char *path);
+
+// True if the file on disk no longer matches what was loaded.
+bool image_stale(const Image *img);
+
+void image_free(Image *img);
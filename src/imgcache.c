@@ -0,0 +1,192 @@
+#include "imgcache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct ImgCacheNode
+{
+	char path[256];        // Lookup key; img.path is rewritten on every load.
+	Image img;
+	bool valid;            // img holds the current file contents.
+	unsigned int gen;      // Generation the image was last checked in.
+	int uses;              // Entries still expected to use the image.
+	pthread_mutex_t lock;  // Held while reading or decoding img.
+	ImgCacheNode *next;
+};
+
+void imgcache_init(ImgCache *c)
+{
+	memset(c, 0, sizeof(*c));
+	pthread_mutex_init(&c->lock, NULL);
+}
+
+void imgcache_shutdown(ImgCache *c)
+{
+	ImgCacheNode *n = c->head;
+	while (n)
+	{
+		ImgCacheNode *next = n->next;
+		image_free(&n->img);
+		pthread_mutex_destroy(&n->lock);
+		free(n);
+		n = next;
+	}
+	for (int i = 0; i < c->spare_count; i++) free(c->spare[i].px);
+	pthread_mutex_destroy(&c->lock);
+	memset(c, 0, sizeof(*c));
+}
+
+void imgcache_next_gen(ImgCache *c)
+{
+	pthread_mutex_lock(&c->lock);
+	c->gen++;
+	pthread_mutex_unlock(&c->lock);
+}
+
+// Takes the smallest spare buffer that holds size bytes. If none does, the
+// largest is dropped instead, so buffers are only kept for as many images as
+// are decoded at once.
+static ImageBuf imgcache_take_spare(ImgCache *c, size_t size)
+{
+	ImageBuf ret = {0};
+	pthread_mutex_lock(&c->lock);
+	int best = -1;
+	int largest = -1;
+	for (int i = 0; i < c->spare_count; i++)
+	{
+		const size_t spare_size = c->spare[i].size;
+		if (spare_size >= size && (best < 0 || spare_size < c->spare[best].size)) best = i;
+		if (largest < 0 || spare_size > c->spare[largest].size) largest = i;
+	}
+	const int idx = (best >= 0) ? best : largest;
+	if (idx >= 0)
+	{
+		ret = c->spare[idx];
+		c->spare[idx] = c->spare[--c->spare_count];
+	}
+	pthread_mutex_unlock(&c->lock);
+
+	if (best < 0 && ret.px)
+	{
+		free(ret.px);
+		ret.px = NULL;
+		ret.size = 0;
+	}
+	return ret;
+}
+
+static void imgcache_keep_spare(ImgCache *c, ImageBuf buf)
+{
+	if (!buf.px) return;
+	pthread_mutex_lock(&c->lock);
+	if (c->spare_count < IMGCACHE_SPARE_MAX)
+	{
+		c->spare[c->spare_count++] = buf;
+		buf.px = NULL;
+	}
+	pthread_mutex_unlock(&c->lock);
+	free(buf.px);
+}
+
+// Releases a node's image, keeping its pixel buffer. Called with n locked.
+static void imgcache_release(ImgCache *c, ImgCacheNode *n)
+{
+	imgcache_keep_spare(c, image_take_buf(&n->img));
+	image_free(&n->img);
+}
+
+static ImgCacheNode *imgcache_find(ImgCache *c, const char *path, bool create)
+{
+	pthread_mutex_lock(&c->lock);
+	ImgCacheNode *n = c->head;
+	while (n && strcmp(n->path, path) != 0) n = n->next;
+	if (!n && create)
+	{
+		n = calloc(sizeof(*n), 1);
+		if (n)
+		{
+			snprintf(n->path, sizeof(n->path), "%s", path);
+			n->gen = c->gen;
+			pthread_mutex_init(&n->lock, NULL);
+			n->next = c->head;
+			c->head = n;
+		}
+	}
+	pthread_mutex_unlock(&c->lock);
+	return n;
+}
+
+void imgcache_expect(ImgCache *c, const char *path)
+{
+	ImgCacheNode *n = imgcache_find(c, path, true);
+	if (!n) return;
+	pthread_mutex_lock(&n->lock);
+	n->uses++;
+	pthread_mutex_unlock(&n->lock);
+}
+
+void imgcache_done(ImgCache *c, const char *path)
+{
+	ImgCacheNode *n = imgcache_find(c, path, false);
+	if (!n) return;
+	pthread_mutex_lock(&n->lock);
+	n->uses--;
+	if (n->uses <= 0 && !c->retain)
+	{
+		n->uses = 0;
+		imgcache_release(c, n);
+		n->valid = false;
+	}
+	pthread_mutex_unlock(&n->lock);
+}
+
+bool imgcache_sole_use(ImgCache *c, const char *path)
+{
+	ImgCacheNode *n = imgcache_find(c, path, false);
+	if (!n) return false;
+	pthread_mutex_lock(&n->lock);
+	const bool ret = (n->uses <= 1);
+	pthread_mutex_unlock(&n->lock);
+	return ret;
+}
+
+void imgcache_invalidate(ImgCache *c, const char *path)
+{
+	ImgCacheNode *n = imgcache_find(c, path, false);
+	if (!n) return;
+	pthread_mutex_lock(&n->lock);
+	n->valid = false;
+	pthread_mutex_unlock(&n->lock);
+}
+
+const Image *imgcache_get(ImgCache *c, const char *path, bool decode,
+                          unsigned int *error)
+{
+	ImgCacheNode *n = imgcache_find(c, path, true);
+	if (!n)
+	{
+		*error = 83;  // LodePNG: memory allocation failed.
+		return NULL;
+	}
+
+	pthread_mutex_lock(&n->lock);
+	if (n->valid && n->gen != c->gen && image_stale(&n->img)) n->valid = false;
+	n->gen = c->gen;
+
+	*error = 0;
+	if (!n->valid)
+	{
+		imgcache_release(c, n);
+		*error = image_load(&n->img, path, c->hash);
+		n->valid = (*error == 0);
+	}
+	if (!*error && decode && !n->img.px)
+	{
+		ImageBuf spare = imgcache_take_spare(c, image_px_size(&n->img));
+		*error = image_decode(&n->img, &spare, !c->skip_checksums, c->inflate);
+		imgcache_keep_spare(c, spare);
+	}
+	pthread_mutex_unlock(&n->lock);
+
+	return *error ? NULL : &n->img;
+}
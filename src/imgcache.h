@@ -0,0 +1,59 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include "image.h"
+
+//
+// Cache of source images, shared by all entries converted in a process.
+//
+// Images are looked up by path. Each one is checked against the file on disk
+// once per generation, and only read and decoded again if it has changed.
+// Lookups from worker threads are safe; an image is read at most once per
+// generation even if several entries ask for it at the same time.
+//
+// Unless retain is set, decoded pixel data is released as soon as every
+// entry expected to use an image is done with it. The pixel buffers of
+// released images are kept to decode later ones into.
+//
+
+#define IMGCACHE_SPARE_MAX 16
+
+typedef struct ImgCacheNode ImgCacheNode;
+
+typedef struct ImgCache
+{
+	ImgCacheNode *head;
+	unsigned int gen;      // Bumped to recheck images against the disk.
+	bool retain;           // Keep images after their last expected use.
+	bool skip_checksums;   // Don't check PNG CRCs and Adler-32 checksums.
+	bool hash;             // Hash file contents as they are read, for entry keys.
+	InflateBackend inflate;
+	ImageBuf spare[IMGCACHE_SPARE_MAX];  // Pixel buffers not in use.
+	int spare_count;
+	pthread_mutex_t lock;  // Guards the node list and spare buffers.
+} ImgCache;
+
+void imgcache_init(ImgCache *c);
+void imgcache_shutdown(ImgCache *c);
+
+// Starts a new generation, so every image is checked against the disk again.
+void imgcache_next_gen(ImgCache *c);
+
+// Notes that one more entry will use the image at path.
+void imgcache_expect(ImgCache *c, const char *path);
+
+// Notes that an entry is done with the image at path.
+void imgcache_done(ImgCache *c, const char *path);
+
+// True if no entry but the caller still expects to use the image at path.
+bool imgcache_sole_use(ImgCache *c, const char *path);
+
+// Forces the image at path to be read again on its next use.
+void imgcache_invalidate(ImgCache *c, const char *path);
+
+// Returns the image for path, read from disk if needed, and also decoded if
+// decode is set. Returns NULL and sets the LodePNG error code on failure.
+// The image stays valid and unchanged until the next generation.
+const Image *imgcache_get(ImgCache *c, const char *path, bool decode,
+                          unsigned int *error);
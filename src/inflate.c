@@ -0,0 +1,762 @@
+#include "inflate.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef USE_ZLIB
+#include <zlib.h>
+#endif  // USE_ZLIB
+
+enum
+{
+	INFLATE_HEADER,          // A block header is next.
+	INFLATE_STORED,
+	INFLATE_HUFFMAN,
+	INFLATE_DONE,
+};
+
+// Table entries: bits to drop in the low byte and the symbol in the top half.
+// An entry for a code longer than the first lookup instead gives where its
+// subtable starts, and how many more bits index it.
+#define INFLATE_ENTRY_SUB     0x0100
+#define INFLATE_ENTRY_INVALID 0x2000
+#define INFLATE_SUB_BITS(e) (((e) >> 9) & 15)
+
+// Room for a symbol: the longest match, and the bytes past it that copying
+// it a word at a time can write.
+#define INFLATE_ROOM (258 + 7)
+
+static const uint16_t k_len_base[29] =
+{
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
+	67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t k_len_extra[29] =
+{
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+	4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t k_dist_base[30] =
+{
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513,
+	769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t k_dist_extra[30] =
+{
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8,
+	8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+static const uint8_t k_clen_order[19] =
+{
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+//
+// Bit input. Past the end of the data, zeroes are read, and in_pos keeps
+// counting so that reading too far can be caught afterwards.
+//
+
+static inline void inflate_refill(InflateBits *b)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	if (b->in_pos + 8 <= b->in_size)
+	{
+		// Loads whole bytes up to 56-63 bits. The bits loaded above that are
+		// loaded again next time, with the same values.
+		uint64_t v;
+		memcpy(&v, &b->in[b->in_pos], sizeof(v));
+		b->bits |= v << b->bit_count;
+		b->in_pos += (63 - b->bit_count) >> 3;
+		b->bit_count |= 56;
+		return;
+	}
+#endif  // __BYTE_ORDER__
+	while (b->bit_count <= 56)
+	{
+		const uint64_t v = (b->in_pos < b->in_size) ? b->in[b->in_pos] : 0;
+		b->bits |= v << b->bit_count;
+		b->in_pos++;
+		b->bit_count += 8;
+	}
+}
+
+static inline uint32_t inflate_bits(InflateBits *b, unsigned int n)
+{
+	const uint32_t ret = b->bits & ((1ULL << n) - 1);
+	b->bits >>= n;
+	b->bit_count -= n;
+	return ret;
+}
+
+// True if n more bits would go past the end of the data.
+static inline bool inflate_short(const InflateBits *b, size_t n)
+{
+	const size_t used = (b->in_pos * 8) - b->bit_count;
+	return used + n > b->in_size * 8;
+}
+
+// Reads a symbol with at least 15 bits loaded.
+static inline uint32_t inflate_decode(InflateBits *b, const uint32_t *table, unsigned int root)
+{
+	uint32_t e = table[b->bits & ((1u << root) - 1)];
+	if (e & INFLATE_ENTRY_SUB)
+	{
+		inflate_bits(b, root);
+		e = table[(e >> 16) + (b->bits & ((1u << INFLATE_SUB_BITS(e)) - 1))];
+	}
+	inflate_bits(b, e & 0xFF);
+	return e;
+}
+
+static unsigned int inflate_reverse(unsigned int code, unsigned int len)
+{
+	unsigned int ret = 0;
+	for (unsigned int i = 0; i < len; i++)
+	{
+		ret = (ret << 1) | (code & 1);
+		code >>= 1;
+	}
+	return ret;
+}
+
+// Builds the table for count code lengths. As in LodePNG, the code has to be
+// complete, unless there is at most one symbol; bits that don't make a code
+// look up an invalid entry.
+static bool inflate_build(uint32_t *table, size_t table_size, unsigned int root,
+                          const uint8_t *lens, int count)
+{
+	int len_count[16] = {0};
+	for (int i = 0; i < count; i++) len_count[lens[i]]++;
+	len_count[0] = 0;
+
+	int left = 1;
+	int present = 0;
+	unsigned int next[16];
+	unsigned int code = 0;
+	for (int l = 1; l < 16; l++)
+	{
+		left = (left << 1) - len_count[l];
+		if (left < 0) return false;
+		present += len_count[l];
+		code = (code + len_count[l - 1]) << 1;
+		next[l] = code;
+	}
+	if (left > 0 && present >= 2) return false;
+
+	unsigned int codes[288];
+	uint8_t sub_len[1 << INFLATE_LIT_BITS] = {0};
+	const unsigned int mask = (1u << root) - 1;
+	for (int i = 0; i < count; i++)
+	{
+		const unsigned int l = lens[i];
+		if (l == 0) continue;
+		codes[i] = inflate_reverse(next[l]++, l);
+		if (l > root && l > sub_len[codes[i] & mask]) sub_len[codes[i] & mask] = l;
+	}
+
+	// Lay out the subtables after the first lookup.
+	size_t used = (size_t)1 << root;
+	for (size_t i = 0; i <= mask; i++)
+	{
+		table[i] = INFLATE_ENTRY_INVALID;
+		if (!sub_len[i]) continue;
+		const unsigned int bits = sub_len[i] - root;
+		if (used + ((size_t)1 << bits) > table_size) return false;
+		table[i] = (uint32_t)(used << 16) | INFLATE_ENTRY_SUB | (bits << 9) | root;
+		for (size_t j = 0; j < ((size_t)1 << bits); j++) table[used + j] = INFLATE_ENTRY_INVALID;
+		used += (size_t)1 << bits;
+	}
+
+	for (int i = 0; i < count; i++)
+	{
+		const unsigned int l = lens[i];
+		if (l == 0) continue;
+		const unsigned int rev = codes[i];
+		if (l <= root)
+		{
+			for (unsigned int j = 0; j < (1u << (root - l)); j++)
+			{
+				table[rev | (j << l)] = ((uint32_t)i << 16) | l;
+			}
+			continue;
+		}
+		const uint32_t sub = table[rev & mask];
+		const unsigned int sub_bits = INFLATE_SUB_BITS(sub);
+		const unsigned int rest = l - root;
+		for (unsigned int j = 0; j < (1u << (sub_bits - rest)); j++)
+		{
+			table[(sub >> 16) + ((rev >> root) | (j << rest))] = ((uint32_t)i << 16) | rest;
+		}
+	}
+	return true;
+}
+
+static unsigned int inflate_fixed(Inflate *z)
+{
+	uint8_t lens[288];
+	for (int i = 0; i < 144; i++) lens[i] = 8;
+	for (int i = 144; i < 256; i++) lens[i] = 9;
+	for (int i = 256; i < 280; i++) lens[i] = 7;
+	for (int i = 280; i < 288; i++) lens[i] = 8;
+	inflate_build(z->lit, INFLATE_LIT_TABLE, INFLATE_LIT_BITS, lens, 288);
+	memset(lens, 5, 32);
+	inflate_build(z->dist, INFLATE_DIST_TABLE, INFLATE_DIST_BITS, lens, 32);
+	return 0;
+}
+
+// Reads the code lengths of a dynamic block, themselves Huffman coded.
+static unsigned int inflate_dynamic(Inflate *z)
+{
+	if (inflate_short(&z->br, 14)) return 49;
+	inflate_refill(&z->br);
+	const int hlit = inflate_bits(&z->br, 5) + 257;
+	const int hdist = inflate_bits(&z->br, 5) + 1;
+	const int hclen = inflate_bits(&z->br, 4) + 4;
+
+	if (inflate_short(&z->br, hclen * 3)) return 50;
+	uint8_t clens[19] = {0};
+	for (int i = 0; i < hclen; i++)
+	{
+		inflate_refill(&z->br);
+		clens[k_clen_order[i]] = inflate_bits(&z->br, 3);
+	}
+	uint32_t ctable[1 << 7];
+	if (!inflate_build(ctable, 1 << 7, 7, clens, 19)) return 55;
+
+	uint8_t lens[288 + 32] = {0};
+	int i = 0;
+	while (i < hlit + hdist)
+	{
+		inflate_refill(&z->br);
+		const uint32_t e = inflate_decode(&z->br, ctable, 7);
+		const uint32_t sym = e >> 16;
+		if (e & INFLATE_ENTRY_INVALID) return 16;
+		if (sym < 16)
+		{
+			lens[i++] = sym;
+		}
+		else
+		{
+			uint8_t value = 0;
+			int rep;
+			if (sym == 16)
+			{
+				if (i == 0) return 54;
+				value = lens[i - 1];
+				rep = 3 + inflate_bits(&z->br, 2);
+			}
+			else if (sym == 17)
+			{
+				rep = 3 + inflate_bits(&z->br, 3);
+			}
+			else
+			{
+				rep = 11 + inflate_bits(&z->br, 7);
+			}
+			if (i + rep > hlit + hdist) return 13;
+			memset(&lens[i], value, rep);
+			i += rep;
+		}
+		if (inflate_short(&z->br, 0)) return 50;
+	}
+	if (lens[256] == 0) return 64;
+
+	uint8_t dlens[32] = {0};
+	memcpy(dlens, &lens[hlit], hdist);
+	memset(&lens[hlit], 0, hdist);
+	if (!inflate_build(z->lit, INFLATE_LIT_TABLE, INFLATE_LIT_BITS, lens, 288)) return 55;
+	if (!inflate_build(z->dist, INFLATE_DIST_TABLE, INFLATE_DIST_BITS, dlens, 32)) return 55;
+	return 0;
+}
+
+static unsigned int inflate_header(Inflate *z)
+{
+	if (inflate_short(&z->br, 3)) return 52;
+	inflate_refill(&z->br);
+	z->last = inflate_bits(&z->br, 1);
+	const uint32_t type = inflate_bits(&z->br, 2);
+	switch (type)
+	{
+		case 0:
+		{
+			// Stored data starts at the next byte; drop the bits loaded ahead.
+			inflate_bits(&z->br, z->br.bit_count & 7);
+			const size_t pos = z->br.in_pos - (z->br.bit_count >> 3);
+			z->br.bits = 0;
+			z->br.bit_count = 0;
+			if (pos + 4 >= z->br.in_size) return 52;
+			const uint8_t *d = &z->br.in[pos];
+			const unsigned int len = d[0] | (d[1] << 8);
+			const unsigned int nlen = d[2] | (d[3] << 8);
+			if (len + nlen != 65535) return 21;
+			if (pos + 4 + len > z->br.in_size) return 23;
+			z->br.in_pos = pos + 4;
+			z->stored_left = len;
+			z->state = INFLATE_STORED;
+			return 0;
+		}
+		case 1:
+			z->state = INFLATE_HUFFMAN;
+			return inflate_fixed(z);
+		case 2:
+			z->state = INFLATE_HUFFMAN;
+			return inflate_dynamic(z);
+		default:
+			return 20;
+	}
+}
+
+// Decodes symbols of a Huffman block into out until it ends or out is too
+// full to be sure of fitting another.
+static unsigned int inflate_huffman(Inflate *z, uint8_t *out, size_t *pos_io, size_t cap)
+{
+	// The bit input is kept in a local copy; stores to out would otherwise
+	// have it reloaded after every byte.
+	InflateBits br = z->br;
+	const uint32_t *lit = z->lit;
+	const uint32_t *dist_table = z->dist;
+	const uint64_t base = z->base;
+	size_t pos = *pos_io;
+	unsigned int error = 0;
+	while (pos + INFLATE_ROOM <= cap)
+	{
+		inflate_refill(&br);
+		uint32_t e = inflate_decode(&br, lit, INFLATE_LIT_BITS);
+		uint32_t sym = e >> 16;
+		if (e & INFLATE_ENTRY_INVALID)
+		{
+			error = 16;
+			break;
+		}
+		if (sym < 256)
+		{
+			out[pos++] = sym;
+			// Runs of literals are common. A refill leaves at least 41 bits
+			// after the first, enough for four more that fit the first lookup.
+			for (int i = 0; i < 4; i++)
+			{
+				e = lit[br.bits & ((1u << INFLATE_LIT_BITS) - 1)];
+				if (e >= (256u << 16) || (e & (INFLATE_ENTRY_SUB | INFLATE_ENTRY_INVALID))) break;
+				inflate_bits(&br, e & 0xFF);
+				out[pos++] = e >> 16;
+			}
+		}
+		else if (sym == 256)
+		{
+			z->state = z->last ? INFLATE_DONE : INFLATE_HEADER;
+		}
+		else if (sym - 257 >= 29)
+		{
+			error = 16;
+			break;
+		}
+		else
+		{
+			sym -= 257;
+			const size_t len = k_len_base[sym] + inflate_bits(&br, k_len_extra[sym]);
+			e = inflate_decode(&br, dist_table, INFLATE_DIST_BITS);
+			sym = e >> 16;
+			if (e & INFLATE_ENTRY_INVALID)
+			{
+				error = 16;
+				break;
+			}
+			if (sym >= 30)
+			{
+				error = 18;
+				break;
+			}
+			const size_t dist = k_dist_base[sym] + inflate_bits(&br, k_dist_extra[sym]);
+			if (dist > base + pos)
+			{
+				error = 52;
+				break;
+			}
+			uint8_t *d = &out[pos];
+			const uint8_t *s = d - dist;
+			const uint8_t *end = d + len;
+			pos += len;
+			if (dist >= 8)
+			{
+				// Whole words at a time, running up to 7 bytes past the match.
+				do
+				{
+					uint64_t v;
+					memcpy(&v, s, sizeof(v));
+					memcpy(d, &v, sizeof(v));
+					d += 8;
+					s += 8;
+				} while (d < end);
+			}
+			else if (dist == 1)
+			{
+				memset(d, *s, len);
+			}
+			else
+			{
+				while (d < end) *d++ = *s++;
+			}
+		}
+
+		if (br.in_pos > br.in_size && inflate_short(&br, 0))
+		{
+			error = 51;
+			break;
+		}
+		if (z->state != INFLATE_HUFFMAN) break;
+	}
+	z->br = br;
+	*pos_io = pos;
+	return error;
+}
+
+// Decodes into out[*pos_io, cap). Output before *pos_io is what matches can
+// refer back to.
+static unsigned int inflate_run(Inflate *z, uint8_t *out, size_t *pos_io, size_t cap)
+{
+	unsigned int error = 0;
+	while (!error && z->state != INFLATE_DONE && *pos_io + INFLATE_ROOM <= cap)
+	{
+		switch (z->state)
+		{
+			case INFLATE_HEADER:
+				error = inflate_header(z);
+				break;
+
+			case INFLATE_STORED:
+			{
+				size_t n = cap - *pos_io;
+				if (n > z->stored_left) n = z->stored_left;
+				memcpy(&out[*pos_io], &z->br.in[z->br.in_pos], n);
+				*pos_io += n;
+				z->br.in_pos += n;
+				z->stored_left -= n;
+				break;
+			}
+
+			case INFLATE_HUFFMAN:
+				error = inflate_huffman(z, out, pos_io, cap);
+				break;
+		}
+		if (z->state == INFLATE_STORED && z->stored_left == 0)
+		{
+			z->state = z->last ? INFLATE_DONE : INFLATE_HEADER;
+		}
+	}
+	return error;
+}
+
+static uint32_t inflate_adler(uint32_t adler, const uint8_t *d, size_t len)
+{
+	uint32_t a = adler & 0xFFFF;
+	uint32_t b = adler >> 16;
+	while (len > 0)
+	{
+		// The most bytes that can be summed before b could overflow.
+		size_t n = (len < 5552) ? len : 5552;
+		len -= n;
+		// 32 bytes add 32 times a to b, plus each byte once for every sum
+		// of a it is part of. Written out this way, the loop vectorizes.
+		for (; n >= 32; n -= 32, d += 32)
+		{
+			uint32_t sum = 0;
+			uint32_t weighted = 0;
+			for (int i = 0; i < 32; i++)
+			{
+				sum += d[i];
+				weighted += (32 - i) * d[i];
+			}
+			b += (a * 32) + weighted;
+			a += sum;
+		}
+		while (n--)
+		{
+			a += *d++;
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+	}
+	return (b << 16) | a;
+}
+
+// Checks the zlib header, and gets ready to decode the first block.
+static unsigned int inflate_init(Inflate *z, const uint8_t *in, size_t size, bool verify)
+{
+	memset(z, 0, sizeof(*z));
+	if (size < 2) return 53;
+	if (((in[0] * 256) + in[1]) % 31 != 0) return 24;
+	if ((in[0] & 15) != 8 || (in[0] >> 4) > 7) return 25;
+	if (in[1] & 0x20) return 26;  // Preset dictionary.
+
+	z->br.in = &in[2];
+	z->br.in_size = size - 2;
+	z->state = INFLATE_HEADER;
+	z->verify = verify;
+	z->adler = 1;
+	if (size >= 4)
+	{
+		const uint8_t *d = &in[size - 4];
+		z->adler_want = ((uint32_t)d[0] << 24) | ((uint32_t)d[1] << 16) | ((uint32_t)d[2] << 8) | d[3];
+	}
+	return 0;
+}
+
+unsigned int inflate_begin(Inflate *z, const uint8_t *in, size_t size, bool verify)
+{
+	const unsigned int error = inflate_init(z, in, size, verify);
+	if (error) return error;
+	z->win = malloc(INFLATE_WIN_SIZE);
+	if (!z->win) return 83;
+	return 0;
+}
+
+// Makes room for at least a match past the end of the window, keeping the
+// history. Only called once everything in it has been read.
+static void inflate_slide(Inflate *z)
+{
+	if (z->win_fill + INFLATE_ROOM <= INFLATE_WIN_SIZE) return;
+	const size_t drop = z->win_fill - INFLATE_HISTORY;
+	memmove(z->win, &z->win[drop], INFLATE_HISTORY);
+	z->base += drop;
+	z->win_fill = INFLATE_HISTORY;
+	z->win_read = INFLATE_HISTORY;
+}
+
+unsigned int inflate_read(Inflate *z, uint8_t *out, size_t len)
+{
+	while (len > 0)
+	{
+		const size_t avail = z->win_fill - z->win_read;
+		if (avail == 0)
+		{
+			if (z->state == INFLATE_DONE) return 91;  // Less data than expected.
+			inflate_slide(z);
+			const unsigned int error = inflate_run(z, z->win, &z->win_fill, INFLATE_WIN_SIZE);
+			if (error) return error;
+			continue;
+		}
+		const size_t n = (avail < len) ? avail : len;
+		const uint8_t *src = &z->win[z->win_read];
+		memcpy(out, src, n);
+		if (z->verify) z->adler = inflate_adler(z->adler, src, n);
+		z->win_read += n;
+		out += n;
+		len -= n;
+	}
+	return 0;
+}
+
+unsigned int inflate_end(Inflate *z)
+{
+	// Any more output would be more than expected.
+	if (z->win_fill != z->win_read) return 91;
+	while (z->state != INFLATE_DONE)
+	{
+		inflate_slide(z);
+		const size_t fill = z->win_fill;
+		const unsigned int error = inflate_run(z, z->win, &z->win_fill, INFLATE_WIN_SIZE);
+		if (error) return error;
+		if (z->win_fill != fill) return 91;
+	}
+	if (z->verify && (z->br.in_size < 2 || z->adler != z->adler_want)) return 58;
+	return 0;
+}
+
+void inflate_free(Inflate *z)
+{
+	free(z->win);
+	z->win = NULL;
+}
+
+// Room for the output to start with. Deflate can't expand data more than
+// 1032 times, so a hint past that comes from a bad header, and is not kept.
+static size_t inflate_start_size(size_t size, size_t size_hint)
+{
+	const size_t most = (size * 1032) + 1;
+	if (size_hint && size_hint <= most) return size_hint;
+	return size * 4;
+}
+
+// Inflates the whole stream straight into one buffer, which is all history.
+static unsigned int inflate_fast(uint8_t **out, size_t *out_size, const uint8_t *in,
+                                 size_t size, size_t size_hint, bool verify)
+{
+	Inflate *z = malloc(sizeof(*z));
+	if (!z) return 83;
+	unsigned int error = inflate_init(z, in, size, verify);
+	size_t cap = inflate_start_size(size, size_hint) + INFLATE_ROOM;
+	uint8_t *buf = error ? NULL : malloc(cap);
+	if (!error && !buf) error = 83;
+	size_t pos = 0;
+	while (!error && z->state != INFLATE_DONE)
+	{
+		if (pos + INFLATE_ROOM > cap)
+		{
+			cap *= 2;
+			uint8_t *grown = realloc(buf, cap);
+			if (!grown)
+			{
+				error = 83;
+				break;
+			}
+			buf = grown;
+		}
+		error = inflate_run(z, buf, &pos, cap);
+	}
+	if (!error && verify && (z->br.in_size < 2 || inflate_adler(1, buf, pos) != z->adler_want))
+	{
+		error = 58;
+	}
+	free(z);
+	if (error)
+	{
+		free(buf);
+		return error;
+	}
+	*out = buf;
+	*out_size = pos;
+	return 0;
+}
+
+#ifdef USE_ZLIB
+// Inflates with zlib, checking the header and checksum as LodePNG does. Any
+// stream LodePNG might treat differently is failed, to leave it to LodePNG.
+static unsigned int inflate_system(uint8_t **out, size_t *out_size, const uint8_t *in,
+                                   size_t size, size_t size_hint, bool verify)
+{
+	Inflate *z = malloc(sizeof(*z));
+	if (!z) return 83;
+	unsigned int error = inflate_init(z, in, size, verify);
+	const uint32_t adler_want = z->adler_want;
+	free(z);
+	if (error) return error;
+	// LodePNG checks the checksum in the last four bytes, wherever the
+	// deflate data ends, so the data must not reach into them.
+	if (size < 6 || size - 2 > UINT_MAX) return 1;
+
+	z_stream zs;
+	memset(&zs, 0, sizeof(zs));
+	if (inflateInit2(&zs, -15) != Z_OK) return 83;
+	zs.next_in = (Bytef *)&in[2];
+	zs.avail_in = size - 2;
+	size_t cap = inflate_start_size(size, size_hint);
+	uint8_t *buf = malloc(cap);
+	size_t pos = 0;
+	int ret = buf ? Z_OK : Z_MEM_ERROR;
+	while (ret == Z_OK)
+	{
+		if (pos == cap)
+		{
+			cap *= 2;
+			uint8_t *grown = realloc(buf, cap);
+			if (!grown)
+			{
+				ret = Z_MEM_ERROR;
+				break;
+			}
+			buf = grown;
+		}
+		const size_t room = cap - pos;
+		zs.next_out = &buf[pos];
+		zs.avail_out = (room > UINT_MAX) ? UINT_MAX : room;
+		const unsigned int avail = zs.avail_out;
+		ret = inflate(&zs, Z_NO_FLUSH);
+		pos += avail - zs.avail_out;
+	}
+	const size_t used = zs.total_in;
+	inflateEnd(&zs);
+
+	if (ret != Z_STREAM_END) error = (ret == Z_MEM_ERROR) ? 83 : 1;
+	else if (used > size - 6) error = 1;
+	else if (verify && inflate_adler(1, buf, pos) != adler_want) error = 58;
+	if (error)
+	{
+		free(buf);
+		return error;
+	}
+	*out = buf;
+	*out_size = pos;
+	return 0;
+}
+#endif  // USE_ZLIB
+
+static const char *kstring_for_inflate_backend[INFLATE_BACKEND_COUNT] =
+{
+	[INFLATE_BACKEND_FAST] = "fast",
+	[INFLATE_BACKEND_LODEPNG] = "lodepng",
+	[INFLATE_BACKEND_ZLIB] = "zlib",
+};
+
+InflateBackend inflate_backend_for_string(const char *str)
+{
+	for (int i = 0; i < INFLATE_BACKEND_COUNT; i++)
+	{
+		if (strcmp(str, kstring_for_inflate_backend[i]) != 0) continue;
+#ifndef USE_ZLIB
+		if (i == INFLATE_BACKEND_ZLIB) break;
+#endif  // USE_ZLIB
+		return (InflateBackend)i;
+	}
+	return INFLATE_BACKEND_COUNT;
+}
+
+const char *inflate_string_for_backend(InflateBackend backend)
+{
+	if (backend < 0 || backend >= INFLATE_BACKEND_COUNT) return "";
+	return kstring_for_inflate_backend[backend];
+}
+
+unsigned int inflate_zlib(InflateBackend backend, uint8_t **out, size_t *out_size,
+                          const uint8_t *in, size_t size, size_t size_hint, bool verify)
+{
+	unsigned int error = 1;
+	switch (backend)
+	{
+		case INFLATE_BACKEND_FAST:
+			error = inflate_fast(out, out_size, in, size, size_hint, verify);
+			break;
+#ifdef USE_ZLIB
+		case INFLATE_BACKEND_ZLIB:
+			error = inflate_system(out, out_size, in, size, size_hint, verify);
+			break;
+#endif  // USE_ZLIB
+		default:
+			break;
+	}
+	if (!error) return 0;
+
+	LodePNGDecompressSettings settings;
+	lodepng_decompress_settings_init(&settings);
+	settings.ignore_adler32 = !verify;
+	*out = NULL;
+	*out_size = 0;
+	return lodepng_zlib_decompress(out, out_size, in, size, &settings);
+}
+
+static unsigned inflate_custom_zlib(unsigned char **out, size_t *out_size, const unsigned char *in,
+                                    size_t size, const LodePNGDecompressSettings *settings)
+{
+	// Text and ICC chunks are limited in size, and left to LodePNG.
+	if (*out_size || settings->max_output_size)
+	{
+		LodePNGDecompressSettings plain = *settings;
+		plain.custom_zlib = NULL;
+		return lodepng_zlib_decompress(out, out_size, in, size, &plain);
+	}
+	const InflateBackend *backend = settings->custom_context;
+	free(*out);
+	return inflate_zlib(*backend, out, out_size, in, size, 0, !settings->ignore_adler32);
+}
+
+void inflate_hook_lodepng(LodePNGDecompressSettings *settings, InflateBackend backend)
+{
+	static const InflateBackend k_backends[INFLATE_BACKEND_COUNT] =
+	{
+		INFLATE_BACKEND_FAST,
+		INFLATE_BACKEND_LODEPNG,
+		INFLATE_BACKEND_ZLIB,
+	};
+	if (backend == INFLATE_BACKEND_LODEPNG) return;
+	settings->custom_zlib = inflate_custom_zlib;
+	settings->custom_context = &k_backends[backend];
+}
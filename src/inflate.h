@@ -0,0 +1,98 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "lodepng.h"
+
+//
+// Inflate for zlib streams held whole in memory, such as PNG image data.
+//
+// Output is either taken a piece at a time, with only the last 32 KiB of it
+// kept for the stream to refer back to, so large images never have to be
+// held inflated all at once, or inflated whole by inflate_zlib(). Anything
+// LodePNG rejects is rejected here too, but a piece at a time, the error
+// codes are not always the same.
+//
+
+#define INFLATE_HISTORY 32768
+#define INFLATE_WIN_SIZE (INFLATE_HISTORY * 4)
+
+// Decoding tables: entries for the first bits of a code, then subtables for
+// codes longer than that.
+#define INFLATE_LIT_BITS 10
+#define INFLATE_LIT_TABLE 2048
+#define INFLATE_DIST_BITS 8
+#define INFLATE_DIST_TABLE 1024
+
+typedef struct InflateBits
+{
+	const uint8_t *in;       // Deflate data, after the zlib header.
+	size_t in_size;
+	size_t in_pos;           // Next byte to load; may run past the end.
+	uint64_t bits;           // Loaded bits, next one lowest.
+	unsigned int bit_count;
+} InflateBits;
+
+typedef struct Inflate
+{
+	InflateBits br;
+	int state;
+	bool last;               // The block being decoded is the last one.
+	size_t stored_left;      // Bytes left in a stored block.
+	uint32_t lit[INFLATE_LIT_TABLE];
+	uint32_t dist[INFLATE_DIST_TABLE];
+
+	uint8_t *win;            // Output not yet read, and the history before it.
+	size_t win_fill;
+	size_t win_read;
+	uint64_t base;           // Bytes output before win[0].
+
+	bool verify;
+	uint32_t adler;          // Adler-32 of the output read so far.
+	uint32_t adler_want;
+} Inflate;
+
+// Starts inflating the zlib stream in. Unless verify is set, the Adler-32
+// checksum at the end is not checked.
+// Returns a LodePNG error code, or 0 on success.
+unsigned int inflate_begin(Inflate *z, const uint8_t *in, size_t size, bool verify);
+
+// Reads the next len bytes of output into out. It is an error for the
+// stream to end first.
+unsigned int inflate_read(Inflate *z, uint8_t *out, size_t len);
+
+// Checks that the stream ends where reading stopped, and its checksum.
+unsigned int inflate_end(Inflate *z);
+
+void inflate_free(Inflate *z);
+
+//
+// Whole streams, with a choice of inflater.
+//
+
+typedef enum InflateBackend
+{
+	INFLATE_BACKEND_FAST,     // The table-driven inflater here.
+	INFLATE_BACKEND_LODEPNG,  // LodePNG's own.
+	INFLATE_BACKEND_ZLIB,     // The system's zlib; only built in with USE_ZLIB.
+	INFLATE_BACKEND_COUNT
+} InflateBackend;
+
+// Returns INFLATE_BACKEND_COUNT for a name that isn't one, or a backend
+// that wasn't built in.
+InflateBackend inflate_backend_for_string(const char *str);
+const char *inflate_string_for_backend(InflateBackend backend);
+
+// Inflates the zlib stream in into a new buffer, set in out. size_hint is
+// the size the output is expected to be, or 0 if it isn't known. Unless
+// verify is set, the Adler-32 checksum is not checked.
+// If the backend fails, LodePNG has the stream again, so whatever is
+// returned, including the error code, is what LodePNG alone would give.
+unsigned int inflate_zlib(InflateBackend backend, uint8_t **out, size_t *out_size,
+                          const uint8_t *in, size_t size, size_t size_hint, bool verify);
+
+// Hooks backend into LodePNG for the streams it inflates itself. LodePNG
+// reports any error from a hook as 110, so on that, decode again without it
+// for the real code.
+void inflate_hook_lodepng(LodePNGDecompressSettings *settings, InflateBackend backend);
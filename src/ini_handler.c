@@ -19,7 +19,7 @@ int ini_handler_func(void *user, const char *section, const char *name, const ch
 		s->symbol[sizeof(s->symbol)-1] = '\0';
 	}
 
-	// Setting the source is what actually kicks off the conversion for this entry.
+	// Setting the source is what actually queues the conversion for this entry.
 	if (strcmp("src", name) == 0)
 	{
 		strncpy(s->src, value, sizeof(s->src));
@@ -34,6 +34,7 @@ int ini_handler_func(void *user, const char *section, const char *name, const ch
 	else if (strcmp("code", name) == 0)
 	{
 		s->frame_cfg.code = strtoul(value, NULL, 0);
+		s->code_set = true;
 	}
 	else if (strcmp("angle", name) == 0)
 	{
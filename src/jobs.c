@@ -0,0 +1,71 @@
+#include "jobs.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define JOBS_THREADS_MAX 256
+
+typedef struct JobsState
+{
+	atomic_int next;  // Next job index to hand out.
+	int count;
+	JobFunc func;
+	void *ctx;
+} JobsState;
+
+static void *jobs_worker(void *arg)
+{
+	JobsState *js = (JobsState *)arg;
+	int idx;
+	while ((idx = atomic_fetch_add(&js->next, 1)) < js->count)
+	{
+		js->func(js->ctx, idx);
+	}
+	return NULL;
+}
+
+void jobs_run(int count, int threads, JobFunc func, void *ctx)
+{
+	if (count <= 0) return;
+	if (threads > count) threads = count;
+	if (threads > JOBS_THREADS_MAX) threads = JOBS_THREADS_MAX;
+
+	JobsState js;
+	atomic_init(&js.next, 0);
+	js.count = count;
+	js.func = func;
+	js.ctx = ctx;
+
+	if (threads <= 1)
+	{
+		jobs_worker(&js);
+		return;
+	}
+
+	// The calling thread takes part as well, so spawn one less.
+	pthread_t tid[JOBS_THREADS_MAX];
+	int spawned = 0;
+	for (int i = 0; i < threads - 1; i++)
+	{
+		if (pthread_create(&tid[spawned], NULL, jobs_worker, &js) != 0)
+		{
+			fprintf(stderr, "[JOBS] Couldn't create worker thread %d\n", i);
+			break;
+		}
+		spawned++;
+	}
+
+	jobs_worker(&js);
+
+	for (int i = 0; i < spawned; i++) pthread_join(tid[i], NULL);
+}
+
+int jobs_default_threads(void)
+{
+	const long n = sysconf(_SC_NPROCESSORS_ONLN);
+	if (n < 1) return 1;
+	if (n > JOBS_THREADS_MAX) return JOBS_THREADS_MAX;
+	return (int)n;
+}
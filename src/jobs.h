@@ -0,0 +1,16 @@
+#pragma once
+
+//
+// Minimal worker pool for running independent jobs in parallel.
+//
+
+// Job function; idx is in the range [0, count).
+typedef void (*JobFunc)(void *ctx, int idx);
+
+// Runs func(ctx, idx) for every idx in [0, count), spread across up to
+// `threads` worker threads. Returns once every job has finished.
+// If threads <= 1, the jobs are run in order on the calling thread.
+void jobs_run(int count, int threads, JobFunc func, void *ctx);
+
+// Number of online processors, for use when the job count is set to "auto".
+int jobs_default_threads(void);
@@ -36,6 +36,14 @@
 #include "format.h"
 #include "conv.h"
 #include "ini_handler.h"
+#include "jobs.h"
+#include "outfile.h"
+#include "imgcache.h"
+#include "palcache.h"
+#include "plan.h"
+#include "project.h"
+#include "stats.h"
+#include "watch.h"
 
 // =======
 // 
@@ -51,7 +59,7 @@
 // strongly recommended), output header filename (ditto), sprite size within
 // sheet, and most importantly the source filename.
 //
-// When the line "src" is read, it kicks off the conversion
+// When the line "src" is read, it queues the conversion
 // using whatever parameters are set. It's OK to start a new sprite section and
 // only change parameters that are different from the last one. Similarly, it is
 // OK to create a section that only sets parameters and doesn't actually start a
@@ -62,6 +70,8 @@
 // * a .pal file containing palette data
 // * a .h file for a C header with offsets defined (also GNU AS compatible)
 // * a .inc file for an assembly file with offset definitions
+// * a .map file with mapping data for composite formats
+// * a .d file with a make rule listing the script and images as dependencies
 //
 // Valid options, with example params:
 //
@@ -74,100 +84,98 @@
 // h = 16
 // src = sprite.png
 
-int main(int argc, char **argv)
+static void print_usage(const char *prog)
 {
-	int ret = -1;
-	if (argc < 2)
-	{
-		printf("Usage: %s CONFIG\n", argv[0]);
-		return -1;
-	}
+	printf("Usage: %s [options] CONFIG\n", prog);
+	printf("       %s [options] --project FILE\n", prog);
+	printf("  -j N               Convert entries using N worker threads (0 = one per CPU)\n");
+	printf("  --cache DIR        Reuse converted entries stored in DIR\n");
+	printf("  --if-changed       Only replace outputs whose contents changed\n");
+	printf("  --check            Write nothing; exit 1 if any output would change\n");
+	printf("  --watch            Rebuild whenever the script or its images change\n");
+	printf("  --project FILE     Build every script listed in FILE\n");
+	printf("  --plan             Report codes, offsets and sizes from image headers only\n");
+	printf("  --skip-checksums   Don't verify PNG CRCs and Adler-32 checksums\n");
+	printf("  --low-memory       Decode images a row of frames at a time where possible\n");
+	printf("  --inflate NAME     Inflate PNG image data with fast (default), lodepng or zlib\n");
+	printf("  --stats            Print time spent and data produced for each entry\n");
+	printf("  --stats-json FILE  Write the same statistics to FILE as JSON\n");
+	printf("  --trace FILE       Write a Chrome trace event timeline to FILE\n");
+}
 
-	Conv conv;
-	if (!conv_init(&conv))
-	{
-		fprintf(stderr, "Couldn't initialize CONV\n");
-		return -1;
-	};
+// Opens the CHR output ahead of conversion. With stream set, entries write
+// their CHR into it as they are placed and don't keep it around afterwards.
+static bool emit_begin(Conv *conv, OutMode out_mode, bool stream)
+{
+	char fname_buf[512];
+	snprintf(fname_buf, sizeof(fname_buf), "%s.chr", conv->out);
+	if (!outfile_open(&conv->out_chr, fname_buf, out_mode)) return false;
+	conv->stream_chr = stream;
+	return true;
+}
 
-	// the actual conversion is kicked off in the INI handler, when `convert` is set.
-	ret = ini_parse(argv[1], &ini_handler_func, &conv);
-	if (ret)
-	{
-		fprintf(stderr, "Error parsing \"%s\".\n", argv[0]);
-		return -1;
-	}
+// Writes all of the output files for a converted script, finishing the CHR
+// output opened by emit_begin().
+static int emit_outputs(Conv *conv, const char *config_fname, OutMode out_mode)
+{
+	int ret = 0;
 
 	// Now emit a pile of CHR data
 	char fname_buf[512];
 
-	FILE *f_chr = NULL;  // CHR rom data
-	FILE *f_pal = NULL;  // Palette data
-	FILE *f_map = NULL;  // Mapping data
-	FILE *f_inc = NULL;  // Macro Assembler AS header / inc
-	FILE *f_hdr = NULL;  // GNU AS assembly / GCC C header
+	OutFile out_pal = {0};  // Palette data
+	OutFile out_map = {0};  // Mapping data
+	OutFile out_inc = {0};  // Macro Assembler AS header / inc
+	OutFile out_hdr = {0};  // GNU AS assembly / GCC C header
+	OutFile out_dep = {0};  // Makefile dependency rule
+	OutFile *outs[] = {&conv->out_chr, &out_pal, &out_map, &out_inc, &out_hdr, &out_dep};
+	static const char *k_out_ext[] = {"chr", "pal", "map", "inc", "h", "d"};
 
-	snprintf(fname_buf, sizeof(fname_buf), "%s.chr", conv.out);
-	f_chr = fopen(fname_buf, "wb");
-	if (!f_chr)
+	for (size_t i = 1; i < sizeof(outs) / sizeof(outs[0]); i++)
 	{
-		fprintf(stderr, "Couldn't open %s for writing\n", fname_buf);
-		ret = -1;
-		goto done;
-	}
-
-	snprintf(fname_buf, sizeof(fname_buf), "%s.pal", conv.out);
-	f_pal = fopen(fname_buf, "wb");
-	if (!f_pal)
-	{
-		fprintf(stderr, "Couldn't open %s for writing\n", fname_buf);
-		ret = -1;
-		goto done;
+		snprintf(fname_buf, sizeof(fname_buf), "%s.%s", conv->out, k_out_ext[i]);
+		if (!outfile_open(outs[i], fname_buf, out_mode))
+		{
+			ret = -1;
+			goto done;
+		}
 	}
 
-	snprintf(fname_buf, sizeof(fname_buf), "%s.map", conv.out);
-	f_map = fopen(fname_buf, "wb");
-	if (!f_map)
-	{
-		fprintf(stderr, "Couldn't open %s for writing\n", fname_buf);
-		ret = -1;
-		goto done;
-	}
+	Writer *w_chr = &conv->out_chr.w;
+	Writer *w_pal = &out_pal.w;
+	Writer *w_map = &out_map.w;
+	FILE *f_inc = out_inc.f;
+	FILE *f_hdr = out_hdr.f;
+	FILE *f_dep = out_dep.f;
 
-	snprintf(fname_buf, sizeof(fname_buf), "%s.inc", conv.out);
-	f_inc = fopen(fname_buf, "wb");
-	if (!f_inc)
-	{
-		fprintf(stderr, "Couldn't open %s for writing\n", fname_buf);
-		ret = -1;
-		goto done;
-	}
+	entry_emit_header_top(f_inc, false);
+	entry_emit_header_top(f_hdr, true);
 
-	snprintf(fname_buf, sizeof(fname_buf), "%s.h", conv.out);
-	f_hdr = fopen(fname_buf, "wb");
-	if (!f_hdr)
+	// Unless it was streamed during conversion.
+	if (!conv->stream_chr && !conv_pack_chr(conv, w_chr))
 	{
-		fprintf(stderr, "Couldn't open %s for writing\n", fname_buf);
 		ret = -1;
 		goto done;
 	}
 
-	entry_emit_header_top(f_inc, false);
-	entry_emit_header_top(f_hdr, true);
-
 	bool formats_used[DATA_FORMAT_COUNT] = {false};
 
-	Entry *e = conv.entry_head;
+	Entry *e = conv->entry_head;
 	int pal_offs = 0;
 	while (e)
 	{
 		printf("Entry $%03X \"%s\": %d x %d, %d frames/tiles\n",
 		       e->id, e->symbol, e->frame_cfg.w, e->frame_cfg.h, e->frames);
-		entry_emit_pal(e, f_pal, &pal_offs);
+		const uint64_t phase_start = stats_now();
+		const size_t pal_start = writer_tell(w_pal);
+		const size_t map_start = writer_tell(w_map);
+		entry_emit_pal(e, w_pal, &pal_offs);
 		entry_emit_meta(e, f_inc, e->pal_block_offs, false);
 		entry_emit_meta(e, f_hdr, e->pal_block_offs, true);
-		entry_emit_chr(e, f_chr);
-		entry_emit_map(e, f_map);
+		entry_emit_map(e, w_map);
+		e->stats.pal_bytes = writer_tell(w_pal) - pal_start;
+		e->stats.map_bytes = writer_tell(w_map) - map_start;
+		stats_phase(&e->stats, STATS_PHASE_META, phase_start);
 
 		formats_used[e->frame_cfg.data_format] = true;
 
@@ -188,18 +196,485 @@ int main(int argc, char **argv)
 		entry_emit_type_decl(f_hdr, fmt, true);
 	}
 
-	entry_emit_header_data_decl(f_hdr, pal_offs, conv.map_pos, conv.out, true);
-	entry_emit_header_chr_size(f_hdr, conv.out, ftell(f_chr));
+	entry_emit_header_data_decl(f_hdr, pal_offs, conv->map_pos, conv->out, true);
+	entry_emit_header_chr_size(f_hdr, conv->out, writer_tell(w_chr));
+
+	entry_emit_depfile(f_dep, conv->out, k_out_ext, sizeof(k_out_ext) / sizeof(k_out_ext[0]),
+	                   config_fname, conv->entry_head);
 
 done:
-	if (f_chr) fclose(f_chr);
-	if (f_pal) fclose(f_pal);
-	if (f_map) fclose(f_map);
-	if (f_inc) fclose(f_inc);
-	if (f_hdr) fclose(f_hdr);
-	conv_shutdown(&conv);
+	// Outputs are only put in place once everything has been emitted.
+	bool out_of_date = false;
+	for (size_t i = 0; i < sizeof(outs) / sizeof(outs[0]); i++)
+	{
+		if (ret != 0)
+		{
+			outfile_abort(outs[i]);
+			continue;
+		}
+
+		const int changed = outfile_close(outs[i]);
+		if (changed < 0)
+		{
+			ret = -1;
+		}
+		else if (changed > 0 && out_mode == OUT_MODE_CHECK)
+		{
+			fprintf(stderr, "%s is out of date.\n", outs[i]->fname);
+			out_of_date = true;
+		}
+	}
+	if (ret == 0 && out_of_date) ret = 1;
+
+	return ret;
+}
+
+typedef struct Options
+{
+	const char *config_fname;
+	const char *project_fname;
+	int jobs;
+	const char *cache_dir;
+	OutMode out_mode;
+	bool watch;
+	bool plan;
+	bool skip_checksums;
+	bool low_memory;
+	InflateBackend inflate;
+	bool stats;
+	const char *stats_json_fname;
+	const char *trace_fname;
+} Options;
+
+// Reports statistics for the scripts just built, as the options ask.
+static int report_stats(const Options *opt, const StatsScript *scripts, int count,
+                        uint64_t start)
+{
+	const uint64_t wall_ns = stats_now() - start;
+	int ret = 0;
+	if (opt->stats) stats_print(stdout, scripts, count, wall_ns);
+	if (opt->stats_json_fname && !stats_write_json(opt->stats_json_fname, scripts, count, wall_ns))
+	{
+		ret = -1;
+	}
+	if (opt->trace_fname && !stats_write_trace(opt->trace_fname, scripts, count)) ret = -1;
+	return ret;
+}
+
+// Sets up conv and parses a script into it, queueing its entries. The caller
+// shuts down conv afterwards either way.
+static bool build_parse(const Options *opt, const char *config_fname, Conv *conv,
+                        ImgCache *imgcache, PalCache *palcache, Entry *prev_head)
+{
+	if (!conv_init(conv))
+	{
+		fprintf(stderr, "Couldn't initialize CONV\n");
+		return false;
+	};
+	conv->jobs = opt->jobs;
+	conv->stream_rows = opt->low_memory;
+	if (opt->cache_dir)
+	{
+		strncpy(conv->cache_dir, opt->cache_dir, sizeof(conv->cache_dir));
+		conv->cache_dir[sizeof(conv->cache_dir)-1] = '\0';
+	}
+	conv->imgcache = imgcache;
+	conv->palcache = palcache;
+	conv->prev_head = prev_head;
+	conv->key_entries = opt->cache_dir || opt->watch;
+
+	// The INI handler queues an entry whenever `src` is set.
+	if (ini_parse(config_fname, &ini_handler_func, conv))
+	{
+		fprintf(stderr, "Error parsing \"%s\".\n", config_fname);
+		return false;
+	}
+	return true;
+}
+
+// Parses the script, converts it, and writes the outputs. The caller shuts
+// down conv afterwards either way.
+static int build(const Options *opt, Conv *conv, ImgCache *imgcache, Entry *prev_head)
+{
+	const uint64_t start = stats_now();
+	if (!build_parse(opt, opt->config_fname, conv, imgcache, NULL, prev_head)) return -1;
+
+	// Entries are only kept whole in watch mode, to be reused by the next build.
+	if (!emit_begin(conv, opt->out_mode, !opt->watch)) return -1;
+
+	// The queued entries are converted all together.
+	if (!conv_run(conv))
+	{
+		fprintf(stderr, "Error converting \"%s\".\n", opt->config_fname);
+		outfile_abort(&conv->out_chr);
+		return -1;
+	}
+
+	int ret = emit_outputs(conv, opt->config_fname, opt->out_mode);
+	if (ret < 0) return ret;
+
+	const StatsScript script = {opt->config_fname, conv};
+	if (report_stats(opt, &script, 1, start) < 0) ret = -1;
+	return ret;
+}
+
+// Builds every script in a project. All scripts are parsed first so that
+// their entries can be converted as one batch; source images and packed
+// palettes are shared between scripts. A script that fails doesn't keep the
+// others from being written.
+static int build_project(const Options *opt)
+{
+	const uint64_t start = stats_now();
+	Project project;
+	if (!project_load(&project, opt->project_fname))
+	{
+		project_shutdown(&project);
+		return -1;
+	}
+
+	Conv *convs = calloc(sizeof(*convs), project.script_count);
+	if (!convs)
+	{
+		fprintf(stderr, "Couldn't allocate scripts\n");
+		project_shutdown(&project);
+		return -1;
+	}
 
-	// Close out data to files
+	ImgCache imgcache;
+	imgcache_init(&imgcache);
+	imgcache.skip_checksums = opt->skip_checksums;
+	imgcache.hash = (opt->cache_dir != NULL);
+	imgcache.inflate = opt->inflate;
+	PalCache palcache;
+	palcache_init(&palcache);
+
+	int ret = 0;
+	bool parsed = true;
+	for (int i = 0; i < project.script_count; i++)
+	{
+		if (!build_parse(opt, project.scripts[i], &convs[i], &imgcache, &palcache, NULL) ||
+		    !emit_begin(&convs[i], opt->out_mode, true))
+		{
+			parsed = false;
+			break;
+		}
+	}
+
+	if (!parsed)
+	{
+		ret = -1;
+	}
+	else
+	{
+		bool *conv_ok = calloc(sizeof(*conv_ok), project.script_count);
+		if (!conv_ok || !conv_run_many(convs, project.script_count, conv_ok)) ret = -1;
+		for (int i = 0; conv_ok && i < project.script_count; i++)
+		{
+			if (!conv_ok[i])
+			{
+				fprintf(stderr, "Error converting \"%s\".\n", project.scripts[i]);
+				outfile_abort(&convs[i].out_chr);
+				ret = -1;
+				continue;
+			}
 
+			const int script_ret = emit_outputs(&convs[i], project.scripts[i], opt->out_mode);
+			if (script_ret < 0) ret = -1;
+			else if (script_ret > 0 && ret == 0) ret = script_ret;
+		}
+		free(conv_ok);
+
+		StatsScript *scripts = malloc(sizeof(*scripts) * project.script_count);
+		if (scripts)
+		{
+			for (int i = 0; i < project.script_count; i++)
+			{
+				scripts[i].script = project.scripts[i];
+				scripts[i].conv = &convs[i];
+			}
+			if (report_stats(opt, scripts, project.script_count, start) < 0) ret = -1;
+			free(scripts);
+		}
+	}
+
+	for (int i = 0; i < project.script_count; i++) conv_shutdown(&convs[i]);
+	free(convs);
+	palcache_shutdown(&palcache);
+	imgcache_shutdown(&imgcache);
+	project_shutdown(&project);
+	return ret;
+}
+
+// Reports the codes, offsets and data sizes each script would produce, from
+// the headers of its images alone. Nothing is converted or written.
+static int plan_scripts(const Options *opt)
+{
+	Project project = {0};
+	const char *single[] = {opt->config_fname};
+	const char **scripts = single;
+	int script_count = 1;
+	if (opt->project_fname)
+	{
+		if (!project_load(&project, opt->project_fname))
+		{
+			project_shutdown(&project);
+			return -1;
+		}
+		scripts = malloc(sizeof(*scripts) * project.script_count);
+		if (!scripts)
+		{
+			fprintf(stderr, "Couldn't allocate scripts\n");
+			project_shutdown(&project);
+			return -1;
+		}
+		for (int i = 0; i < project.script_count; i++) scripts[i] = project.scripts[i];
+		script_count = project.script_count;
+	}
+
+	int ret = 0;
+	for (int i = 0; i < script_count; i++)
+	{
+		Conv conv;
+		if (build_parse(opt, scripts[i], &conv, NULL, NULL, NULL) && conv_plan(&conv))
+		{
+			plan_print(stdout, scripts[i], &conv);
+		}
+		else
+		{
+			fprintf(stderr, "Error planning \"%s\".\n", scripts[i]);
+			ret = -1;
+		}
+		conv_shutdown(&conv);
+	}
+
+	if (scripts != single) free(scripts);
+	project_shutdown(&project);
+	return ret;
+}
+
+static void watch_changed(void *ctx, const char *path)
+{
+	ImgCache *imgcache = (ImgCache *)ctx;
+	printf("Changed: %s\n", path);
+	imgcache_invalidate(imgcache, path);
+}
+
+// Builds the script, then again every time it or one of its images changes.
+// Decoded images and converted entries are kept between builds, so only
+// entries whose image or settings changed are converted again.
+static int watch_loop(const Options *opt)
+{
+	Watch w;
+	if (!watch_init(&w)) return -1;
+
+	ImgCache imgcache;
+	imgcache_init(&imgcache);
+	imgcache.retain = true;
+	imgcache.skip_checksums = opt->skip_checksums;
+	imgcache.hash = true;
+	imgcache.inflate = opt->inflate;
+
+	Conv prev;
+	bool have_prev = false;
+	int ret = 0;
+	for (;;)
+	{
+		Conv conv;
+		imgcache_next_gen(&imgcache);
+		ret = build(opt, &conv, &imgcache, have_prev ? prev.entry_head : NULL);
+		if (ret < 0) printf("Build failed. Waiting for changes...\n");
+		else printf("Build done. Waiting for changes...\n");
+		fflush(stdout);
+
+		// Watch the script and every image it uses.
+		const char **paths = malloc(sizeof(*paths) * (conv.entry_count + 1));
+		if (!paths)
+		{
+			conv_shutdown(&conv);
+			ret = -1;
+			break;
+		}
+		int path_count = 0;
+		paths[path_count++] = opt->config_fname;
+		for (Entry *e = conv.entry_head; e; e = e->next) paths[path_count++] = e->src;
+		const bool watching = watch_set_files(&w, paths, path_count);
+		free(paths);
+
+		// Keep the latest good conversion around to reuse entries from.
+		if (ret >= 0)
+		{
+			if (have_prev) conv_shutdown(&prev);
+			prev = conv;
+			have_prev = true;
+		}
+		else
+		{
+			conv_shutdown(&conv);
+		}
+
+		if (!watching || !watch_wait(&w, watch_changed, &imgcache))
+		{
+			ret = -1;
+			break;
+		}
+	}
+
+	if (have_prev) conv_shutdown(&prev);
+	imgcache_shutdown(&imgcache);
+	watch_shutdown(&w);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	Options opt = {0};
+	opt.jobs = 1;
+	opt.out_mode = OUT_MODE_ALWAYS;
+	opt.inflate = INFLATE_BACKEND_FAST;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char *arg = argv[i];
+		if (strncmp(arg, "-j", 2) == 0)
+		{
+			// Accept both "-j N" and "-jN".
+			const char *val = arg[2] ? &arg[2] : ((i + 1 < argc) ? argv[++i] : NULL);
+			if (!val)
+			{
+				print_usage(argv[0]);
+				return -1;
+			}
+			opt.jobs = strtol(val, NULL, 0);
+			if (opt.jobs <= 0) opt.jobs = jobs_default_threads();
+		}
+		else if (strcmp(arg, "--cache") == 0)
+		{
+			if (i + 1 >= argc)
+			{
+				print_usage(argv[0]);
+				return -1;
+			}
+			opt.cache_dir = argv[++i];
+		}
+		else if (strcmp(arg, "--if-changed") == 0)
+		{
+			opt.out_mode = OUT_MODE_IF_CHANGED;
+		}
+		else if (strcmp(arg, "--check") == 0)
+		{
+			opt.out_mode = OUT_MODE_CHECK;
+		}
+		else if (strcmp(arg, "--watch") == 0)
+		{
+			opt.watch = true;
+		}
+		else if (strcmp(arg, "--plan") == 0)
+		{
+			opt.plan = true;
+		}
+		else if (strcmp(arg, "--skip-checksums") == 0)
+		{
+			opt.skip_checksums = true;
+		}
+		else if (strcmp(arg, "--low-memory") == 0)
+		{
+			opt.low_memory = true;
+		}
+		else if (strcmp(arg, "--inflate") == 0)
+		{
+			if (i + 1 >= argc)
+			{
+				print_usage(argv[0]);
+				return -1;
+			}
+			opt.inflate = inflate_backend_for_string(argv[++i]);
+			if (opt.inflate == INFLATE_BACKEND_COUNT)
+			{
+				fprintf(stderr, "Unknown inflate backend \"%s\"\n", argv[i]);
+				print_usage(argv[0]);
+				return -1;
+			}
+		}
+		else if (strcmp(arg, "--stats") == 0)
+		{
+			opt.stats = true;
+		}
+		else if (strcmp(arg, "--stats-json") == 0)
+		{
+			if (i + 1 >= argc)
+			{
+				print_usage(argv[0]);
+				return -1;
+			}
+			opt.stats_json_fname = argv[++i];
+		}
+		else if (strcmp(arg, "--trace") == 0)
+		{
+			if (i + 1 >= argc)
+			{
+				print_usage(argv[0]);
+				return -1;
+			}
+			opt.trace_fname = argv[++i];
+		}
+		else if (strcmp(arg, "--project") == 0)
+		{
+			if (i + 1 >= argc)
+			{
+				print_usage(argv[0]);
+				return -1;
+			}
+			opt.project_fname = argv[++i];
+		}
+		else if (arg[0] == '-')
+		{
+			fprintf(stderr, "Unknown option \"%s\"\n", arg);
+			print_usage(argv[0]);
+			return -1;
+		}
+		else
+		{
+			opt.config_fname = arg;
+		}
+	}
+
+	if (!opt.config_fname == !opt.project_fname)
+	{
+		print_usage(argv[0]);
+		return -1;
+	}
+
+	if (opt.plan)
+	{
+		if (opt.watch)
+		{
+			fprintf(stderr, "--watch can't be used with --plan.\n");
+			return -1;
+		}
+		return plan_scripts(&opt);
+	}
+
+	if (opt.project_fname)
+	{
+		if (opt.watch)
+		{
+			fprintf(stderr, "--watch can't be used with --project.\n");
+			return -1;
+		}
+		return build_project(&opt);
+	}
+
+	if (opt.watch) return watch_loop(&opt);
+
+	// Symbols that share a sheet only have it decoded once.
+	ImgCache imgcache;
+	imgcache_init(&imgcache);
+	imgcache.skip_checksums = opt.skip_checksums;
+	imgcache.hash = (opt.cache_dir != NULL);
+	imgcache.inflate = opt.inflate;
+	Conv conv;
+	const int ret = build(&opt, &conv, &imgcache, NULL);
+	conv_shutdown(&conv);
+	imgcache_shutdown(&imgcache);
 	return ret;
 }
@@ -33,7 +33,7 @@ $0E    2   flip dx
 
 #include "types.h"
 #include <stdio.h>
-#include "endian.h"
+#include "writer.h"
 
 #define MDCSP_HEADER_BYTES 0x08
 #define MDCSP_REF_BYTES    0x08
@@ -46,39 +46,39 @@ static inline size_t mdcsp_bytes_for_mapping(int ref_count, int spr_count)
 }
 
 // Returns bytes used for mapping.
-static inline size_t mdcsp_emit_mapping(const Entry *e, FILE *f)
+static inline size_t mdcsp_emit_mapping(const Entry *e, Writer *w)
 {
 	const uint16_t sprlist_offs = MDCSP_HEADER_BYTES + (e->md_csp.ref_count*MDCSP_REF_BYTES);
 	const uint16_t fixed_buffer_words = (e->chr_bytes / 2) / (sizeof(uint16_t));
 	const uint16_t vram_buffer_words = e->md_csp.dma_buffer_tiles * (32 / sizeof(uint16_t));
 
-	fwrite_uint16be(e->md_csp.ref_count, f);
-	fwrite_uint16be(sprlist_offs, f);
-	fwrite_uint16be(fixed_buffer_words, f);
-	fwrite_uint16be(vram_buffer_words, f);
+	writer_put16be(w, e->md_csp.ref_count);
+	writer_put16be(w, sprlist_offs);
+	writer_put16be(w, fixed_buffer_words);
+	writer_put16be(w, vram_buffer_words);
 
 	// Ref list.
 	for (int i = 0; i < e->md_csp.ref_count; i++)
 	{
 		const MdCspRef *ref = &e->md_csp.ref_dat[i];
-		fwrite_uint16be(ref->spr_count, f);
-		fwrite_uint16be(ref->spr_index * 16, f);  // * sizeof(spr_def)
-		fwrite_uint16be(ref->tile_index, f);  // Tile offset within tile data.
-		fwrite_uint16be(ref->tile_count * (32 / sizeof(uint16_t)), f);  // DMA size in words.
+		writer_put16be(w, ref->spr_count);
+		writer_put16be(w, ref->spr_index * 16);  // * sizeof(spr_def)
+		writer_put16be(w, ref->tile_index);  // Tile offset within tile data.
+		writer_put16be(w, ref->tile_count * (32 / sizeof(uint16_t)));  // DMA size in words.
 	}
 	// Sprite list.
 	for (int i = 0; i < e->md_csp.spr_count; i++)
 	{
 		const MdCspSpr *spr = &e->md_csp.spr_dat[i];
-		fwrite_int16be(spr->dy, f);
+		writer_put16be(w, spr->dy);
 		const uint16_t sizebits = ((spr->h-1)) | ((spr->w-1) << 2);
-		fwrite_uint16be(sizebits << 8, f);
-		fwrite_uint16be(spr->tile, f);
-		fwrite_int16be(spr->dx, f);
-		fwrite_int16be(spr->flip_dy, f);
-		fwrite_uint16be(0, f);
-		fwrite_uint16be(0, f);
-		fwrite_int16be(spr->flip_dx, f);
+		writer_put16be(w, sizebits << 8);
+		writer_put16be(w, spr->tile);
+		writer_put16be(w, spr->dx);
+		writer_put16be(w, spr->flip_dy);
+		writer_put16be(w, 0);
+		writer_put16be(w, 0);
+		writer_put16be(w, spr->flip_dx);
 	}
 
 	return mdcsp_bytes_for_mapping(e->md_csp.ref_count, e->md_csp.spr_count);
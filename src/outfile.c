@@ -0,0 +1,110 @@
+#include "outfile.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define OUTFILE_CMP_CHUNK 0x10000
+
+bool outfile_open(OutFile *o, const char *fname, OutMode mode)
+{
+	memset(o, 0, sizeof(*o));
+	o->mode = mode;
+	snprintf(o->fname, sizeof(o->fname), "%s", fname);
+
+	if (mode == OUT_MODE_CHECK)
+	{
+		// Nothing may be written beside the output, so use an anonymous file.
+		o->f = tmpfile();
+	}
+	else
+	{
+		// The temporary file is kept in the same directory so it can be
+		// renamed over the output.
+		snprintf(o->tmp_fname, sizeof(o->tmp_fname), "%s.%ld.tmp", fname, (long)getpid());
+		o->f = fopen(o->tmp_fname, "w+b");
+	}
+
+	if (!o->f)
+	{
+		fprintf(stderr, "Couldn't open %s for writing\n", fname);
+		return false;
+	}
+	writer_init(&o->w, o->f);
+	return true;
+}
+
+// Returns true if the file at fname holds exactly the contents of f.
+static bool outfile_matches_disk(FILE *f, const char *fname)
+{
+	FILE *f_old = fopen(fname, "rb");
+	if (!f_old) return false;
+
+	bool match = true;
+	uint8_t *buf_new = malloc(OUTFILE_CMP_CHUNK);
+	uint8_t *buf_old = malloc(OUTFILE_CMP_CHUNK);
+	if (!buf_new || !buf_old)
+	{
+		match = false;
+		goto done;
+	}
+
+	rewind(f);
+	while (match)
+	{
+		const size_t len_new = fread(buf_new, 1, OUTFILE_CMP_CHUNK, f);
+		const size_t len_old = fread(buf_old, 1, OUTFILE_CMP_CHUNK, f_old);
+		if (len_new != len_old || memcmp(buf_new, buf_old, len_new) != 0) match = false;
+		if (len_new < OUTFILE_CMP_CHUNK) break;
+	}
+
+done:
+	free(buf_new);
+	free(buf_old);
+	fclose(f_old);
+	return match;
+}
+
+int outfile_close(OutFile *o)
+{
+	if (!o->f) return -1;
+
+	if (!writer_shutdown(&o->w) || fflush(o->f) != 0 || ferror(o->f))
+	{
+		fprintf(stderr, "Couldn't write %s\n", o->fname);
+		outfile_abort(o);
+		return -1;
+	}
+
+	const bool changed = (o->mode == OUT_MODE_ALWAYS) ||
+	                     !outfile_matches_disk(o->f, o->fname);
+
+	if (o->mode == OUT_MODE_CHECK || !changed)
+	{
+		outfile_abort(o);
+		return changed ? 1 : 0;
+	}
+
+	const bool close_ok = (fclose(o->f) == 0);
+	o->f = NULL;
+#ifdef _WIN32
+	remove(o->fname);
+#endif  // _WIN32
+	if (!close_ok || rename(o->tmp_fname, o->fname) != 0)
+	{
+		fprintf(stderr, "Couldn't replace %s\n", o->fname);
+		remove(o->tmp_fname);
+		return -1;
+	}
+	o->tmp_fname[0] = '\0';
+	return 1;
+}
+
+void outfile_abort(OutFile *o)
+{
+	writer_discard(&o->w);
+	if (o->f) fclose(o->f);
+	o->f = NULL;
+	if (o->tmp_fname[0] != '\0') remove(o->tmp_fname);
+	o->tmp_fname[0] = '\0';
+}
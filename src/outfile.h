@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdio.h>
+#include "writer.h"
+
+//
+// Output files, written to a temporary file and then put in place at once.
+//
+
+typedef enum OutMode
+{
+	OUT_MODE_ALWAYS,      // Always replace the output.
+	OUT_MODE_IF_CHANGED,  // Only replace the output if the content differs.
+	OUT_MODE_CHECK,       // Never write; only report whether it would change.
+} OutMode;
+
+typedef struct OutFile
+{
+	char fname[512];      // Final destination.
+	char tmp_fname[528];  // Temporary file beside it; empty in check mode.
+	FILE *f;              // Stream to write contents to.
+	Writer w;             // Buffered binary writes to f.
+	OutMode mode;
+} OutFile;
+
+// Opens a stream for the output named fname.
+bool outfile_open(OutFile *o, const char *fname, OutMode mode);
+
+// Finishes the output, comparing it to what is on disk as the mode requires.
+// Returns 1 if the output was (or would be) changed, 0 if it was already
+// up to date, and -1 on error.
+int outfile_close(OutFile *o);
+
+// Discards the output, leaving the file on disk alone. Does nothing to an
+// output already closed or discarded.
+void outfile_abort(OutFile *o);
@@ -0,0 +1,78 @@
+#include "palcache.h"
+#include "hash.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct PalCacheNode
+{
+	uint64_t hash;
+	PalFormat fmt;
+	size_t count;
+	uint8_t srcpal[256 * 4];  // RGBA, as given.
+	uint16_t packed[256];
+	PalCacheNode *next;
+};
+
+void palcache_init(PalCache *c)
+{
+	memset(c, 0, sizeof(*c));
+	pthread_mutex_init(&c->lock, NULL);
+}
+
+void palcache_shutdown(PalCache *c)
+{
+	for (int i = 0; i < PALCACHE_BUCKETS; i++)
+	{
+		PalCacheNode *n = c->buckets[i];
+		while (n)
+		{
+			PalCacheNode *next = n->next;
+			free(n);
+			n = next;
+		}
+	}
+	pthread_mutex_destroy(&c->lock);
+	memset(c, 0, sizeof(*c));
+}
+
+void palcache_pack(PalCache *c, PalFormat fmt, const uint8_t *srcpal,
+                   uint16_t *destpal, size_t count)
+{
+	if (count > 256) count = 256;
+	uint64_t hash = hash_int(HASH_INIT, fmt);
+	hash = hash_bytes(hash, srcpal, count * 4);
+	const int bucket = hash % PALCACHE_BUCKETS;
+
+	pthread_mutex_lock(&c->lock);
+	for (const PalCacheNode *n = c->buckets[bucket]; n; n = n->next)
+	{
+		if (n->hash != hash || n->fmt != fmt || n->count != count) continue;
+		if (memcmp(n->srcpal, srcpal, count * 4) != 0) continue;
+		memcpy(destpal, n->packed, sizeof(n->packed));
+		pthread_mutex_unlock(&c->lock);
+		return;
+	}
+	pthread_mutex_unlock(&c->lock);
+
+	// Packing is done outside of the lock. If two threads race on the same
+	// palette, both results are identical and either one may be kept.
+	PalCacheNode *n = calloc(sizeof(*n), 1);
+	if (!n)
+	{
+		memset(destpal, 0, sizeof(uint16_t) * 256);
+		pal_pack_set(fmt, srcpal, destpal, count);
+		return;
+	}
+	n->hash = hash;
+	n->fmt = fmt;
+	n->count = count;
+	memcpy(n->srcpal, srcpal, count * 4);
+	pal_pack_set(fmt, srcpal, n->packed, count);
+	memcpy(destpal, n->packed, sizeof(n->packed));
+
+	pthread_mutex_lock(&c->lock);
+	n->next = c->buckets[bucket];
+	c->buckets[bucket] = n;
+	pthread_mutex_unlock(&c->lock);
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "pal.h"
+
+//
+// Cache of packed palettes, shared by all entries converted in a process.
+// Sheets that share a palette, or one sheet used by several scripts, only
+// have their palette packed once per palette format.
+//
+
+#define PALCACHE_BUCKETS 64
+
+typedef struct PalCacheNode PalCacheNode;
+
+typedef struct PalCache
+{
+	PalCacheNode *buckets[PALCACHE_BUCKETS];
+	pthread_mutex_t lock;
+} PalCache;
+
+void palcache_init(PalCache *c);
+void palcache_shutdown(PalCache *c);
+
+// Same as pal_pack_set() into a zeroed 256-entry destpal, reusing the result
+// for a palette that was packed before.
+void palcache_pack(PalCache *c, PalFormat fmt, const uint8_t *srcpal,
+                   uint16_t *destpal, size_t count);
@@ -0,0 +1,65 @@
+#include "plan.h"
+#include "conv.h"
+#include "entry_emit.h"
+#include "format.h"
+
+void plan_print(FILE *f, const char *script, const Conv *s)
+{
+	fprintf(f, "%s:\n", script);
+	fprintf(f, "%-24s %-11s %9s %6s %-15s %8s %9s %6s\n",
+	        "Symbol", "Format", "Image", "Frames", "Codes", "CHR offs", "CHR", "Pal");
+
+	size_t chr_total = 0;
+	size_t pal_total = 0;
+	int unsized = 0;
+	uint32_t code_used = 0;
+	uint32_t code_lo = UINT32_MAX;
+	uint32_t code_hi = 0;
+	for (const Entry *e = s->entry_head; e; e = e->next)
+	{
+		const FrameCfg *frame_cfg = &e->frame_cfg;
+		const bool fixed = conv_format_fixed_size(frame_cfg->data_format);
+		const size_t chr_bytes = entry_chr_size(e);
+		const size_t pal_bytes = e->pal_ref ? 0 : e->pal_size * sizeof(uint16_t);
+		chr_total += chr_bytes;
+		pal_total += pal_bytes;
+		if (!fixed) unsized++;
+
+		if (e->code_count > 0)
+		{
+			code_used += e->code_count;
+			if (frame_cfg->code < code_lo) code_lo = frame_cfg->code;
+			if (frame_cfg->code + e->code_count - 1 > code_hi) code_hi = frame_cfg->code + e->code_count - 1;
+		}
+
+		char size[32];
+		char codes[32];
+		char chr[32];
+		snprintf(size, sizeof(size), "%dx%d", frame_cfg->src_tex_w, frame_cfg->src_tex_h);
+		if (!fixed) snprintf(codes, sizeof(codes), "$%X-?", frame_cfg->code);
+		else if (e->code_count == 0) snprintf(codes, sizeof(codes), "-");
+		else snprintf(codes, sizeof(codes), "$%X-$%X", frame_cfg->code,
+		              frame_cfg->code + e->code_count - 1);
+		if (!fixed) snprintf(chr, sizeof(chr), "?");
+		else snprintf(chr, sizeof(chr), "%zu", chr_bytes);
+
+		fprintf(f, "%-24s %-11s %9s %6d %-15s %8zX %9s %6zu\n",
+		        e->symbol, string_for_data_format(frame_cfg->data_format),
+		        size, e->frames, codes, e->chr_offs, chr, pal_bytes);
+	}
+
+	fprintf(f, "\n%s.chr: %zu bytes, %s.pal: %zu bytes, %s.map: %zu bytes; %zu bytes total\n",
+	        s->out, chr_total, s->out, pal_total, s->out, s->map_pos,
+	        chr_total + pal_total + s->map_pos);
+	if (code_used > 0)
+	{
+		fprintf(f, "Codes $%X-$%X, $%X used\n", code_lo, code_hi, code_used);
+	}
+	if (unsized > 0)
+	{
+		fprintf(f, "%d entries depend on their pixels and need a full convert to be sized;\n"
+		        "their data is not counted, and the codes and offsets after them are low.\n",
+		        unsized);
+	}
+	fprintf(f, "\n");
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdio.h>
+#include "types.h"
+
+//
+// Budget report for --plan.
+//
+// Lists the codes, offsets and sizes that conv_plan() worked out for each
+// entry of a script, and the totals for each of its outputs.
+//
+
+void plan_print(FILE *f, const char *script, const Conv *s);
@@ -0,0 +1,382 @@
+#include "pngdec.h"
+#include "lodepng.h"
+#include <stdlib.h>
+#include <string.h>
+
+bool pngdec_supported(const uint8_t *png, size_t size)
+{
+	// IHDR is always first: bit depth, color type and interlace method.
+	if (size < 33) return false;
+	const uint8_t depth = png[24];
+	const bool depth_ok = (depth == 1 || depth == 2 || depth == 4 || depth == 8);
+	return depth_ok && png[25] == LCT_PALETTE && png[28] == 0;
+}
+
+static inline uint8_t paeth(uint8_t a, uint8_t b, uint8_t c)
+{
+	const int p = a + b - c;
+	const int pa = abs(p - a);
+	const int pb = abs(p - b);
+	const int pc = abs(p - c);
+	if (pa <= pb && pa <= pc) return a;
+	if (pb <= pc) return b;
+	return c;
+}
+
+// Reverses the filter on one row of len bytes. Indexed pixels are never more
+// than a byte, so the left neighbour is always the previous byte. prev is
+// the unfiltered row above, or all zeroes for the first row.
+static bool pngdec_unfilter_row(uint8_t *out, const uint8_t *in, const uint8_t *prev,
+                                size_t len, uint8_t filter)
+{
+	switch (filter)
+	{
+		case 0:  // None
+			memcpy(out, in, len);
+			break;
+
+		case 1:  // Sub
+			out[0] = in[0];
+			for (size_t i = 1; i < len; i++) out[i] = in[i] + out[i - 1];
+			break;
+
+		case 2:  // Up
+			for (size_t i = 0; i < len; i++) out[i] = in[i] + prev[i];
+			break;
+
+		case 3:  // Average
+			out[0] = in[0] + (prev[0] >> 1);
+			for (size_t i = 1; i < len; i++) out[i] = in[i] + ((out[i - 1] + prev[i]) >> 1);
+			break;
+
+		case 4:  // Paeth
+			out[0] = in[0] + prev[0];
+			for (size_t i = 1; i < len; i++) out[i] = in[i] + paeth(out[i - 1], prev[i], prev[i - 1]);
+			break;
+
+		default:
+			return false;
+	}
+	return true;
+}
+
+// Walks the chunks after IHDR the way LodePNG does, checking the same things
+// in the same order. The image data is pointed to where it lies if it is in
+// one chunk, or joined up into *idat_buf if not.
+static unsigned int pngdec_read_chunks(LodePNGState *state, const uint8_t *in, size_t insize,
+                                       const uint8_t **idat, size_t *idat_size,
+                                       uint8_t **idat_buf)
+{
+	size_t pos = 33;
+	while (true)
+	{
+		if (pos + 12 > insize) return 30;  // Chunk broken off at end of file.
+		const uint8_t *chunk = &in[pos];
+		const unsigned int len = lodepng_chunk_length(chunk);
+		if (len > 2147483647) return 63;
+		if (pos + (size_t)len + 12 > insize) return 64;
+		const uint8_t *data = lodepng_chunk_data_const(chunk);
+
+		const bool is_idat = lodepng_chunk_type_equals(chunk, "IDAT");
+		const bool is_iend = lodepng_chunk_type_equals(chunk, "IEND");
+		if (is_idat && !*idat)
+		{
+			*idat = data;
+			*idat_size = len;
+		}
+		else if (is_idat)
+		{
+			if (!*idat_buf)
+			{
+				// All of the chunks together can't be bigger than the file.
+				*idat_buf = malloc(insize);
+				if (!*idat_buf) return 83;
+				memcpy(*idat_buf, *idat, *idat_size);
+				*idat = *idat_buf;
+			}
+			memcpy(&(*idat_buf)[*idat_size], data, len);
+			*idat_size += len;
+		}
+		else if (!is_iend)
+		{
+			// LodePNG handles the palette and the metadata chunks it knows,
+			// including their CRCs. Other critical chunks can't be skipped.
+			const bool known = lodepng_chunk_type_equals(chunk, "PLTE") ||
+			                   lodepng_chunk_ancillary(chunk);
+			if (!known && !state->decoder.ignore_critical) return 69;
+			const unsigned int error = lodepng_inspect_chunk(state, pos, in, insize);
+			if (error) return error;
+			pos += (size_t)len + 12;
+			continue;
+		}
+
+		if (!state->decoder.ignore_crc && lodepng_chunk_check_crc(chunk)) return 57;
+		if (is_iend) return 0;
+		pos += (size_t)len + 12;
+	}
+}
+
+// LodePNG converts lower bit depths to 8 by color: an index takes the color
+// of its palette entry, or opaque black past the end of the palette, and
+// becomes the last entry with that color. An index whose color isn't in the
+// palette at all is marked with -1.
+static void pngdec_build_remap(const LodePNGColorMode *color, int16_t *remap)
+{
+	const int count = 1 << color->bitdepth;
+	const size_t pal_size = (color->palettesize < 256) ? color->palettesize : 256;
+	for (int i = 0; i < count; i++)
+	{
+		static const uint8_t k_black[4] = {0, 0, 0, 255};
+		const uint8_t *rgba = ((size_t)i < pal_size) ? &color->palette[i * 4] : k_black;
+		remap[i] = -1;
+		for (size_t j = 0; j < pal_size; j++)
+		{
+			if (memcmp(&color->palette[j * 4], rgba, 4) == 0) remap[i] = j;
+		}
+	}
+}
+
+// Expands every possible byte of packed pixels into its 8 / depth indices.
+// bad[b] is set if any of them has no index to map to.
+static void pngdec_build_unpack(int depth, const int16_t *remap, uint8_t *lut, bool *bad)
+{
+	const int per_byte = 8 / depth;
+	const int mask = (1 << depth) - 1;
+	for (int b = 0; b < 256; b++)
+	{
+		bad[b] = false;
+		for (int i = 0; i < per_byte; i++)
+		{
+			const int16_t idx = remap[(b >> (8 - (depth * (i + 1)))) & mask];
+			if (idx < 0) bad[b] = true;
+			lut[(b * per_byte) + i] = (uint8_t)idx;
+		}
+	}
+}
+
+// Unpacks one row of w pixels. Pixels in the padding at the end of the row
+// are not looked at. Returns false if one had no index to map to.
+static bool pngdec_unpack_row(uint8_t *out, const uint8_t *in, size_t w, int depth,
+                              const int16_t *remap, const uint8_t *lut, const bool *bad)
+{
+	const int per_byte = 8 / depth;
+	const size_t whole = w / per_byte;
+	bool ok = true;
+	for (size_t i = 0; i < whole; i++)
+	{
+		const uint8_t b = in[i];
+		if (bad[b]) ok = false;
+		memcpy(&out[i * per_byte], &lut[b * per_byte], per_byte);
+	}
+
+	const int rest = w % per_byte;
+	const int mask = (1 << depth) - 1;
+	for (int i = 0; i < rest; i++)
+	{
+		const int16_t idx = remap[(in[whole] >> (8 - (depth * (i + 1)))) & mask];
+		if (idx < 0) ok = false;
+		out[(whole * per_byte) + i] = (uint8_t)idx;
+	}
+	return ok;
+}
+
+// Unfilters the rows of the image, and unpacks them if they are below 8 bits.
+static unsigned int pngdec_rows(Image *img, const LodePNGColorMode *color, const uint8_t *scan,
+                                size_t line_bytes)
+{
+	const size_t w = img->w;
+	const size_t h = img->h;
+	const int depth = color->bitdepth;
+
+	int16_t remap[256];
+	uint8_t lut[256 * 8];
+	bool bad[256];
+	if (depth < 8)
+	{
+		pngdec_build_remap(color, remap);
+		pngdec_build_unpack(depth, remap, lut, bad);
+	}
+
+	// Packed rows are unfiltered into one half of rows while the other holds
+	// the row above. The row above the first is taken to be zero.
+	uint8_t *rows = calloc(line_bytes, 2);
+	if (!rows) return 83;
+	const uint8_t *prev = rows;
+	unsigned int error = 0;
+	bool unmapped = false;
+	for (size_t y = 0; y < h; y++)
+	{
+		const uint8_t *row_in = &scan[y * (line_bytes + 1)];
+		uint8_t *row_px = &img->buf.px[y * w];
+		uint8_t *row = (depth < 8) ? &rows[((y + 1) & 1) * line_bytes] : row_px;
+		if (!pngdec_unfilter_row(row, &row_in[1], prev, line_bytes, row_in[0]))
+		{
+			error = 36;  // Invalid filter type.
+			break;
+		}
+		if (depth < 8 && !pngdec_unpack_row(row_px, row, w, depth, remap, lut, bad))
+		{
+			unmapped = true;
+		}
+		prev = row;
+	}
+	free(rows);
+
+	// LodePNG unfilters the whole image before converting it, so a bad filter
+	// anywhere takes precedence.
+	if (!error && unmapped) error = 82;  // Color not in palette.
+	return error;
+}
+
+// Reads the header and every chunk up to the end of the file.
+static unsigned int pngdec_start(LodePNGState *state, const uint8_t *in, size_t insize,
+                                 unsigned int *w, unsigned int *h, const uint8_t **idat,
+                                 size_t *idat_size, uint8_t **idat_buf)
+{
+	unsigned int error = lodepng_inspect(w, h, state, in, insize);
+	if (error) return error;
+	error = pngdec_read_chunks(state, in, insize, idat, idat_size, idat_buf);
+	if (error) return error;
+	if (!state->info_png.color.palette) return 106;  // PNG file must have PLTE chunk.
+	return 0;
+}
+
+static unsigned int pngdec_run(Image *img, LodePNGState *state, InflateBackend inflate,
+                               bool verify, const uint8_t **idat, size_t *idat_size,
+                               uint8_t **idat_buf, uint8_t **scan)
+{
+	unsigned int error = pngdec_start(state, img->png, img->file_size, &img->w, &img->h,
+	                                  idat, idat_size, idat_buf);
+	if (error) return error;
+	const LodePNGColorMode *color = &state->info_png.color;
+
+	// Each row starts with its filter type.
+	const size_t w = img->w;
+	const size_t h = img->h;
+	const size_t line_bytes = ((w * color->bitdepth) + 7) / 8;
+	const size_t scan_want = (line_bytes + 1) * h;
+	size_t scan_size = 0;
+	error = inflate_zlib(inflate, scan, &scan_size, *idat, *idat_size, scan_want, verify);
+	if (error) return error;
+	if (scan_size != scan_want) return 91;  // Decompressed size doesn't match.
+
+	if (img->buf.size < w * h)
+	{
+		free(img->buf.px);
+		img->buf.size = 0;
+		img->buf.px = malloc(w * h);
+		if (!img->buf.px) return 83;
+		img->buf.size = w * h;
+	}
+
+	error = pngdec_rows(img, color, *scan, line_bytes);
+	if (error) return error;
+
+	img->px = img->buf.px;
+	img->palette_size = color->palettesize;
+	memcpy(img->palette, color->palette, img->palette_size * 4);
+	return 0;
+}
+
+unsigned int pngdec_decode(Image *img, bool verify, InflateBackend inflate)
+{
+	LodePNGState state;
+	lodepng_state_init(&state);
+	state.decoder.ignore_crc = !verify;
+	state.decoder.zlibsettings.ignore_adler32 = !verify;
+	const uint8_t *idat = NULL;
+	size_t idat_size = 0;
+	uint8_t *idat_buf = NULL;
+	uint8_t *scan = NULL;
+	const unsigned int error = pngdec_run(img, &state, inflate, verify, &idat, &idat_size,
+	                                      &idat_buf, &scan);
+	free(scan);
+	free(idat_buf);
+	lodepng_state_cleanup(&state);
+	return error;
+}
+
+unsigned int pngdec_rows_begin(PngDecRows *r, const uint8_t *png, size_t size, bool verify)
+{
+	memset(r, 0, sizeof(*r));
+	LodePNGState state;
+	lodepng_state_init(&state);
+	state.decoder.ignore_crc = !verify;
+	state.decoder.zlibsettings.ignore_adler32 = !verify;
+	const uint8_t *idat = NULL;
+	size_t idat_size = 0;
+	unsigned int error = pngdec_start(&state, png, size, &r->w, &r->h, &idat, &idat_size,
+	                                  &r->idat_buf);
+	const LodePNGColorMode *color = &state.info_png.color;
+	if (!error) error = inflate_begin(&r->z, idat, idat_size, verify);
+	if (!error)
+	{
+		r->depth = color->bitdepth;
+		r->line_bytes = (((size_t)r->w * r->depth) + 7) / 8;
+		r->rows = calloc(((r->line_bytes + 1) * 3) + r->w, 1);
+		if (!r->rows) error = 83;
+	}
+	if (!error)
+	{
+		if (r->depth < 8)
+		{
+			pngdec_build_remap(color, r->remap);
+			pngdec_build_unpack(r->depth, r->remap, r->lut, r->bad);
+		}
+		r->palette_size = color->palettesize;
+		memcpy(r->palette, color->palette, r->palette_size * 4);
+	}
+	lodepng_state_cleanup(&state);
+	return error;
+}
+
+unsigned int pngdec_rows_read(PngDecRows *r, uint8_t *px, unsigned int count)
+{
+	// rows holds the filtered row as read, then the last two unfiltered, the
+	// one above the first row being all zeroes. Rows that aren't wanted are
+	// still unpacked, to find pixels with no index the same as LodePNG.
+	const size_t line_bytes = r->line_bytes;
+	uint8_t *row_in = r->rows;
+	for (unsigned int i = 0; i < count; i++)
+	{
+		if (r->y >= r->h) return 91;
+		const unsigned int error = inflate_read(&r->z, row_in, line_bytes + 1);
+		if (error) return error;
+		uint8_t *row = &r->rows[(line_bytes + 1) * (1 + ((r->y + 1) & 1))];
+		const uint8_t *prev = &r->rows[(line_bytes + 1) * (1 + (r->y & 1))];
+		if (!pngdec_unfilter_row(row, &row_in[1], prev, line_bytes, row_in[0])) return 36;
+		r->y++;
+
+		uint8_t *row_px = px ? &px[(size_t)i * r->w] : &r->rows[(line_bytes + 1) * 3];
+		if (r->depth == 8)
+		{
+			if (px) memcpy(row_px, row, r->w);
+		}
+		else if (!pngdec_unpack_row(row_px, row, r->w, r->depth, r->remap, r->lut, r->bad))
+		{
+			r->unmapped = true;
+		}
+	}
+	return 0;
+}
+
+unsigned int pngdec_rows_end(PngDecRows *r)
+{
+	while (r->y < r->h)
+	{
+		const unsigned int error = pngdec_rows_read(r, NULL, 1);
+		if (error) return error;
+	}
+	const unsigned int error = inflate_end(&r->z);
+	if (error) return error;
+	return r->unmapped ? 82 : 0;
+}
+
+void pngdec_rows_free(PngDecRows *r)
+{
+	inflate_free(&r->z);
+	free(r->rows);
+	free(r->idat_buf);
+	r->rows = NULL;
+	r->idat_buf = NULL;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "image.h"
+#include "inflate.h"
+
+//
+// Decoder for the indexed PNGs that make up most source art.
+//
+// LodePNG copies the image data out of the file, decodes into a buffer of
+// its own and then converts that into another for the requested color mode,
+// looking up the color of every pixel for lower bit depths. Here the image
+// data is inflated from the file as it lies, and each row is unfiltered and
+// unpacked straight into the image's pixel buffer. The result and any errors
+// are the same as LodePNG's, so either decoder can be used.
+//
+
+// True if pngdec_decode() handles the file: indexed, not interlaced.
+bool pngdec_supported(const uint8_t *png, size_t size);
+
+// Decodes img->png into img->buf, replacing it if it is too small, and sets
+// px, w, h and the palette. Unless verify is set, chunk CRCs and the Adler-32
+// checksum of the image data are not checked. The image data is inflated
+// with inflate.
+// Returns a LodePNG error code, or 0 on success.
+unsigned int pngdec_decode(Image *img, bool verify, InflateBackend inflate);
+
+// Decoding of a supported file a few rows at a time, for images too large to
+// want in memory whole. Only the rows asked for are ever held decoded.
+typedef struct PngDecRows
+{
+	Inflate z;
+	unsigned int w, h;
+	unsigned int y;            // Next row to decode.
+	int depth;
+	size_t line_bytes;
+	uint8_t *rows;             // Row being read, the two above it, and scratch.
+	uint8_t *idat_buf;
+	bool unmapped;             // A pixel had no index to map to.
+	int16_t remap[256];
+	uint8_t lut[256 * 8];
+	bool bad[256];
+	uint8_t palette[256 * 4];  // RGBA
+	int palette_size;
+} PngDecRows;
+
+// Reads the chunks of png, setting w, h and the palette, and gets ready to
+// decode the first row. png has to stay loaded until pngdec_rows_free(),
+// which is called whether or not this succeeds.
+unsigned int pngdec_rows_begin(PngDecRows *r, const uint8_t *png, size_t size, bool verify);
+
+// Decodes the next count rows into px, one byte per pixel.
+unsigned int pngdec_rows_read(PngDecRows *r, uint8_t *px, unsigned int count);
+
+// Decodes the rest of the image without keeping it, and checks it.
+// Together with the calls before, this returns an error wherever
+// pngdec_decode() would, but the code may differ.
+unsigned int pngdec_rows_end(PngDecRows *r);
+
+void pngdec_rows_free(PngDecRows *r);
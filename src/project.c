@@ -0,0 +1,53 @@
+#include "project.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "inih/ini.h"
+
+static int project_handler_func(void *user, const char *section, const char *name,
+                                const char *value)
+{
+	(void)section;
+	Project *p = (Project *)user;
+
+	if (strcmp("script", name) == 0)
+	{
+		char (*scripts)[256] = realloc(p->scripts, sizeof(*scripts) * (p->script_count + 1));
+		if (!scripts)
+		{
+			fprintf(stderr, "[PROJECT] Couldn't allocate script list\n");
+			return 0;
+		}
+		p->scripts = scripts;
+		snprintf(p->scripts[p->script_count], sizeof(p->scripts[0]), "%s", value);
+		p->script_count++;
+	}
+	else
+	{
+		printf("WARNING: Unhandled directive \"%s\"\n", name);
+		return 0;
+	}
+	return 1;
+}
+
+bool project_load(Project *p, const char *fname)
+{
+	memset(p, 0, sizeof(*p));
+	if (ini_parse(fname, &project_handler_func, p))
+	{
+		fprintf(stderr, "Error parsing \"%s\".\n", fname);
+		return false;
+	}
+	if (p->script_count == 0)
+	{
+		fprintf(stderr, "No scripts listed in \"%s\".\n", fname);
+		return false;
+	}
+	return true;
+}
+
+void project_shutdown(Project *p)
+{
+	free(p->scripts);
+	memset(p, 0, sizeof(*p));
+}
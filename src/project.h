@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdbool.h>
+
+//
+// Project manifest, listing conversion scripts to build in one process.
+//
+// The manifest uses the same INI syntax as scripts:
+//
+// script = gfx/md_sprites.ini
+// script = gfx/neo_sprites.ini
+//
+// Each script sets its own `out` as usual.
+//
+
+typedef struct Project
+{
+	char (*scripts)[256];
+	int script_count;
+} Project;
+
+bool project_load(Project *p, const char *fname);
+void project_shutdown(Project *p);
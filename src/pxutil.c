@@ -1,6 +1,12 @@
 #include "pxutil.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include "transpose.h"
+
+#ifdef CPU_X86
+#include <immintrin.h>
+#endif
 
 
 // -----------------------------------------------------------------------------
@@ -24,26 +30,14 @@ void pxutil_rotate_tile(uint8_t *imgdat, int x, int y, int line_w,
 		case 0:
 			break;
 		case 90:
-			for (int dy = 0; dy < tsize; dy++)
-			{
-				for (int dx = 0; dx < tsize; dx++)
-				{
-					const int sy = tsize - dx - 1;
-					const int sx = dy;
-					imgcopy[dy*tsize + dx] = imgdat[((y+sy)*line_w) + (x+sx)];
-				}
-			}
+			// Columns from the left, read bottom to top.
+			transpose_block(&imgdat[((y + tsize - 1) * line_w) + x], -line_w,
+			                imgcopy, tsize, tsize, tsize);
 			break;
 		case 270:
-			for (int dy = 0; dy < tsize; dy++)
-			{
-				for (int dx = 0; dx < tsize; dx++)
-				{
-					const int sy = dx;
-					const int sx = tsize - dy - 1;
-					imgcopy[dy*tsize + dx] = imgdat[((y+sy)*line_w) + (x+sx)];
-				}
-			}
+			// Columns from the right, read top to bottom.
+			transpose_block(&imgdat[(y * line_w) + x], line_w,
+			                &imgcopy[(tsize - 1) * tsize], -tsize, tsize, tsize);
 			break;
 		case 180:
 			for (int dy = 0; dy < tsize; dy++)
@@ -63,10 +57,7 @@ void pxutil_rotate_tile(uint8_t *imgdat, int x, int y, int line_w,
 
 	for (int cy = 0; cy < tsize; cy++)
 	{
-		for (int cx = 0; cx < tsize; cx++)
-		{
-			imgdat[(cy+y)*line_w + x + cx] = imgcopy[cy*tsize + cx];
-		}
+		memcpy(&imgdat[(cy+y)*line_w + x], &imgcopy[cy*tsize], tsize);
 	}
 
 	free(imgcopy);
@@ -77,41 +68,374 @@ void pxutil_rotate_tile(uint8_t *imgdat, int x, int y, int line_w,
 // Data Packing
 // -----------------------------------------------------------------------------
 
-bool pxutil_pack_planar(const uint8_t *in, int planes,
-                        uint32_t order, bool reverse, uint8_t *out)
+// Gets the pixel bit behind each plane from order, complaining and returning
+// false if the planes can't be packed.
+static bool planar_bits(int planes, uint32_t order, int *bits)
 {
-	if (planes >= 8)
+	if (planes > 8)
 	{
 		fprintf(stderr, "More than eight bitplanes are not supported.\n");
 		return false;
 	}
 	for (int plane = 0; plane < planes; plane++)
 	{
-		const int plane_bit = order & 0x7;
-		if (plane_bit >= planes)
+		bits[plane] = order & 0x7;
+		if (bits[plane] >= planes)
 		{
 			fprintf(stderr, "Plane bit %d used despite plane count of %d\n",
-			       plane_bit, planes);
+			       bits[plane], planes);
 			return false;
 		}
+		order = order >> 4;
+	}
+	return true;
+}
 
-		out[plane] = 0;
-		const uint8_t testbits = (1 << plane_bit);
-	//	printf("plane %d: test $%X\n", plane, testbits);
+// Eight pixels, the first in the low byte.
+static inline uint64_t planar_load(const uint8_t *in)
+{
+	uint64_t px;
+	memcpy(&px, in, sizeof(px));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	px = __builtin_bswap64(px);
+#endif
+	return px;
+}
 
-		for (int i = 0; i < 8; i++)
+// With a plane's bit moved to the bottom of each pixel's byte, one multiply
+// gathers all eight into the top byte: the first pixel's in bit 7, or with
+// the other constant, in bit 0.
+static void pack_planar_scalar(const uint8_t *in, size_t in_stride, size_t count,
+                               int planes, const int *bits, bool reverse,
+                               uint8_t inv, uint8_t *out)
+{
+	const uint64_t gather = reverse ? 0x0102040810204080ULL : 0x8040201008040201ULL;
+	for (size_t i = 0; i < count; i++)
+	{
+		const uint64_t px = planar_load(&in[i * in_stride]);
+		for (int plane = 0; plane < planes; plane++)
 		{
-			if (!(in[i] & testbits)) continue;
+			const uint64_t lsbs = (px >> bits[plane]) & 0x0101010101010101ULL;
+			*out++ = (uint8_t)((lsbs * gather) >> 56) ^ inv;
+		}
+	}
+}
+
+#ifdef CPU_X86
 
-			if (reverse) out[plane] |= (0x01 << i);
-			else out[plane] |= (0x80 >> i);
+// Writes four rows of four planes, from the masks of each plane: byte r of
+// mask[p] is plane p of row r.
+__attribute__((target("sse2")))
+static inline void pack_planar_store4x4(const uint32_t *mask, uint8_t inv, uint8_t *out)
+{
+	const __m128i p01 = _mm_unpacklo_epi8(_mm_cvtsi32_si128(mask[0]), _mm_cvtsi32_si128(mask[1]));
+	const __m128i p23 = _mm_unpacklo_epi8(_mm_cvtsi32_si128(mask[2]), _mm_cvtsi32_si128(mask[3]));
+	const __m128i rows = _mm_xor_si128(_mm_unpacklo_epi16(p01, p23), _mm_set1_epi8(inv));
+	_mm_storeu_si128((__m128i *)out, rows);
+}
+
+// Writes four rows of any number of planes, as above.
+static inline void pack_planar_store(const uint32_t *mask, int planes, uint8_t inv, uint8_t *out)
+{
+	for (int row = 0; row < 4; row++)
+	{
+		for (int plane = 0; plane < planes; plane++)
+		{
+			*out++ = (uint8_t)(mask[plane] >> (row * 8)) ^ inv;
 		}
-		order = order >> 4;
 	}
-	//printf("result buffer {%02X %02X %02X %02X %02X %02X %02X %02X}\n", out[0], out[1], out[2], out[3], out[4], out[5], out[6], out[7]);
+}
+
+// Shifting a plane's bit to the top of each byte lets movemask take a bit
+// per pixel, the first pixel's lowest. Unless reversed, each row's pixels
+// are swapped end for end first. Four rows go at a time, in two registers;
+// returns the number of rows packed.
+__attribute__((target("sse2")))
+static size_t pack_planar_sse2(const uint8_t *in, size_t in_stride, size_t count,
+                               int planes, const int *bits, bool reverse,
+                               uint8_t inv, uint8_t *out)
+{
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128i px[2];
+		for (int k = 0; k < 2; k++)
+		{
+			const uint8_t *row = &in[(i + (2 * k)) * in_stride];
+			px[k] = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)row),
+			                           _mm_loadl_epi64((const __m128i *)&row[in_stride]));
+			if (reverse) continue;
+			px[k] = _mm_shufflelo_epi16(px[k], _MM_SHUFFLE(0, 1, 2, 3));
+			px[k] = _mm_shufflehi_epi16(px[k], _MM_SHUFFLE(0, 1, 2, 3));
+			px[k] = _mm_or_si128(_mm_slli_epi16(px[k], 8), _mm_srli_epi16(px[k], 8));
+		}
+		uint32_t mask[8];
+		for (int plane = 0; plane < planes; plane++)
+		{
+			const __m128i shift = _mm_cvtsi32_si128(7 - bits[plane]);
+			mask[plane] = (uint32_t)_mm_movemask_epi8(_mm_sll_epi64(px[0], shift)) |
+			              ((uint32_t)_mm_movemask_epi8(_mm_sll_epi64(px[1], shift)) << 16);
+		}
+		if (planes == 4) pack_planar_store4x4(mask, inv, out);
+		else pack_planar_store(mask, planes, inv, out);
+		out += 4 * planes;
+	}
+	return i;
+}
+
+// As above, with the four rows in one register.
+__attribute__((target("avx2")))
+static size_t pack_planar_avx2(const uint8_t *in, size_t in_stride, size_t count,
+                               int planes, const int *bits, bool reverse,
+                               uint8_t inv, uint8_t *out)
+{
+	const __m256i flip = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0,
+	                                      15, 14, 13, 12, 11, 10, 9, 8,
+	                                      7, 6, 5, 4, 3, 2, 1, 0,
+	                                      15, 14, 13, 12, 11, 10, 9, 8);
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		const uint8_t *row = &in[i * in_stride];
+		__m256i px;
+		if (in_stride == 8)
+		{
+			px = _mm256_loadu_si256((const __m256i *)row);
+		}
+		else
+		{
+			px = _mm256_setr_epi64x(planar_load(row),
+			                        planar_load(&row[in_stride]),
+			                        planar_load(&row[2 * in_stride]),
+			                        planar_load(&row[3 * in_stride]));
+		}
+		if (!reverse) px = _mm256_shuffle_epi8(px, flip);
+		uint32_t mask[8];
+		for (int plane = 0; plane < planes; plane++)
+		{
+			const __m128i shift = _mm_cvtsi32_si128(7 - bits[plane]);
+			mask[plane] = (uint32_t)_mm256_movemask_epi8(_mm256_sll_epi64(px, shift));
+		}
+		if (planes == 4) pack_planar_store4x4(mask, inv, out);
+		else pack_planar_store(mask, planes, inv, out);
+		out += 4 * planes;
+	}
+	return i;
+}
+
+#endif  // CPU_X86
+
+bool pxutil_pack_planar(const uint8_t *in, int planes,
+                        uint32_t order, bool reverse, uint8_t *out)
+{
+	return pxutil_pack_planar_rows_isa(CPU_ISA_SCALAR, in, 8, 1, planes, order,
+	                                   reverse, false, out);
+}
+
+bool pxutil_pack_planar_rows_isa(CpuIsa isa,
+                                 const uint8_t *in, size_t in_stride, size_t count,
+                                 int planes, uint32_t order, bool reverse,
+                                 bool invert, uint8_t *out)
+{
+	int bits[8];
+	if (!planar_bits(planes, order, bits)) return false;
+	const uint8_t inv = invert ? 0xFF : 0x00;
+	size_t done = 0;
+#ifdef CPU_X86
+	if (isa == CPU_ISA_AVX2)
+	{
+		done = pack_planar_avx2(in, in_stride, count, planes, bits, reverse, inv, out);
+	}
+	else if (isa == CPU_ISA_SSE2)
+	{
+		done = pack_planar_sse2(in, in_stride, count, planes, bits, reverse, inv, out);
+	}
+#else
+	(void)isa;
+#endif  // CPU_X86
+	pack_planar_scalar(&in[done * in_stride], in_stride, count - done,
+	                   planes, bits, reverse, inv, &out[done * planes]);
 	return true;
 }
 
+bool pxutil_pack_planar_rows(const uint8_t *in, size_t in_stride, size_t count,
+                             int planes, uint32_t order, bool reverse,
+                             bool invert, uint8_t *out)
+{
+	return pxutil_pack_planar_rows_isa(cpu_isa_best(), in, in_stride, count,
+	                                   planes, order, reverse, invert, out);
+}
+
+static void pack_nibbles_scalar(const uint8_t *in, size_t pairs, bool swap, bool hi,
+                                uint8_t *out)
+{
+	for (size_t i = 0; i < pairs; i++)
+	{
+		const uint8_t px0 = swap ? in[1] : in[0];
+		const uint8_t px1 = swap ? in[0] : in[1];
+		in += 2;
+
+		*out++ = ((px0 << 4) & 0xF0) | (px1 & 0x0F);
+		if (hi) *out++ = (px0 & 0xF0) | ((px1 >> 4) & 0x0F);
+	}
+}
+
+#ifdef CPU_X86
+
+// Each pair is a 16-bit lane, first pixel lowest. Its packed byte is worked
+// out in the low byte of the lane.
+__attribute__((target("sse2")))
+static inline __m128i pack_nibbles_lanes_sse2(__m128i w, bool swap)
+{
+	const __m128i nib_lo = _mm_set1_epi16(0x000F);
+	const __m128i nib_hi = _mm_set1_epi16(0x00F0);
+	const __m128i w4 = swap ? _mm_srli_epi16(w, 4) : _mm_slli_epi16(w, 4);
+	const __m128i lo = swap ? _mm_and_si128(w, nib_lo) : _mm_and_si128(_mm_srli_epi16(w, 8), nib_lo);
+	return _mm_or_si128(_mm_and_si128(w4, nib_hi), lo);
+}
+
+// Returns the number of pairs packed. The compiler vectorizes the scalar
+// loop with hi about as well as this would, so that is left to it.
+__attribute__((target("sse2")))
+static size_t pack_nibbles_sse2(const uint8_t *in, size_t pairs, bool swap, bool hi,
+                                uint8_t *out)
+{
+	size_t i = 0;
+	if (hi) return 0;
+	for (; i + 16 <= pairs; i += 16)
+	{
+		const __m128i w0 = _mm_loadu_si128((const __m128i *)&in[i * 2]);
+		const __m128i w1 = _mm_loadu_si128((const __m128i *)&in[(i * 2) + 16]);
+		_mm_storeu_si128((__m128i *)&out[i],
+		                 _mm_packus_epi16(pack_nibbles_lanes_sse2(w0, swap),
+		                                  pack_nibbles_lanes_sse2(w1, swap)));
+	}
+	return i;
+}
+
+// As above, sixteen pairs to a register. With hi, the high nibbles' byte is
+// worked out in the high byte of the lane, which leaves the lane as the two
+// bytes to output.
+__attribute__((target("avx2")))
+static inline __m256i pack_nibbles_lanes_avx2(__m256i w, bool swap, bool hi)
+{
+	const __m256i nib_lo = _mm256_set1_epi16(0x000F);
+	const __m256i nib_hi = _mm256_set1_epi16(0x00F0);
+	const __m256i w4 = swap ? _mm256_srli_epi16(w, 4) : _mm256_slli_epi16(w, 4);
+	const __m256i lo = swap ? _mm256_and_si256(w, nib_lo) : _mm256_and_si256(_mm256_srli_epi16(w, 8), nib_lo);
+	const __m256i packed = _mm256_or_si256(_mm256_and_si256(w4, nib_hi), lo);
+	if (!hi) return packed;
+	const __m256i top = swap
+	    ? _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(w, 8), nib_hi), _mm256_and_si256(_mm256_srli_epi16(w, 4), nib_lo))
+	    : _mm256_or_si256(_mm256_and_si256(w, nib_hi), _mm256_srli_epi16(w, 12));
+	return _mm256_or_si256(packed, _mm256_slli_epi16(top, 8));
+}
+
+// As for SSE2, but hi is worth doing here. packus works within each half of
+// the register, so the packed halves are put back in order after.
+__attribute__((target("avx2")))
+static size_t pack_nibbles_avx2(const uint8_t *in, size_t pairs, bool swap, bool hi,
+                                uint8_t *out)
+{
+	size_t i = 0;
+	if (hi)
+	{
+		for (; i + 16 <= pairs; i += 16)
+		{
+			const __m256i w = _mm256_loadu_si256((const __m256i *)&in[i * 2]);
+			_mm256_storeu_si256((__m256i *)&out[i * 2], pack_nibbles_lanes_avx2(w, swap, true));
+		}
+		return i;
+	}
+	for (; i + 32 <= pairs; i += 32)
+	{
+		const __m256i w0 = _mm256_loadu_si256((const __m256i *)&in[i * 2]);
+		const __m256i w1 = _mm256_loadu_si256((const __m256i *)&in[(i * 2) + 32]);
+		const __m256i packed = _mm256_packus_epi16(pack_nibbles_lanes_avx2(w0, swap, false),
+		                                           pack_nibbles_lanes_avx2(w1, swap, false));
+		_mm256_storeu_si256((__m256i *)&out[i], _mm256_permute4x64_epi64(packed, 0xD8));
+	}
+	return i;
+}
+
+// Rows 0-3 and 4-7 of a tile are packed into a register each, a row to
+// each 32 bits. Transposing those as 4x4 bytes turns each 32 bits into a
+// column of pairs, which are reordered, and the two halves joined.
+__attribute__((target("sse2")))
+static void pack_nibble_columns_sse2(const uint8_t *in, size_t tiles, uint8_t *out)
+{
+	for (size_t i = 0; i < tiles; i++)
+	{
+		const uint8_t *tile = &in[i * 8 * 8];
+		__m128i half[2];
+		for (int k = 0; k < 2; k++)
+		{
+			const __m128i w0 = _mm_loadu_si128((const __m128i *)&tile[k * 32]);
+			const __m128i w1 = _mm_loadu_si128((const __m128i *)&tile[(k * 32) + 16]);
+			const __m128i rows = _mm_packus_epi16(pack_nibbles_lanes_sse2(w0, true),
+			                                      pack_nibbles_lanes_sse2(w1, true));
+			const __m128i t = _mm_unpacklo_epi8(rows, _mm_srli_si128(rows, 8));
+			const __m128i cols = _mm_unpacklo_epi8(t, _mm_srli_si128(t, 8));
+			half[k] = _mm_shuffle_epi32(cols, _MM_SHUFFLE(1, 0, 3, 2));
+		}
+		_mm_storeu_si128((__m128i *)&out[i * 32], _mm_unpacklo_epi32(half[0], half[1]));
+		_mm_storeu_si128((__m128i *)&out[(i * 32) + 16], _mm_unpackhi_epi32(half[0], half[1]));
+	}
+}
+
+#endif  // CPU_X86
+
+void pxutil_pack_nibbles_isa(CpuIsa isa, const uint8_t *in, size_t pairs,
+                             bool swap, bool hi, uint8_t *out)
+{
+	size_t done = 0;
+#ifdef CPU_X86
+	if (isa == CPU_ISA_AVX2) done = pack_nibbles_avx2(in, pairs, swap, hi, out);
+	else if (isa == CPU_ISA_SSE2) done = pack_nibbles_sse2(in, pairs, swap, hi, out);
+#else
+	(void)isa;
+#endif  // CPU_X86
+	pack_nibbles_scalar(&in[done * 2], pairs - done, swap, hi, &out[hi ? done * 2 : done]);
+}
+
+void pxutil_pack_nibbles(const uint8_t *in, size_t pairs, bool swap, bool hi,
+                         uint8_t *out)
+{
+	pxutil_pack_nibbles_isa(cpu_isa_best(), in, pairs, swap, hi, out);
+}
+
+void pxutil_pack_nibble_columns_isa(CpuIsa isa, const uint8_t *in, size_t tiles,
+                                    uint8_t *out)
+{
+#ifdef CPU_X86
+	if (isa != CPU_ISA_SCALAR)
+	{
+		pack_nibble_columns_sse2(in, tiles, out);
+		return;
+	}
+#else
+	(void)isa;
+#endif  // CPU_X86
+	static const int column_pair_order_tbl[4] = {2, 3, 0, 1};
+	for (size_t i = 0; i < tiles; i++)
+	{
+		const uint8_t *tile = &in[i * 8 * 8];
+		for (int colset = 0; colset < 4; colset++)
+		{
+			const int source_x_offset = column_pair_order_tbl[colset] * 2;
+			for (int row = 0; row < 8; row++)
+			{
+				pack_nibbles_scalar(&tile[(row * 8) + source_x_offset], 1, true, false, out++);
+			}
+		}
+	}
+}
+
+void pxutil_pack_nibble_columns(const uint8_t *in, size_t tiles, uint8_t *out)
+{
+	pxutil_pack_nibble_columns_isa(cpu_isa_best(), in, tiles, out);
+}
+
 // Pass a pointer to eight pixels and linear data comes out.
 //
 // in: pointer to linear array of 8 pixels (one byte per)
@@ -1,8 +1,10 @@
 #ifndef PXUTIL_H
 #define PXUTIL_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include "cpu.h"
 
 
 // -----------------------------------------------------------------------------
@@ -39,6 +41,54 @@ void pxutil_rotate_tile(uint8_t *imgdat,
 bool pxutil_pack_planar(const uint8_t *in, int planes,
                         uint32_t order, bool reverse, uint8_t *out);
 
+// Packs count rows of eight pixels to planar data, as pxutil_pack_planar()
+// does each, several rows at a time where the CPU allows.
+//
+// in: pointer to the first row
+// in_stride: distance from each row to the next
+// count: number of rows
+// planes, order, reverse: as for pxutil_pack_planar()
+// invert: if true, every byte is emitted inverted, as CPS graphics are
+// out: pointer to destination buffer (count * planes in size), rows in order
+bool pxutil_pack_planar_rows(const uint8_t *in, size_t in_stride, size_t count,
+                             int planes, uint32_t order, bool reverse,
+                             bool invert, uint8_t *out);
+
+// As above, packed with isa, which has to be one the CPU has.
+bool pxutil_pack_planar_rows_isa(CpuIsa isa,
+                                 const uint8_t *in, size_t in_stride, size_t count,
+                                 int planes, uint32_t order, bool reverse,
+                                 bool invert, uint8_t *out);
+
+// Packs pairs of pixels into a byte each, the first pixel's low nibble over
+// the second's.
+//
+// in: pointer to pixels (one byte per, 2 * pairs in size)
+// pairs: number of pixel pairs
+// swap: if true, the second pixel of each pair goes on top, as for SP013
+// hi: if true, each byte is followed by another packing the pixels' high
+//     nibbles the same way, for 8bpp data split in two
+// out: pointer to destination buffer (pairs bytes, or 2 * pairs with hi)
+void pxutil_pack_nibbles(const uint8_t *in, size_t pairs, bool swap, bool hi,
+                         uint8_t *out);
+
+// As above, packed with isa, which has to be one the CPU has.
+void pxutil_pack_nibbles_isa(CpuIsa isa, const uint8_t *in, size_t pairs,
+                             bool swap, bool hi, uint8_t *out);
+
+// Packs 8x8 tiles as Neo-Geo fix tiles: pixel pairs packed as with swap
+// above, a column of pairs at a time from the top, taking the columns in
+// the order 2, 3, 0, 1.
+//
+// in: pointer to tiles of 8x8 pixels (one byte per)
+// tiles: number of tiles
+// out: pointer to destination buffer (32 * tiles in size)
+void pxutil_pack_nibble_columns(const uint8_t *in, size_t tiles, uint8_t *out);
+
+// As above, packed with isa, which has to be one the CPU has.
+void pxutil_pack_nibble_columns_isa(CpuIsa isa, const uint8_t *in, size_t tiles,
+                                    uint8_t *out);
+
 // Pass a pointer to eight pixels and linear data comes out.
 //
 // in: pointer to linear array of 8 pixels (one byte per)
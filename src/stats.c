@@ -0,0 +1,300 @@
+// For clock_gettime().
+#define _POSIX_C_SOURCE 200809L
+
+#include "stats.h"
+#include "format.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <time.h>
+
+static const char *kstring_for_phase[STATS_PHASE_COUNT] =
+{
+	[STATS_PHASE_LOAD]      = "load",
+	[STATS_PHASE_DECODE]    = "decode",
+	[STATS_PHASE_PAL]       = "pal",
+	[STATS_PHASE_READ]      = "read",
+	[STATS_PHASE_PAL_DEDUP] = "pal_dedup",
+	[STATS_PHASE_PACK]      = "pack",
+	[STATS_PHASE_META]      = "meta",
+};
+
+static int stats_thread(void)
+{
+	static atomic_int s_next_thread;
+	static _Thread_local int s_thread = -1;
+	if (s_thread < 0) s_thread = atomic_fetch_add(&s_next_thread, 1);
+	return s_thread;
+}
+
+uint64_t stats_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+void stats_phase(EntryStats *st, StatsPhase phase, uint64_t start)
+{
+	if (st->start_ns[phase] == 0) st->start_ns[phase] = start;
+	st->dur_ns[phase] += stats_now() - start;
+	st->thread[phase] = stats_thread();
+}
+
+void stats_phase_span(EntryStats *st, StatsPhase phase, uint64_t start, uint64_t dur)
+{
+	if (st->start_ns[phase] == 0) st->start_ns[phase] = start;
+	st->dur_ns[phase] += dur;
+	st->thread[phase] = stats_thread();
+
+	// The total above still counts a piece that can't be kept for the trace.
+	if (st->span_count >= st->span_cap)
+	{
+		const int cap = st->span_cap ? st->span_cap * 2 : 16;
+		StatsSpan *spans = realloc(st->spans, sizeof(*spans) * cap);
+		if (!spans) return;
+		st->spans = spans;
+		st->span_cap = cap;
+	}
+	st->spans[st->span_count++] = (StatsSpan){phase, st->thread[phase], start, dur};
+}
+
+void stats_free(EntryStats *st)
+{
+	free(st->spans);
+	st->spans = NULL;
+	st->span_count = 0;
+	st->span_cap = 0;
+}
+
+// Hardware sprites an entry takes up: one per frame for sprite formats, or
+// however many the composite needed.
+static int stats_sprites(const Entry *e)
+{
+	if (e->frame_cfg.data_format == DATA_FORMAT_MD_CSP) return e->md_csp.spr_count;
+	return format_desc(e->frame_cfg.data_format)->sprite ? e->frames : 0;
+}
+
+typedef struct StatsTotal
+{
+	int entries;
+	int cached;
+	int frames;
+	int tiles;
+	int sprites;
+	int pal_dedup;
+	size_t chr_bytes;
+	size_t pal_bytes;
+	size_t map_bytes;
+	uint64_t dur_ns[STATS_PHASE_COUNT];
+} StatsTotal;
+
+static void stats_total_add(StatsTotal *t, const Entry *e)
+{
+	t->entries++;
+	if (e->stats.cached) t->cached++;
+	t->frames += e->frames;
+	t->tiles += e->code_count;
+	t->sprites += stats_sprites(e);
+	if (e->pal_ref) t->pal_dedup++;
+	t->chr_bytes += e->stats.chr_bytes;
+	t->pal_bytes += e->stats.pal_bytes;
+	t->map_bytes += e->stats.map_bytes;
+	for (int i = 0; i < STATS_PHASE_COUNT; i++) t->dur_ns[i] += e->stats.dur_ns[i];
+}
+
+static void stats_print_row(FILE *f, const char *name, const char *fmt_name,
+                            const StatsTotal *t)
+{
+	fprintf(f, "%-24s %-11s %6d %6d %5d %9zu %6zu %6zu",
+	        name, fmt_name, t->frames, t->tiles, t->sprites,
+	        t->chr_bytes, t->pal_bytes, t->map_bytes);
+	for (int i = 0; i < STATS_PHASE_COUNT; i++)
+	{
+		fprintf(f, " %9.3f", t->dur_ns[i] / 1000000.0);
+	}
+	fprintf(f, "\n");
+}
+
+void stats_print(FILE *f, const StatsScript *scripts, int count, uint64_t wall_ns)
+{
+	fprintf(f, "%-24s %-11s %6s %6s %5s %9s %6s %6s",
+	        "Symbol", "Format", "Frames", "Tiles", "Spr", "CHR", "Pal", "Map");
+	for (int i = 0; i < STATS_PHASE_COUNT; i++) fprintf(f, " %9s", kstring_for_phase[i]);
+	fprintf(f, "\n");
+
+	StatsTotal by_format[DATA_FORMAT_COUNT] = {0};
+	StatsTotal all = {0};
+	for (int i = 0; i < count; i++)
+	{
+		if (count > 1) fprintf(f, "%s:\n", scripts[i].script);
+		for (const Entry *e = scripts[i].conv->entry_head; e; e = e->next)
+		{
+			StatsTotal t = {0};
+			stats_total_add(&t, e);
+			stats_total_add(&by_format[e->frame_cfg.data_format], e);
+			stats_total_add(&all, e);
+			stats_print_row(f, e->symbol, string_for_data_format(e->frame_cfg.data_format), &t);
+		}
+	}
+
+	fprintf(f, "\nBy format:\n");
+	for (DataFormat fmt = 0; fmt < DATA_FORMAT_COUNT; fmt++)
+	{
+		if (by_format[fmt].entries == 0) continue;
+		char name[32];
+		snprintf(name, sizeof(name), "(%d entries)", by_format[fmt].entries);
+		stats_print_row(f, name, string_for_data_format(fmt), &by_format[fmt]);
+	}
+	stats_print_row(f, "Total", "", &all);
+
+	fprintf(f, "\n%d entries, %d from cache, %d palettes shared; %.3f ms wall time (phase times are summed across threads, in ms).\n",
+	        all.entries, all.cached, all.pal_dedup, wall_ns / 1000000.0);
+}
+
+static void json_str(FILE *f, const char *str)
+{
+	fputc('"', f);
+	for (const unsigned char *c = (const unsigned char *)str; *c; c++)
+	{
+		if (*c == '"' || *c == '\\') fprintf(f, "\\%c", *c);
+		else if (*c < 0x20) fprintf(f, "\\u%04X", *c);
+		else fputc(*c, f);
+	}
+	fputc('"', f);
+}
+
+static void json_totals(FILE *f, const StatsTotal *t)
+{
+	fprintf(f, "\"entries\": %d, \"cached\": %d, \"frames\": %d, \"tiles\": %d, "
+	        "\"sprites\": %d, \"pal_dedup\": %d, \"chr_bytes\": %zu, \"pal_bytes\": %zu, "
+	        "\"map_bytes\": %zu, \"time_us\": {",
+	        t->entries, t->cached, t->frames, t->tiles, t->sprites, t->pal_dedup,
+	        t->chr_bytes, t->pal_bytes, t->map_bytes);
+	for (int i = 0; i < STATS_PHASE_COUNT; i++)
+	{
+		fprintf(f, "%s\"%s\": %.3f", i ? ", " : "", kstring_for_phase[i], t->dur_ns[i] / 1000.0);
+	}
+	fprintf(f, "}");
+}
+
+bool stats_write_json(const char *fname, const StatsScript *scripts, int count,
+                      uint64_t wall_ns)
+{
+	FILE *f = fopen(fname, "w");
+	if (!f)
+	{
+		fprintf(stderr, "Couldn't open %s for writing\n", fname);
+		return false;
+	}
+
+	StatsTotal by_format[DATA_FORMAT_COUNT] = {0};
+	StatsTotal all = {0};
+	fprintf(f, "{\n\"entries\": [");
+	bool first = true;
+	for (int i = 0; i < count; i++)
+	{
+		for (const Entry *e = scripts[i].conv->entry_head; e; e = e->next)
+		{
+			StatsTotal t = {0};
+			stats_total_add(&t, e);
+			stats_total_add(&by_format[e->frame_cfg.data_format], e);
+			stats_total_add(&all, e);
+
+			fprintf(f, "%s\n  {\"script\": ", first ? "" : ",");
+			json_str(f, scripts[i].script);
+			fprintf(f, ", \"symbol\": ");
+			json_str(f, e->symbol);
+			fprintf(f, ", \"src\": ");
+			json_str(f, e->src);
+			fprintf(f, ", \"format\": \"%s\", ", string_for_data_format(e->frame_cfg.data_format));
+			json_totals(f, &t);
+			fprintf(f, "}");
+			first = false;
+		}
+	}
+	fprintf(f, "\n],\n\"formats\": {");
+	first = true;
+	for (DataFormat fmt = 0; fmt < DATA_FORMAT_COUNT; fmt++)
+	{
+		if (by_format[fmt].entries == 0) continue;
+		fprintf(f, "%s\n  \"%s\": {", first ? "" : ",", string_for_data_format(fmt));
+		json_totals(f, &by_format[fmt]);
+		fprintf(f, "}");
+		first = false;
+	}
+	fprintf(f, "\n},\n\"total\": {");
+	json_totals(f, &all);
+	fprintf(f, "},\n\"wall_us\": %.3f\n}\n", wall_ns / 1000.0);
+
+	const bool ret = (fclose(f) == 0);
+	if (!ret) fprintf(stderr, "Couldn't write %s\n", fname);
+	return ret;
+}
+
+static void stats_trace_event(FILE *f, bool *first, const char *script, const Entry *e,
+                              StatsPhase phase, uint64_t start, uint64_t dur, int thread)
+{
+	fprintf(f, "%s\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", "
+	        "\"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": %d, \"args\": {\"symbol\": ",
+	        *first ? "" : ",", kstring_for_phase[phase],
+	        string_for_data_format(e->frame_cfg.data_format), start / 1000.0, dur / 1000.0,
+	        thread);
+	json_str(f, e->symbol);
+	fprintf(f, ", \"script\": ");
+	json_str(f, script);
+	fprintf(f, "}}");
+	*first = false;
+}
+
+bool stats_write_trace(const char *fname, const StatsScript *scripts, int count)
+{
+	FILE *f = fopen(fname, "w");
+	if (!f)
+	{
+		fprintf(stderr, "Couldn't open %s for writing\n", fname);
+		return false;
+	}
+
+	// Times are given relative to the first phase of any entry.
+	uint64_t base = UINT64_MAX;
+	for (int i = 0; i < count; i++)
+	{
+		for (const Entry *e = scripts[i].conv->entry_head; e; e = e->next)
+		{
+			for (int p = 0; p < STATS_PHASE_COUNT; p++)
+			{
+				if (e->stats.start_ns[p] && e->stats.start_ns[p] < base) base = e->stats.start_ns[p];
+			}
+		}
+	}
+
+	fprintf(f, "{\"traceEvents\": [");
+	bool first = true;
+	for (int i = 0; i < count; i++)
+	{
+		for (const Entry *e = scripts[i].conv->entry_head; e; e = e->next)
+		{
+			// A phase that ran in pieces is shown as those pieces.
+			bool split[STATS_PHASE_COUNT] = {false};
+			for (int s = 0; s < e->stats.span_count; s++)
+			{
+				const StatsSpan *span = &e->stats.spans[s];
+				split[span->phase] = true;
+				stats_trace_event(f, &first, scripts[i].script, e, span->phase,
+				                  span->start_ns - base, span->dur_ns, span->thread);
+			}
+			for (int p = 0; p < STATS_PHASE_COUNT; p++)
+			{
+				if (!e->stats.start_ns[p] || split[p]) continue;
+				stats_trace_event(f, &first, scripts[i].script, e, p,
+				                  e->stats.start_ns[p] - base, e->stats.dur_ns[p],
+				                  e->stats.thread[p]);
+			}
+		}
+	}
+	fprintf(f, "\n]}\n");
+
+	const bool ret = (fclose(f) == 0);
+	if (!ret) fprintf(stderr, "Couldn't write %s\n", fname);
+	return ret;
+}
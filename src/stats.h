@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "types.h"
+
+//
+// Timing and size statistics for converted entries.
+//
+// Each entry records how long its phases took in its EntryStats as it is
+// converted and emitted. The reports below summarize them for one or more
+// scripts once everything has been written.
+//
+
+// Monotonic time in nanoseconds.
+uint64_t stats_now(void);
+
+// Records that a phase of work on an entry ran from start until now.
+void stats_phase(EntryStats *st, StatsPhase phase, uint64_t start);
+
+// Records one piece of a phase that ran for dur from start. The pieces are
+// added up like stats_phase(), and each one is its own event in the trace.
+void stats_phase_span(EntryStats *st, StatsPhase phase, uint64_t start, uint64_t dur);
+
+// Frees the pieces recorded by stats_phase_span().
+void stats_free(EntryStats *st);
+
+// Scripts to report on.
+typedef struct StatsScript
+{
+	const char *script;
+	const Conv *conv;
+} StatsScript;
+
+// Readable summary: every entry, then totals for each format.
+void stats_print(FILE *f, const StatsScript *scripts, int count, uint64_t wall_ns);
+
+// The same data as JSON.
+bool stats_write_json(const char *fname, const StatsScript *scripts, int count,
+                      uint64_t wall_ns);
+
+// Phases of every entry as a Chrome trace event timeline (chrome://tracing).
+bool stats_write_trace(const char *fname, const StatsScript *scripts, int count);
@@ -3,6 +3,8 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
+#include "transpose.h"
 
 enum
 {
@@ -23,6 +25,10 @@ static inline uint8_t *tile_read_frame(uint8_t *px,
                                        int tilesize, int angle,
                                        int lim_x, int lim_y,
                                        uint32_t flags, uint8_t *chr_w);
+static inline uint8_t *tile_read_lines(uint8_t *px, int png_w,
+                                       int png_x, int png_y,
+                                       int sw_adj, int sh_adj,
+                                       int angle, uint8_t *chr_w);
 
 
 
@@ -32,11 +38,93 @@ static inline uint8_t *tile_read_frame(uint8_t *px,
 // #define TILEREAD_DEBUG_OUT
 
 
+// Readers for each angle. Only the top-left w_in x h_in pixels of the tile
+// are inside the frame; the rest read as 0. Each output row is handled as
+// runs of zeroes and pixels rather than pixel by pixel, and erase is
+// constant wherever these are inlined.
+
+// Rows are copied as they are.
+static inline uint8_t *tile_read_tile_0(uint8_t *px_frame, int src_w, int tw, int th,
+                                        int w_in, int h_in, bool erase, uint8_t *chr_w)
+{
+	for (int y = 0; y < h_in; y++)
+	{
+		uint8_t *src = &px_frame[y * src_w];
+		memcpy(chr_w, src, w_in);
+		if (erase) memset(src, 0, w_in);
+		memset(&chr_w[w_in], 0, tw - w_in);
+		chr_w += tw;
+	}
+	memset(chr_w, 0, (size_t)(th - h_in) * tw);
+	return chr_w + ((size_t)(th - h_in) * tw);
+}
+
+// Rows are copied backwards, bottom row first.
+static inline uint8_t *tile_read_tile_180(uint8_t *px_frame, int src_w, int tw, int th,
+                                          int w_in, int h_in, bool erase, uint8_t *chr_w)
+{
+	memset(chr_w, 0, (size_t)(th - h_in) * tw);
+	chr_w += (size_t)(th - h_in) * tw;
+	for (int y = h_in - 1; y >= 0; y--)
+	{
+		uint8_t *src = &px_frame[y * src_w];
+		memset(chr_w, 0, tw - w_in);
+		chr_w += tw - w_in;
+		for (int x = w_in - 1; x >= 0; x--)
+		{
+			*chr_w++ = src[x];
+			if (erase) src[x] = 0;
+		}
+	}
+	return chr_w;
+}
+
+// Erases what the readers below took from the frame.
+static inline void tile_read_erase(uint8_t *px_frame, int src_w, int w_in, int h_in)
+{
+	for (int y = 0; y < h_in; y++) memset(&px_frame[y * src_w], 0, w_in);
+}
+
+// Each output row is a column, from the right, read top to bottom: the
+// frame transposed into the output from its last row up.
+static inline uint8_t *tile_read_tile_90(uint8_t *px_frame, int src_w, int tw, int th,
+                                         int w_in, int h_in, bool erase, uint8_t *chr_w)
+{
+	memset(chr_w, 0, (size_t)(tw - w_in) * th);
+	transpose_block(px_frame, src_w, &chr_w[(size_t)(tw - 1) * th], -th, w_in, h_in);
+	if (h_in < th)
+	{
+		for (int x = tw - w_in; x < tw; x++) memset(&chr_w[(x * th) + h_in], 0, th - h_in);
+	}
+	if (erase) tile_read_erase(px_frame, src_w, w_in, h_in);
+	return chr_w + ((size_t)tw * th);
+}
+
+// Each output row is a column, from the left, read bottom to top: the frame
+// transposed from its last row up.
+static inline uint8_t *tile_read_tile_270(uint8_t *px_frame, int src_w, int tw, int th,
+                                          int w_in, int h_in, bool erase, uint8_t *chr_w)
+{
+	if (h_in > 0)
+	{
+		transpose_block(&px_frame[(h_in - 1) * src_w], -src_w,
+		                &chr_w[th - h_in], th, w_in, h_in);
+	}
+	if (h_in < th)
+	{
+		for (int x = 0; x < w_in; x++) memset(&chr_w[x * th], 0, th - h_in);
+	}
+	memset(&chr_w[(size_t)w_in * th], 0, (size_t)(tw - w_in) * th);
+	if (erase) tile_read_erase(px_frame, src_w, w_in, h_in);
+	return chr_w + ((size_t)tw * th);
+}
+
 // px_frame: source image data (top left)
 // src_w: source image width
 // src_h: source image height
 // tw: width
 // th: height
+// tw_lim, th_lim: pixels past these read as 0
 // angle: rotation angle (90 degree only)
 // chr_w: handle to output buffer
 // returns new output buffer handle, advanced by pixel count (sw * sh)
@@ -46,69 +134,53 @@ static inline uint8_t *tile_read_tile(uint8_t *px_frame, int src_w,
                                       int angle,
                                       uint32_t flags, uint8_t *chr_w)
 {
-	const bool yoko = ((angle == 0) || (angle == 180));
-	const int touter_lim = yoko ? th : tw;
-	const int tinner_lim = yoko ? tw : th;
-
 	// The inner and outer iteration order is based on the orientation
 	// of the sprite, as in general the hardware works in yoko terms.
-
-	// Tile outer iteration
-	for (int to = 0; to < touter_lim; to++)  // h in yoko, w in tate
+	// Single pixels, as SP013 reads, aren't worth setting up runs for.
+	if (tw == 1 && th == 1)
 	{
-		// Tile inner iteration
-		for (int ti = 0; ti < tinner_lim; ti++)  // w in yoko, h in tate
-		{
-			// Index calculation.
-			int yoffs = 0;
-			int xoffs = 0;
-			switch (angle)
-			{
-				case 0:
-					yoffs = to;
-					xoffs = ti;
-					break;
-				case 270:
-					xoffs = to;
-					yoffs = th - 1 - ti;
-					break;
-				case 180:
-					yoffs = th - 1 - to;
-					xoffs = tw - 1 - ti;
-					break;
-				case 90:
-					xoffs = tw - 1 - to;
-					yoffs = ti;
-					break;
-				default:
-					break;
-			}
-
-			if (xoffs >= tw_lim || yoffs >= th_lim)
-			{
-				*chr_w++ = 0;
-#ifdef TILEREAD_DEBUG_OUT
-				printf(" ");
-#endif  // TILEREAD_DEBUG_OUT
-			}
-			else
-			{
-				const unsigned int px_idx = (yoffs*src_w) + xoffs;
-				const uint8_t pixel = px_frame[px_idx];
-				*chr_w++ = pixel;
-				if (flags & TILE_READ_FLAG_ERASE) px_frame[px_idx] = 0;
-#ifdef TILEREAD_DEBUG_OUT
-				printf("%c", pixel == 0 ? ' ' : '0' + pixel);
-#endif  // TILEREAD_DEBUG_OUT
-			};
+		const bool in = (tw_lim > 0 && th_lim > 0);
+		*chr_w = in ? *px_frame : 0;
+		if (in && (flags & TILE_READ_FLAG_ERASE)) *px_frame = 0;
+		return chr_w + 1;
+	}
 
-		}
+	const int w_in = (tw_lim < 0) ? 0 : ((tw_lim > tw) ? tw : tw_lim);
+	const int h_in = (th_lim < 0) ? 0 : ((th_lim > th) ? th : th_lim);
+	const bool erase = flags & TILE_READ_FLAG_ERASE;
+	uint8_t *ret;
+	switch (angle)
+	{
+		// Angles are checked by conv_validate().
+		default:
+		case 0:
+			ret = erase ? tile_read_tile_0(px_frame, src_w, tw, th, w_in, h_in, true, chr_w)
+			            : tile_read_tile_0(px_frame, src_w, tw, th, w_in, h_in, false, chr_w);
+			break;
+		case 90:
+			ret = erase ? tile_read_tile_90(px_frame, src_w, tw, th, w_in, h_in, true, chr_w)
+			            : tile_read_tile_90(px_frame, src_w, tw, th, w_in, h_in, false, chr_w);
+			break;
+		case 180:
+			ret = erase ? tile_read_tile_180(px_frame, src_w, tw, th, w_in, h_in, true, chr_w)
+			            : tile_read_tile_180(px_frame, src_w, tw, th, w_in, h_in, false, chr_w);
+			break;
+		case 270:
+			ret = erase ? tile_read_tile_270(px_frame, src_w, tw, th, w_in, h_in, true, chr_w)
+			            : tile_read_tile_270(px_frame, src_w, tw, th, w_in, h_in, false, chr_w);
+			break;
+	}
 
 #ifdef TILEREAD_DEBUG_OUT
-		printf("\n");
-#endif  // TILEREAD_DEBUG_OUT
+	const bool yoko = ((angle == 0) || (angle == 180));
+	const int tinner_lim = yoko ? tw : th;
+	for (const uint8_t *p = chr_w; p < ret; p++)
+	{
+		printf("%c", *p == 0 ? ' ' : '0' + *p);
+		if ((p - chr_w) % tinner_lim == tinner_lim - 1) printf("\n");
 	}
-	return chr_w;
+#endif  // TILEREAD_DEBUG_OUT
+	return ret;
 }
 
 static inline void get_tx_ty(int tile_inner, int tile_inner_count,
@@ -251,3 +323,63 @@ static inline uint8_t *tile_read_frame(uint8_t *px,
 	}
 	return chr_w;
 }
+
+// Reads a frame laid out a line at a time, as SP013 is. The output is the
+// same as tile_read_frame() with a tilesize of 1, no limits and no flags,
+// but taken as whole rows and columns instead of a pixel at a time.
+static inline uint8_t *tile_read_lines(uint8_t *px, int png_w,
+                                       int png_x, int png_y,
+                                       int sw_adj, int sh_adj,
+                                       int angle, uint8_t *chr_w)
+{
+	uint8_t *px_frame = &px[(png_y * sh_adj * png_w) + (png_x * sw_adj)];
+	switch (angle)
+	{
+		// Angles are checked by conv_validate().
+		default:
+		case 0:
+			for (int y = 0; y < sh_adj; y++)
+			{
+				memcpy(chr_w, &px_frame[y * png_w], sw_adj);
+				chr_w += sw_adj;
+			}
+			break;
+
+		// tile_read_frame() reads the same line for every column at 90
+		// degrees, as get_tx_ty() takes both x and y from the inner index:
+		// one pixel from each row, walking left from x = sh_adj - 1.
+		case 90:
+			if (sw_adj <= 0) break;
+			for (int y = 0; y < sh_adj; y++)
+			{
+				chr_w[y] = px_frame[(y * png_w) + (sh_adj - 1 - y)];
+			}
+			for (int x = 1; x < sw_adj; x++)
+			{
+				memcpy(&chr_w[x * sh_adj], chr_w, sh_adj);
+			}
+			chr_w += sw_adj * sh_adj;
+			break;
+
+		case 180:
+			for (int y = sh_adj - 1; y >= 0; y--)
+			{
+				const uint8_t *src = &px_frame[y * png_w];
+				for (int x = sw_adj - 1; x >= 0; x--) *chr_w++ = src[x];
+			}
+			break;
+
+		case 270:
+			for (int x = 0; x < sw_adj; x++)
+			{
+				const uint8_t *src = &px_frame[((sh_adj - 1) * png_w) + x];
+				for (int y = 0; y < sh_adj; y++)
+				{
+					*chr_w++ = *src;
+					src -= png_w;
+				}
+			}
+			break;
+	}
+	return chr_w;
+}
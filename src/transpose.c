@@ -0,0 +1,199 @@
+#include "transpose.h"
+
+#ifdef CPU_X86
+#include <immintrin.h>
+#endif
+
+// Column x of a w x h block of src goes to row x of dst.
+static void transpose_scalar(const uint8_t *src, ptrdiff_t src_stride,
+                             uint8_t *dst, ptrdiff_t dst_stride,
+                             int w, int h)
+{
+	for (int x = 0; x < w; x++)
+	{
+		const uint8_t *s = &src[x];
+		uint8_t *d = &dst[x * dst_stride];
+		for (int y = 0; y < h; y++)
+		{
+			d[y] = *s;
+			s += src_stride;
+		}
+	}
+}
+
+#ifdef CPU_X86
+
+// Interleaving rows a byte, then two, then four at a time leaves d[k]
+// holding columns 2k and 2k + 1, eight bytes each.
+__attribute__((target("sse2")))
+static void transpose_8x8_sse2(const uint8_t *src, ptrdiff_t src_stride,
+                               uint8_t *dst, ptrdiff_t dst_stride)
+{
+	__m128i a[8];
+	for (int y = 0; y < 8; y++)
+	{
+		a[y] = _mm_loadl_epi64((const __m128i *)&src[y * src_stride]);
+	}
+	const __m128i b0 = _mm_unpacklo_epi8(a[0], a[1]);
+	const __m128i b1 = _mm_unpacklo_epi8(a[2], a[3]);
+	const __m128i b2 = _mm_unpacklo_epi8(a[4], a[5]);
+	const __m128i b3 = _mm_unpacklo_epi8(a[6], a[7]);
+	const __m128i c0 = _mm_unpacklo_epi16(b0, b1);
+	const __m128i c1 = _mm_unpackhi_epi16(b0, b1);
+	const __m128i c2 = _mm_unpacklo_epi16(b2, b3);
+	const __m128i c3 = _mm_unpackhi_epi16(b2, b3);
+	const __m128i d[4] =
+	{
+		_mm_unpacklo_epi32(c0, c2),
+		_mm_unpackhi_epi32(c0, c2),
+		_mm_unpacklo_epi32(c1, c3),
+		_mm_unpackhi_epi32(c1, c3),
+	};
+	for (int k = 0; k < 4; k++)
+	{
+		_mm_storel_epi64((__m128i *)&dst[(2 * k) * dst_stride], d[k]);
+		_mm_storel_epi64((__m128i *)&dst[(2 * k + 1) * dst_stride],
+		                 _mm_unpackhi_epi64(d[k], d[k]));
+	}
+}
+
+// As above for eight rows of sixteen, leaving columns 2k and 2k + 1 in d[k].
+// Works the same within each lane of an AVX2 register.
+#define TRANSPOSE_8X16(T, S, a, d) \
+	do \
+	{ \
+		const T b0 = S##unpacklo_epi8(a[0], a[1]); \
+		const T b1 = S##unpackhi_epi8(a[0], a[1]); \
+		const T b2 = S##unpacklo_epi8(a[2], a[3]); \
+		const T b3 = S##unpackhi_epi8(a[2], a[3]); \
+		const T b4 = S##unpacklo_epi8(a[4], a[5]); \
+		const T b5 = S##unpackhi_epi8(a[4], a[5]); \
+		const T b6 = S##unpacklo_epi8(a[6], a[7]); \
+		const T b7 = S##unpackhi_epi8(a[6], a[7]); \
+		const T c0 = S##unpacklo_epi16(b0, b2); \
+		const T c1 = S##unpackhi_epi16(b0, b2); \
+		const T c2 = S##unpacklo_epi16(b1, b3); \
+		const T c3 = S##unpackhi_epi16(b1, b3); \
+		const T c4 = S##unpacklo_epi16(b4, b6); \
+		const T c5 = S##unpackhi_epi16(b4, b6); \
+		const T c6 = S##unpacklo_epi16(b5, b7); \
+		const T c7 = S##unpackhi_epi16(b5, b7); \
+		d[0] = S##unpacklo_epi32(c0, c4); \
+		d[1] = S##unpackhi_epi32(c0, c4); \
+		d[2] = S##unpacklo_epi32(c1, c5); \
+		d[3] = S##unpackhi_epi32(c1, c5); \
+		d[4] = S##unpacklo_epi32(c2, c6); \
+		d[5] = S##unpackhi_epi32(c2, c6); \
+		d[6] = S##unpacklo_epi32(c3, c7); \
+		d[7] = S##unpackhi_epi32(c3, c7); \
+	} while (0)
+
+// The top and bottom halves are done as above, and their columns joined.
+__attribute__((target("sse2")))
+static void transpose_16x16_sse2(const uint8_t *src, ptrdiff_t src_stride,
+                                 uint8_t *dst, ptrdiff_t dst_stride)
+{
+	__m128i a[8];
+	__m128i top[8];
+	__m128i bottom[8];
+	for (int y = 0; y < 8; y++)
+	{
+		a[y] = _mm_loadu_si128((const __m128i *)&src[y * src_stride]);
+	}
+	TRANSPOSE_8X16(__m128i, _mm_, a, top);
+	for (int y = 0; y < 8; y++)
+	{
+		a[y] = _mm_loadu_si128((const __m128i *)&src[(y + 8) * src_stride]);
+	}
+	TRANSPOSE_8X16(__m128i, _mm_, a, bottom);
+	for (int k = 0; k < 8; k++)
+	{
+		_mm_storeu_si128((__m128i *)&dst[(2 * k) * dst_stride],
+		                 _mm_unpacklo_epi64(top[k], bottom[k]));
+		_mm_storeu_si128((__m128i *)&dst[(2 * k + 1) * dst_stride],
+		                 _mm_unpackhi_epi64(top[k], bottom[k]));
+	}
+}
+
+// Rows y and y + 8 share a register, one per lane, so both halves are done
+// at once. Each d[k] then holds columns 2k and 2k + 1 of the top half in
+// its low lane and of the bottom half in its high lane; swapping the middle
+// quarters makes those two output rows.
+__attribute__((target("avx2")))
+static void transpose_16x16_avx2(const uint8_t *src, ptrdiff_t src_stride,
+                                 uint8_t *dst, ptrdiff_t dst_stride)
+{
+	__m256i a[8];
+	__m256i d[8];
+	for (int y = 0; y < 8; y++)
+	{
+		const __m128i lo = _mm_loadu_si128((const __m128i *)&src[y * src_stride]);
+		const __m128i hi = _mm_loadu_si128((const __m128i *)&src[(y + 8) * src_stride]);
+		a[y] = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+	}
+	TRANSPOSE_8X16(__m256i, _mm256_, a, d);
+	for (int k = 0; k < 8; k++)
+	{
+		const __m256i rows = _mm256_permute4x64_epi64(d[k], 0xD8);
+		_mm_storeu_si128((__m128i *)&dst[(2 * k) * dst_stride],
+		                 _mm256_castsi256_si128(rows));
+		_mm_storeu_si128((__m128i *)&dst[(2 * k + 1) * dst_stride],
+		                 _mm256_extracti128_si256(rows, 1));
+	}
+}
+
+#endif  // CPU_X86
+
+void transpose_block_isa(CpuIsa isa,
+                         const uint8_t *src, ptrdiff_t src_stride,
+                         uint8_t *dst, ptrdiff_t dst_stride,
+                         int w, int h)
+{
+#ifdef CPU_X86
+	if (isa != CPU_ISA_SCALAR)
+	{
+		void (*t16)(const uint8_t *, ptrdiff_t, uint8_t *, ptrdiff_t) =
+		    (isa == CPU_ISA_AVX2) ? transpose_16x16_avx2 : transpose_16x16_sse2;
+		// Block (x, y) of src is block (y, x) of dst.
+		int y = 0;
+		for (; y + 8 <= h; )
+		{
+			const int bh = (y + 16 <= h) ? 16 : 8;
+			int x = 0;
+			for (; x + 8 <= w; )
+			{
+				const uint8_t *s = &src[(y * src_stride) + x];
+				uint8_t *d = &dst[(x * dst_stride) + y];
+				if (bh == 16 && x + 16 <= w)
+				{
+					t16(s, src_stride, d, dst_stride);
+					x += 16;
+					continue;
+				}
+				transpose_8x8_sse2(s, src_stride, d, dst_stride);
+				if (bh == 16)
+				{
+					transpose_8x8_sse2(&s[8 * src_stride], src_stride, &d[8], dst_stride);
+				}
+				x += 8;
+			}
+			transpose_scalar(&src[(y * src_stride) + x], src_stride,
+			                 &dst[(x * dst_stride) + y], dst_stride, w - x, bh);
+			y += bh;
+		}
+		src = &src[y * src_stride];
+		dst = &dst[y];
+		h -= y;
+	}
+#else
+	(void)isa;
+#endif  // CPU_X86
+	transpose_scalar(src, src_stride, dst, dst_stride, w, h);
+}
+
+void transpose_block(const uint8_t *src, ptrdiff_t src_stride,
+                     uint8_t *dst, ptrdiff_t dst_stride,
+                     int w, int h)
+{
+	transpose_block_isa(cpu_isa_best(), src, src_stride, dst, dst_stride, w, h);
+}
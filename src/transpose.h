@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "cpu.h"
+
+//
+// Byte matrix transposes, for reading tiles at 90 and 270 degrees.
+//
+// A w x h block of src becomes an h x w block of dst: column x of src, read
+// top to bottom, is row x of dst. Either stride may be negative, which flips
+// that side, so both rotations are a transpose. Blocks are taken 16x16 and
+// 8x8 at a time with SSE2 or AVX2 where the CPU has them, and the edges that
+// don't fit a byte at a time.
+//
+
+// Transposes with isa, which has to be one the CPU has.
+void transpose_block_isa(CpuIsa isa,
+                         const uint8_t *src, ptrdiff_t src_stride,
+                         uint8_t *dst, ptrdiff_t dst_stride,
+                         int w, int h);
+
+// Transposes with cpu_isa_best().
+void transpose_block(const uint8_t *src, ptrdiff_t src_stride,
+                     uint8_t *dst, ptrdiff_t dst_stride,
+                     int w, int h);
@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "format.h"
+#include "outfile.h"
 #include "pal.h"
 
 //
@@ -53,12 +54,50 @@ typedef struct MdCspSpr
 	int16_t flip_dx, flip_dy;
 } MdCspSpr;
 
+// Phases of work timed for each entry, for --stats.
+typedef enum StatsPhase
+{
+	STATS_PHASE_LOAD,       // Reading the source file.
+	STATS_PHASE_DECODE,     // Decoding the PNG.
+	STATS_PHASE_PAL,        // Packing the palette.
+	STATS_PHASE_READ,       // Reading tiles and claiming sprites.
+	STATS_PHASE_PAL_DEDUP,  // Looking for an identical earlier palette.
+	STATS_PHASE_PACK,       // Packing CHR data for output.
+	STATS_PHASE_META,       // Palette, mapping and header output.
+	STATS_PHASE_COUNT
+} StatsPhase;
+
+// One piece of a phase that ran in several, such as decoding a band of rows.
+typedef struct StatsSpan
+{
+	StatsPhase phase;
+	int thread;
+	uint64_t start_ns;
+	uint64_t dur_ns;
+} StatsSpan;
+
+typedef struct EntryStats
+{
+	uint64_t start_ns[STATS_PHASE_COUNT];  // Zero if the phase didn't run.
+	uint64_t dur_ns[STATS_PHASE_COUNT];
+	int thread[STATS_PHASE_COUNT];         // Small ID of the thread that ran it.
+	StatsSpan *spans;  // Pieces of phases that ran in several, for the trace.
+	int span_count;
+	int span_cap;
+	bool cached;       // Taken from the cache or a previous build.
+	size_t chr_bytes;  // Bytes written to each output.
+	size_t pal_bytes;
+	size_t map_bytes;
+} EntryStats;
+
 typedef struct Entry Entry;
 struct Entry
 {
 	int id;
 	char symbol[256];  // Symbol name as enumerated
 	char symbol_upper[256];
+	char src[256];  // Source image filename.
+	uint64_t key;   // Hash of the source image and conversion settings.
 	uint16_t pal[256];
 	int pal_size;
 	Entry *pal_ref;  // Pointer to pre-existing entry with the same palette.
@@ -70,6 +109,8 @@ struct Entry
 
 	// Starting code and code increment per frame / element.
 	uint32_t code_per;
+	uint32_t code_count;  // Total code increment over all frames.
+	bool code_set;        // Starting code was set by the script, not carried over.
 	int frames;
 
 	// DataFormat-specific things.
@@ -115,8 +156,14 @@ struct Entry
 	// Mapping.
 	size_t map_offs;
 	size_t map_bytes;
+
+	EntryStats stats;
 };
 
+typedef struct ImgCache ImgCache;
+typedef struct PalCache PalCache;
+typedef struct Writer Writer;
+
 // State for the conversion process.
 typedef struct Conv
 {
@@ -132,6 +179,18 @@ typedef struct Conv
 	char src[256];           // Source image filename.
 	char symbol[256];        // Symbol name (section).
 	FrameCfg frame_cfg;
+	bool code_set;           // Code was set since the last entry was added.
+
+	int jobs;                // Worker threads used for conversion.
+	char cache_dir[256];     // Converted entry cache directory; empty if unused.
+	ImgCache *imgcache;      // Shared source image cache, if any.
+	PalCache *palcache;      // Shared packed palette cache, if any.
+	Entry *prev_head;        // Entries from a previous run, reused if unchanged.
+	bool key_entries;        // Key entries by their source and settings, to find
+	                         // them in the cache or a later --watch build.
+	OutFile out_chr;         // CHR output, opened before conversion.
+	bool stream_chr;         // CHR is written to out_chr during conversion.
+	bool stream_rows;        // Decode images a row of frames at a time if possible.
 
 	size_t chr_pos;
 	size_t map_pos;
@@ -0,0 +1,166 @@
+#include "watch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#define WATCH_EVENT_MASK (IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE)
+// Changes are collected until none have arrived for this long.
+#define WATCH_SETTLE_MS 100
+
+bool watch_init(Watch *w)
+{
+	memset(w, 0, sizeof(*w));
+	w->fd = inotify_init1(IN_CLOEXEC);
+	if (w->fd < 0)
+	{
+		fprintf(stderr, "[WATCH] Couldn't initialize inotify\n");
+		return false;
+	}
+	return true;
+}
+
+void watch_shutdown(Watch *w)
+{
+	if (w->fd >= 0) close(w->fd);
+	free(w->files);
+	memset(w, 0, sizeof(*w));
+	w->fd = -1;
+}
+
+bool watch_set_files(Watch *w, const char **paths, int count)
+{
+	// Starting over with a new instance drops all of the old watches.
+	close(w->fd);
+	free(w->files);
+	w->file_count = 0;
+	w->files = calloc(sizeof(*w->files), count ? count : 1);
+	w->fd = inotify_init1(IN_CLOEXEC);
+	if (!w->files || w->fd < 0)
+	{
+		fprintf(stderr, "[WATCH] Couldn't set up watches\n");
+		return false;
+	}
+
+	for (int i = 0; i < count; i++)
+	{
+		bool dupe = false;
+		for (int j = 0; j < w->file_count && !dupe; j++)
+		{
+			if (strcmp(w->files[j].path, paths[i]) == 0) dupe = true;
+		}
+		if (dupe) continue;
+
+		WatchFile *wf = &w->files[w->file_count];
+		snprintf(wf->path, sizeof(wf->path), "%s", paths[i]);
+
+		char dir[sizeof(wf->path)];
+		snprintf(dir, sizeof(dir), "%s", paths[i]);
+		char *slash = strrchr(dir, '/');
+		if (slash)
+		{
+			slash[slash == dir ? 1 : 0] = '\0';
+			wf->name = &wf->path[(slash - dir) + 1];
+		}
+		else
+		{
+			strcpy(dir, ".");
+			wf->name = wf->path;
+		}
+
+		// Adding the same directory again just returns the existing watch.
+		wf->wd = inotify_add_watch(w->fd, dir, WATCH_EVENT_MASK);
+		if (wf->wd < 0)
+		{
+			fprintf(stderr, "[WATCH] Couldn't watch %s\n", dir);
+			continue;
+		}
+		w->file_count++;
+	}
+	return true;
+}
+
+bool watch_wait(Watch *w, WatchFunc func, void *ctx)
+{
+	bool *changed = calloc(sizeof(*changed), w->file_count ? w->file_count : 1);
+	if (!changed) return false;
+
+	bool any = false;
+	int timeout = -1;  // Block until the first change.
+	for (;;)
+	{
+		struct pollfd pfd = {.fd = w->fd, .events = POLLIN};
+		const int pret = poll(&pfd, 1, timeout);
+		if (pret < 0)
+		{
+			fprintf(stderr, "[WATCH] poll failed\n");
+			free(changed);
+			return false;
+		}
+		if (pret == 0) break;  // Settled.
+
+		char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+		const ssize_t len = read(w->fd, buf, sizeof(buf));
+		if (len <= 0)
+		{
+			fprintf(stderr, "[WATCH] read failed\n");
+			free(changed);
+			return false;
+		}
+
+		for (char *p = buf; p < buf + len; )
+		{
+			const struct inotify_event *ev = (const struct inotify_event *)p;
+			p += sizeof(*ev) + ev->len;
+			if (ev->len == 0) continue;
+			for (int i = 0; i < w->file_count; i++)
+			{
+				if (w->files[i].wd != ev->wd) continue;
+				if (strcmp(w->files[i].name, ev->name) != 0) continue;
+				changed[i] = true;
+				any = true;
+			}
+		}
+
+		if (any) timeout = WATCH_SETTLE_MS;
+	}
+
+	for (int i = 0; i < w->file_count; i++)
+	{
+		if (changed[i]) func(ctx, w->files[i].path);
+	}
+	free(changed);
+	return true;
+}
+
+#else
+
+bool watch_init(Watch *w)
+{
+	memset(w, 0, sizeof(*w));
+	fprintf(stderr, "[WATCH] Watching files is not supported on this platform\n");
+	return false;
+}
+
+void watch_shutdown(Watch *w)
+{
+	free(w->files);
+	memset(w, 0, sizeof(*w));
+}
+
+bool watch_set_files(Watch *w, const char **paths, int count)
+{
+	return false;
+}
+
+bool watch_wait(Watch *w, WatchFunc func, void *ctx)
+{
+	return false;
+}
+
+#endif  // __linux__
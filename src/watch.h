@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdbool.h>
+
+//
+// Waiting on changes to files, for rebuilding in --watch mode.
+//
+// The directories holding the files are watched rather than the files
+// themselves, so editors that save by replacing the file are noticed too.
+// Only supported on Linux, where inotify is available.
+//
+
+typedef struct WatchFile
+{
+	char path[256];  // As given to watch_set_files().
+	int wd;          // Watch descriptor of the containing directory.
+	const char *name;  // Points at the filename part of path.
+} WatchFile;
+
+typedef struct Watch
+{
+	int fd;
+	WatchFile *files;
+	int file_count;
+} Watch;
+
+// Callback for a watched file that changed.
+typedef void (*WatchFunc)(void *ctx, const char *path);
+
+bool watch_init(Watch *w);
+void watch_shutdown(Watch *w);
+
+// Replaces the set of watched files.
+bool watch_set_files(Watch *w, const char **paths, int count);
+
+// Blocks until at least one watched file changes, then calls func for each
+// changed file once things have settled down.
+bool watch_wait(Watch *w, WatchFunc func, void *ctx);
@@ -0,0 +1,96 @@
+#include "writer.h"
+#include <stdlib.h>
+#include <string.h>
+
+void writer_init(Writer *w, FILE *f)
+{
+	memset(w, 0, sizeof(*w));
+	w->f = f;
+}
+
+bool writer_flush(Writer *w)
+{
+	if (w->pos > 0 && !w->error)
+	{
+		if (!w->f || fwrite(w->buf, 1, w->pos, w->f) != w->pos) w->error = true;
+		else w->written += w->pos;
+	}
+	w->pos = 0;
+	return !w->error;
+}
+
+bool writer_shutdown(Writer *w)
+{
+	const bool ret = writer_flush(w);
+	free(w->buf);
+	w->buf = NULL;
+	w->size = 0;
+	return ret;
+}
+
+void writer_discard(Writer *w)
+{
+	free(w->buf);
+	writer_init(w, NULL);
+}
+
+bool writer_make_room(Writer *w, size_t len)
+{
+	if (w->error || len > WRITER_BUF_SIZE) return false;
+	if (!w->buf)
+	{
+		w->buf = malloc(WRITER_BUF_SIZE);
+		if (!w->buf)
+		{
+			fprintf(stderr, "[WRITER] Couldn't allocate buffer\n");
+			w->error = true;
+			return false;
+		}
+		w->size = WRITER_BUF_SIZE;
+		return true;
+	}
+	return writer_flush(w);
+}
+
+void writer_put_direct(Writer *w, const void *data, size_t len)
+{
+	if (!writer_flush(w)) return;
+	if (!w->f || fwrite(data, 1, len, w->f) != len) w->error = true;
+	else w->written += len;
+}
+
+void writer_put16be_array(Writer *w, const uint16_t *vals, size_t count)
+{
+	while (count > 0)
+	{
+		size_t n = count;
+		if (n > WRITER_BUF_SIZE / 2) n = WRITER_BUF_SIZE / 2;
+		uint8_t *d = writer_reserve(w, n * 2);
+		if (!d) return;
+		for (size_t i = 0; i < n; i++)
+		{
+			*d++ = (vals[i] >> 8) & 0xFF;
+			*d++ = vals[i] & 0xFF;
+		}
+		vals += n;
+		count -= n;
+	}
+}
+
+void writer_put16le_array(Writer *w, const uint16_t *vals, size_t count)
+{
+	while (count > 0)
+	{
+		size_t n = count;
+		if (n > WRITER_BUF_SIZE / 2) n = WRITER_BUF_SIZE / 2;
+		uint8_t *d = writer_reserve(w, n * 2);
+		if (!d) return;
+		for (size_t i = 0; i < n; i++)
+		{
+			*d++ = vals[i] & 0xFF;
+			*d++ = (vals[i] >> 8) & 0xFF;
+		}
+		vals += n;
+		count -= n;
+	}
+}
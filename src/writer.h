@@ -0,0 +1,115 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+//
+// Buffered binary output. Data is gathered in memory and handed to the file
+// in large blocks, so emitting a byte or a word is only a store.
+//
+
+#define WRITER_BUF_SIZE (256 * 1024)
+
+typedef struct Writer
+{
+	FILE *f;
+	uint8_t *buf;      // Allocated on first use.
+	size_t pos;        // Bytes waiting in buf.
+	size_t size;       // Capacity of buf.
+	size_t written;    // Bytes handed to the file so far.
+	bool error;        // A write or allocation has failed.
+} Writer;
+
+void writer_init(Writer *w, FILE *f);
+
+// Writes out anything buffered. Returns false if anything failed to write.
+bool writer_flush(Writer *w);
+
+// Flushes, then releases the buffer.
+bool writer_shutdown(Writer *w);
+
+// Releases the buffer, dropping anything not yet written.
+void writer_discard(Writer *w);
+
+// Flushes to make room for at least len more bytes.
+bool writer_make_room(Writer *w, size_t len);
+
+// Writes len bytes that don't need to go through the buffer.
+void writer_put_direct(Writer *w, const void *data, size_t len);
+
+// Total bytes written, including those still buffered.
+static inline size_t writer_tell(const Writer *w)
+{
+	return w->written + w->pos;
+}
+
+// Returns space for len bytes to be filled in by the caller, or NULL if the
+// buffer couldn't be set up.
+static inline uint8_t *writer_reserve(Writer *w, size_t len)
+{
+	if (w->size - w->pos < len && !writer_make_room(w, len)) return NULL;
+	uint8_t *ret = &w->buf[w->pos];
+	w->pos += len;
+	return ret;
+}
+
+static inline void writer_put(Writer *w, const void *data, size_t len)
+{
+	if (len > WRITER_BUF_SIZE)
+	{
+		writer_put_direct(w, data, len);
+		return;
+	}
+	uint8_t *d = writer_reserve(w, len);
+	if (d) memcpy(d, data, len);
+}
+
+static inline void writer_put8(Writer *w, uint8_t val)
+{
+	uint8_t *d = writer_reserve(w, 1);
+	if (d) d[0] = val;
+}
+
+// Motorola 68000 uses big-endian data.
+static inline void writer_put16be(Writer *w, uint16_t val)
+{
+	uint8_t *d = writer_reserve(w, 2);
+	if (!d) return;
+	d[0] = (val >> 8) & 0xFF;
+	d[1] = val & 0xFF;
+}
+
+static inline void writer_put16le(Writer *w, uint16_t val)
+{
+	uint8_t *d = writer_reserve(w, 2);
+	if (!d) return;
+	d[0] = val & 0xFF;
+	d[1] = (val >> 8) & 0xFF;
+}
+
+static inline void writer_put32be(Writer *w, uint32_t val)
+{
+	uint8_t *d = writer_reserve(w, 4);
+	if (!d) return;
+	d[0] = (val >> 24) & 0xFF;
+	d[1] = (val >> 16) & 0xFF;
+	d[2] = (val >> 8) & 0xFF;
+	d[3] = val & 0xFF;
+}
+
+static inline void writer_put32le(Writer *w, uint32_t val)
+{
+	uint8_t *d = writer_reserve(w, 4);
+	if (!d) return;
+	d[0] = val & 0xFF;
+	d[1] = (val >> 8) & 0xFF;
+	d[2] = (val >> 16) & 0xFF;
+	d[3] = (val >> 24) & 0xFF;
+}
+
+// Bulk versions for arrays of words.
+void writer_put16be_array(Writer *w, const uint16_t *vals, size_t count);
+void writer_put16le_array(Writer *w, const uint16_t *vals, size_t count);